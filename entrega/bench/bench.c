@@ -0,0 +1,85 @@
+#include "bench.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void bench_key(char *key, size_t i) {
+  static const char first[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+  snprintf(key, BENCH_KEY_SIZE, "%c:%zu", first[i % (sizeof(first) - 1)], i);
+}
+
+uint64_t bench_rand(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+size_t bench_heap_used(void) {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+size_t bench_arg(int argc, char **argv, int i, size_t def) {
+  if (i >= argc) {
+    return def;
+  }
+  return (size_t)strtoull(argv[i], NULL, 10);
+}
+
+HashTable *bench_table(void) {
+  static HashTable *anchor = NULL;
+  if (anchor == NULL) {
+    anchor = create_hash_table();
+    if (anchor == NULL) {
+      return NULL;
+    }
+  }
+  return create_hash_table();
+}
+
+int bench_put(HashTable *ht, const char *key, const char *value) {
+  uint64_t commit = commit_begin(ht);
+  int result = write_pair(ht, key, value, 0, commit);
+  commit_end(ht, commit);
+  table_maintenance(ht);
+  return result;
+}
+
+Cliente *bench_clients(size_t n, const char *notify_path) {
+  Cliente *clients = calloc(n, sizeof(Cliente));
+  if (clients == NULL) {
+    return NULL;
+  }
+  for (size_t i = 0; i < n; i++) {
+    clients[i].id = (int)i + 1;
+    clients[i].resp_pipe = -1;
+    clients[i].req_pipe = -1;
+    pthread_mutex_init(&clients[i].lock, NULL);
+    notify_queue_init(&clients[i].notif,
+                      notify_path != NULL ? notify_path : "/nonexistent",
+                      (unsigned)i);
+    if (notify_path == NULL) {
+      notify_close(&clients[i].notif);
+    }
+  }
+  return clients;
+}
+
+void bench_free_clients(Cliente *clients, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    notify_queue_destroy(&clients[i].notif);
+    pthread_mutex_destroy(&clients[i].lock);
+  }
+  free(clients);
+}
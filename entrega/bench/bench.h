@@ -0,0 +1,73 @@
+#ifndef KVS_BENCH_H
+#define KVS_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "src/server/kvs.h"
+
+#define BENCH_KEY_SIZE 24 // espaco para as chaves geradas por bench_key
+
+// Funcoes partilhadas pelos benchmarks (ver bench/README.md).
+// Os benchmarks usam diretamente as funcoes da tabela e das operacoes, sem
+// pipes nem clientes, para medir so o codigo do servidor.
+
+/// @brief retorna o tempo do relogio monotono
+/// @return o tempo em segundos
+double bench_now(void);
+
+/// @brief gera a i-esima chave dos benchmarks; a primeira letra percorre
+/// [a-z0-9], para as chaves se espalharem tambem pela tabela original (que
+/// escolhia a lista pela primeira letra)
+/// @param key onde fica a chave (BENCH_KEY_SIZE bytes)
+/// @param i o num da chave
+void bench_key(char *key, size_t i);
+
+/// @brief gerador pseudo-aleatorio (xorshift64*)
+/// @param state estado do gerador, diferente de 0
+/// @return o num seguinte
+uint64_t bench_rand(uint64_t *state);
+
+/// @brief retorna os bytes do heap em uso (malloc, incluindo os blocos
+/// grandes pedidos com mmap)
+/// @return os bytes em uso
+size_t bench_heap_used(void);
+
+/// @brief le o argumento i da linha de comandos como um num
+/// @param argc num de argumentos
+/// @param argv os argumentos
+/// @param i indice do argumento
+/// @param def valor se o argumento nao foi dado
+/// @return o valor
+size_t bench_arg(int argc, char **argv, int i, size_t def);
+
+/// @brief cria uma tabela vazia; a primeira tabela criada nunca e
+/// libertada, para as pools partilhadas pelas tabelas (que so podem ser
+/// inicializadas uma vez por processo) nao serem destruidas por free_table
+/// @return a tabela, NULL se nao havia memoria
+HashTable *bench_table(void);
+
+/// @brief escreve um par numa tabela usada por uma so thread, num commit so
+/// dele e com a manutencao (rehash) que o kvs_write faz depois
+/// @param ht a tabela
+/// @param key a chave
+/// @param value o valor
+/// @return 0 se deu certo, 1 se deu errado
+int bench_put(HashTable *ht, const char *key, const char *value);
+
+/// @brief cria clientes sem pipes de pedidos e respostas, com ids de 1 a n,
+/// para subscreverem chaves
+/// @param n num de clientes
+/// @param notify_path ficheiro onde as notificadoras escrevem as
+/// notificacoes de todos (por ex. /dev/null), NULL para as filas ficarem
+/// fechadas e as notificacoes serem codificadas mas deitadas fora
+/// @return array com os clientes, NULL se nao havia memoria
+Cliente *bench_clients(size_t n, const char *notify_path);
+
+/// @brief fecha as filas e liberta os clientes criados com bench_clients
+/// (ja sem subscricoes)
+/// @param clients os clientes
+/// @param n num de clientes
+void bench_free_clients(Cliente *clients, size_t n);
+
+#endif // KVS_BENCH_H
@@ -0,0 +1,135 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "src/server/pool.h"
+
+// Subscribe/unsubscribe em tempestade: cada thread (como as das sessoes)
+// tem os seus clientes e subscreve e tira a subscricao de chaves ao acaso,
+// com a stripe da chave bloqueada como o addSubscriber e o removeSubscriber.
+// Mede tambem alocar e libertar nos do tamanho de uma subscricao com uma
+// pool (como o servidor faz) e com o malloc (como fazia antes).
+// uso: bench/churn [max_threads] [ops_por_thread]
+
+#define CLIENTS_PER_THREAD 16
+#define KEYS 1000
+#define ALLOC_BURST 64 // nos alocados antes de os libertar
+
+typedef struct Worker {
+  pthread_t thread;
+  HashTable *ht;
+  Cliente *clients; //CLIENTS_PER_THREAD clientes desta thread
+  size_t ops;
+  bool use_pool;
+  int failed;
+} Worker;
+
+static Pool bench_pool;
+
+static void *churn(void *arg) {
+  Worker *w = arg;
+  uint64_t state = (uint64_t)(uintptr_t)w | 1;
+  char key[BENCH_KEY_SIZE];
+  for (size_t i = 0; i < w->ops; i++) {
+    Cliente *cliente = &w->clients[bench_rand(&state) % CLIENTS_PER_THREAD];
+    bench_key(key, bench_rand(&state) % KEYS);
+    uint64_t stripe = stripe_bit(key);
+    lock_stripes(w->ht, stripe, true);
+    w->failed |= addSubscription(w->ht, cliente, key);
+    unlock_stripes(w->ht, stripe);
+    lock_stripes(w->ht, stripe, true);
+    w->failed |= removeSubscription(w->ht, cliente, key);
+    unlock_stripes(w->ht, stripe);
+  }
+  return NULL;
+}
+
+static void *alloc_free(void *arg) {
+  Worker *w = arg;
+  void *nodes[ALLOC_BURST];
+  for (size_t i = 0; i < w->ops; i += ALLOC_BURST) {
+    for (size_t j = 0; j < ALLOC_BURST; j++) {
+      nodes[j] = w->use_pool ? pool_alloc(&bench_pool)
+                             : malloc(sizeof(Subscriptions));
+      w->failed |= nodes[j] == NULL;
+    }
+    for (size_t j = 0; j < ALLOC_BURST; j++) {
+      if (w->use_pool) {
+        pool_free(&bench_pool, nodes[j]);
+      } else {
+        free(nodes[j]);
+      }
+    }
+  }
+  return NULL;
+}
+
+//corre func em threads threads; retorna os segundos, -1 se deu erro
+static double run(Worker *workers, size_t threads, void *(*func)(void *)) {
+  double start = bench_now();
+  for (size_t t = 0; t < threads; t++) {
+    if (pthread_create(&workers[t].thread, NULL, func, &workers[t]) != 0) {
+      return -1;
+    }
+  }
+  int failed = 0;
+  for (size_t t = 0; t < threads; t++) {
+    pthread_join(workers[t].thread, NULL);
+    failed |= workers[t].failed;
+  }
+  double elapsed = bench_now() - start;
+  return failed ? -1 : elapsed;
+}
+
+int main(int argc, char **argv) {
+  size_t max_threads = bench_arg(argc, argv, 1, 8);
+  size_t ops = bench_arg(argc, argv, 2, 200000);
+  HashTable *ht = bench_table();
+  Cliente *clients = bench_clients(max_threads * CLIENTS_PER_THREAD, NULL);
+  Worker *workers = calloc(max_threads, sizeof(Worker));
+  if (ht == NULL || clients == NULL || workers == NULL ||
+      pool_init(&bench_pool, "bench", sizeof(Subscriptions)) != 0) {
+    fprintf(stderr, "Failed to set up the benchmark\n");
+    return 1;
+  }
+  char key[BENCH_KEY_SIZE];
+  for (size_t i = 0; i < KEYS; i++) {
+    bench_key(key, i);
+    if (bench_put(ht, key, "value") != 0) {
+      fprintf(stderr, "Failed to write pair\n");
+      return 1;
+    }
+  }
+
+  printf("%8s %14s %14s %14s\n", "threads", "sub+unsub/s", "pool ns", "malloc ns");
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    for (size_t t = 0; t < threads; t++) {
+      workers[t] = (Worker){.ht = ht,
+                            .clients = &clients[t * CLIENTS_PER_THREAD],
+                            .ops = ops};
+    }
+    double churn_s = run(workers, threads, churn);
+    for (size_t t = 0; t < threads; t++) {
+      workers[t].use_pool = true;
+    }
+    double pool_s = run(workers, threads, alloc_free);
+    for (size_t t = 0; t < threads; t++) {
+      workers[t].use_pool = false;
+    }
+    double malloc_s = run(workers, threads, alloc_free);
+    if (churn_s < 0 || pool_s < 0 || malloc_s < 0) {
+      fprintf(stderr, "Failed to run with %zu threads\n", threads);
+      return 1;
+    }
+    //ns por par alocar+libertar, somando o tempo de todas as threads
+    double total = (double)(threads * ops);
+    printf("%8zu %14.0f %14.1f %14.1f\n", threads, total / churn_s,
+           pool_s / total * 1e9, malloc_s / total * 1e9);
+    fflush(stdout);
+  }
+  free(workers);
+  bench_free_clients(clients, max_threads * CLIENTS_PER_THREAD);
+  free_table(ht);
+  return 0;
+}
@@ -0,0 +1,166 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench/bench.h"
+#include "src/server/snapshot.h"
+
+// READs com varios leitores e um escritor a escrever ao mesmo tempo, pelos
+// dois caminhos de leitura do servidor: sem locks (snapshot e sequencias das
+// stripes, como o kvs_read) e com a stripe da chave bloqueada para leitura
+// (o rwlock, como antes das leituras sem locks).
+// uso: bench/contention [max_leitores] [chaves] [ms_por_medida]
+
+#define READ_RETRIES 3 // como no kvs_read: depois disto bloqueia a stripe
+
+typedef struct Run {
+  HashTable *ht;
+  size_t keys;
+  bool lock_free;
+  atomic_bool stop;
+  atomic_size_t reads;
+  atomic_size_t writes;
+} Run;
+
+//READ de uma chave sem locks, com o snapshot e as sequencias das stripes
+static int read_lock_free(HashTable *ht, const char *key, char *value,
+                          size_t size) {
+  uint64_t stripes = stripe_bit(key);
+  unsigned seqs[NUM_STRIPES];
+  uint64_t snapshot = snapshot_begin(&ht->clock->visible_commit);
+  int missing = 1;
+  bool consistente = false;
+  for (int tentativa = 0; tentativa < READ_RETRIES && !consistente;
+       tentativa++) {
+    if (!read_stripes_begin(ht, stripes, seqs)) {
+      break;
+    }
+    missing = read_pair(ht, key, value, size, snapshot);
+    consistente = read_stripes_validate(ht, stripes, seqs);
+  }
+  if (!consistente) {
+    lock_stripes(ht, stripes, false);
+    missing = read_pair(ht, key, value, size, snapshot);
+    unlock_stripes(ht, stripes);
+  }
+  snapshot_end();
+  return missing;
+}
+
+//READ de uma chave com a stripe bloqueada para leitura
+static int read_locked(HashTable *ht, const char *key, char *value,
+                       size_t size) {
+  uint64_t stripes = stripe_bit(key);
+  lock_stripes(ht, stripes, false);
+  int missing = read_pair(ht, key, value, size, SNAPSHOT_LATEST);
+  unlock_stripes(ht, stripes);
+  return missing;
+}
+
+static void *reader(void *arg) {
+  Run *run = arg;
+  uint64_t state = (uint64_t)pthread_self() | 1;
+  char key[BENCH_KEY_SIZE], value[MAX_STRING_SIZE];
+  size_t reads = 0;
+  while (!atomic_load_explicit(&run->stop, memory_order_relaxed)) {
+    bench_key(key, bench_rand(&state) % run->keys);
+    if (run->lock_free) {
+      read_lock_free(run->ht, key, value, sizeof(value));
+    } else {
+      read_locked(run->ht, key, value, sizeof(value));
+    }
+    reads++;
+  }
+  atomic_fetch_add(&run->reads, reads);
+  return NULL;
+}
+
+//reescreve chaves ao acaso, cada uma no seu commit
+static void *writer(void *arg) {
+  Run *run = arg;
+  uint64_t state = 0x9e3779b97f4a7c15;
+  char key[BENCH_KEY_SIZE], value[BENCH_KEY_SIZE];
+  size_t writes = 0;
+  while (!atomic_load_explicit(&run->stop, memory_order_relaxed)) {
+    bench_key(key, bench_rand(&state) % run->keys);
+    snprintf(value, sizeof(value), "v%zu", writes);
+    uint64_t stripes = stripe_bit(key);
+    lock_stripes(run->ht, stripes, true);
+    uint64_t commit = commit_begin(run->ht);
+    write_pair(run->ht, key, value, 0, commit);
+    commit_end(run->ht, commit);
+    unlock_stripes(run->ht, stripes);
+    table_maintenance(run->ht);
+    writes++;
+  }
+  atomic_fetch_add(&run->writes, writes);
+  return NULL;
+}
+
+//mede durante ms milissegundos; retorna 0 se deu certo
+static int measure(Run *run, size_t readers, unsigned ms) {
+  pthread_t threads[readers + 1];
+  atomic_store(&run->stop, false);
+  atomic_store(&run->reads, 0);
+  atomic_store(&run->writes, 0);
+  for (size_t i = 0; i < readers; i++) {
+    if (pthread_create(&threads[i], NULL, reader, run) != 0) {
+      return 1;
+    }
+  }
+  if (pthread_create(&threads[readers], NULL, writer, run) != 0) {
+    return 1;
+  }
+  double start = bench_now();
+  struct timespec duration = {ms / 1000, (long)(ms % 1000) * 1000000};
+  nanosleep(&duration, NULL);
+  atomic_store(&run->stop, true);
+  for (size_t i = 0; i <= readers; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double elapsed = bench_now() - start;
+  printf("%8zu %10s %14.0f %14.0f\n", readers,
+         run->lock_free ? "lock-free" : "rwlock",
+         (double)atomic_load(&run->reads) / elapsed,
+         (double)atomic_load(&run->writes) / elapsed);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t max_readers = bench_arg(argc, argv, 1, 8);
+  size_t keys = bench_arg(argc, argv, 2, 100000);
+  unsigned ms = (unsigned)bench_arg(argc, argv, 3, 1000);
+
+  static Run run;
+  run.ht = bench_table();
+  run.keys = keys;
+  if (run.ht == NULL) {
+    fprintf(stderr, "Failed to create table\n");
+    return 1;
+  }
+  char key[BENCH_KEY_SIZE];
+  for (size_t i = 0; i < keys; i++) {
+    bench_key(key, i);
+    if (bench_put(run.ht, key, "value") != 0) {
+      fprintf(stderr, "Failed to write pair\n");
+      return 1;
+    }
+  }
+
+  printf("%8s %10s %14s %14s\n", "readers", "path", "reads/s", "writes/s");
+  for (size_t readers = 1; readers <= max_readers; readers *= 2) {
+    run.lock_free = true;
+    if (measure(&run, readers, ms) != 0) {
+      return 1;
+    }
+    run.lock_free = false;
+    if (measure(&run, readers, ms) != 0) {
+      return 1;
+    }
+  }
+  free_table(run.ht);
+  return 0;
+}
@@ -0,0 +1,141 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench/bench.h"
+#include "bench/legacy.h"
+
+// Desconexao em massa: C clientes subscrevem as mesmas K chaves e depois
+// desligam-se todos, pela ordem em que chegaram. Com as subscricoes
+// atuais (cada uma e uma so aresta, ligada ao cliente e guardada no
+// conjunto dos subscritores do par) e com as originais (copiadas em
+// `legacy.c`), em que tirar uma subscricao percorre a lista dos
+// subscritores do par a procura do cliente.
+// uso: bench/disconnect [max_clientes]
+
+typedef struct Shape {
+  size_t clients;
+  size_t keys;
+} Shape;
+
+static const Shape shapes[] = {
+    {100, 10}, {1000, 10}, {10000, 10}, {1000, 100}, {100, 1000},
+};
+
+//o disconnectClient sem as tabelas globais: tira sempre a primeira
+//subscricao, com a stripe da chave bloqueada
+static int disconnect(HashTable *ht, Cliente *cliente) {
+  while (1) {
+    char key[MAX_STRING_SIZE + 1];
+    pthread_mutex_lock(&cliente->lock);
+    Subscriptions *first = cliente->head_subscricoes;
+    if (first == NULL) {
+      pthread_mutex_unlock(&cliente->lock);
+      return 0;
+    }
+    strcpy(key, first->par->key);
+    pthread_mutex_unlock(&cliente->lock);
+    uint64_t stripe = stripe_bit(key);
+    lock_stripes(ht, stripe, true);
+    int result = removeFirstSubscription(cliente, first);
+    unlock_stripes(ht, stripe);
+    if (result != 0) {
+      return 1;
+    }
+  }
+}
+
+//ns por subscricao com as subscricoes atuais, -1 se deu erro
+static double current_run(const Shape *shape) {
+  HashTable *ht = bench_table();
+  Cliente *clients = bench_clients(shape->clients, NULL);
+  if (ht == NULL || clients == NULL) {
+    return -1;
+  }
+  char key[BENCH_KEY_SIZE];
+  for (size_t k = 0; k < shape->keys; k++) {
+    bench_key(key, k);
+    if (bench_put(ht, key, "value") != 0) {
+      return -1;
+    }
+  }
+  for (size_t i = 0; i < shape->clients; i++) {
+    for (size_t k = 0; k < shape->keys; k++) {
+      bench_key(key, k);
+      uint64_t stripe = stripe_bit(key);
+      lock_stripes(ht, stripe, true);
+      int failed = addSubscription(ht, &clients[i], key);
+      unlock_stripes(ht, stripe);
+      if (failed) {
+        return -1;
+      }
+    }
+  }
+  int failed = 0;
+  double start = bench_now();
+  for (size_t i = 0; i < shape->clients; i++) {
+    failed |= disconnect(ht, &clients[i]);
+  }
+  double elapsed = bench_now() - start;
+  bench_free_clients(clients, shape->clients);
+  free_table(ht);
+  return failed ? -1
+                : elapsed / (double)(shape->clients * shape->keys) * 1e9;
+}
+
+//ns por subscricao com as subscricoes originais, -1 se deu erro
+static double legacy_run(const Shape *shape) {
+  LegacyTable *lt = legacy_create();
+  LegacyClient *clients = calloc(shape->clients, sizeof(LegacyClient));
+  if (lt == NULL || clients == NULL) {
+    return -1;
+  }
+  char key[BENCH_KEY_SIZE];
+  for (size_t k = 0; k < shape->keys; k++) {
+    bench_key(key, k);
+    if (legacy_insert(lt, key, "value") != 0) {
+      return -1;
+    }
+  }
+  for (size_t i = 0; i < shape->clients; i++) {
+    clients[i].id = (int)i + 1;
+    for (size_t k = 0; k < shape->keys; k++) {
+      bench_key(key, k);
+      if (legacy_subscribe(lt, &clients[i], key) != 0) {
+        return -1;
+      }
+    }
+  }
+  int failed = 0;
+  double start = bench_now();
+  for (size_t i = 0; i < shape->clients; i++) {
+    failed |= legacy_disconnect(&clients[i]);
+  }
+  double elapsed = bench_now() - start;
+  free(clients);
+  legacy_free(lt);
+  return failed ? -1
+                : elapsed / (double)(shape->clients * shape->keys) * 1e9;
+}
+
+int main(int argc, char **argv) {
+  size_t max_clients = bench_arg(argc, argv, 1, 10000);
+  printf("%8s %8s %12s %12s\n", "clients", "keys", "ns/sub", "original");
+  for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+    if (shapes[s].clients > max_clients) {
+      continue;
+    }
+    double current = current_run(&shapes[s]);
+    double legacy = legacy_run(&shapes[s]);
+    if (current < 0 || legacy < 0) {
+      fprintf(stderr, "Failed to run %zu clients with %zu keys\n",
+              shapes[s].clients, shapes[s].keys);
+      return 1;
+    }
+    printf("%8zu %8zu %12.1f %12.1f\n", shapes[s].clients, shapes[s].keys,
+           current, legacy);
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "bench/legacy.h"
+
+// Custo de cada subscritor a mais quando uma chave muda: 1, 10, 100, ...
+// `max_subs` clientes subscrevem a mesma chave e a chave muda varias vezes,
+// com a notificacao posta na fila de cada um. As filas estao abertas e as
+// notificadoras escrevem-nas em /dev/null, como escreveriam nos pipes dos
+// clientes.
+// - partilhada: o notificarSubs, que codifica a mensagem uma vez e poe a
+//   mesma nas filas de todos
+// - por subscritor: como antes, uma mensagem por subscritor, feita com o
+//   pad_string original (que chama o strlen a cada byte)
+// uso: bench/fanout [max_subs] [notificacoes]
+
+#define FANOUT_KEY "tenant07:eu-west:object:00000123"
+
+//uma mensagem por subscritor, como o notificarSubs antes de as partilhar
+static int notify_each(KeyNode *par, const char *value) {
+  SubscriberSet *set = par->subscribers;
+  for (size_t i = 0; set != NULL && i < set->count; i++) {
+    //o frame vem da pool das notificacoes; a mensagem e refeita com o
+    //pad_string original por cima da que o notify_frame fez
+    NotifyFrame *frame = notify_frame("", "");
+    if (frame == NULL) {
+      return 1;
+    }
+    legacy_pad_string(&frame->data[0], par->key, 41);
+    legacy_pad_string(&frame->data[41], value, 41);
+    notify_push(&set->members[i]->notif, frame);
+    notify_frame_release(frame);
+  }
+  return 0;
+}
+
+//muda a chave changes vezes; retorna os ns por subscritor, -1 se deu erro
+static double run(KeyNode *par, size_t subs, size_t changes, bool shared) {
+  char value[BENCH_KEY_SIZE];
+  int failed = 0;
+  double start = bench_now();
+  for (size_t i = 0; i < changes; i++) {
+    snprintf(value, sizeof(value), "v%zu", i);
+    failed |= shared ? notificarSubs(par, value) : notify_each(par, value);
+  }
+  double elapsed = bench_now() - start;
+  return failed ? -1 : elapsed / (double)(changes * subs) * 1e9;
+}
+
+int main(int argc, char **argv) {
+  size_t max_subs = bench_arg(argc, argv, 1, 10000);
+  size_t notifications = bench_arg(argc, argv, 2, 2000000);
+  HashTable *ht = bench_table();
+  Cliente *clients = bench_clients(max_subs, "/dev/null");
+  if (ht == NULL || clients == NULL || bench_put(ht, FANOUT_KEY, "value") != 0) {
+    fprintf(stderr, "Failed to set up the benchmark\n");
+    return 1;
+  }
+
+  char key[] = FANOUT_KEY;
+  uint64_t stripe = stripe_bit(key);
+  printf("%12s %14s %16s\n", "subscribers", "shared ns/sub", "per-sub ns/sub");
+  size_t subscribed = 0;
+  for (size_t subs = 1; subs <= max_subs; subs *= 10) {
+    lock_stripes(ht, stripe, true);
+    for (; subscribed < subs; subscribed++) {
+      if (addSubscription(ht, &clients[subscribed], key) != 0) {
+        fprintf(stderr, "Failed to subscribe\n");
+        return 1;
+      }
+    }
+    //as notificacoes sao feitas com a stripe bloqueada, como no WRITE
+    KeyNode *par = getKeyNode(ht, key);
+    size_t changes = notifications / subs > 0 ? notifications / subs : 1;
+    double shared = run(par, subs, changes, true);
+    double each = run(par, subs, changes, false);
+    unlock_stripes(ht, stripe);
+    if (shared < 0 || each < 0) {
+      fprintf(stderr, "Failed to notify %zu subscribers\n", subs);
+      return 1;
+    }
+    printf("%12zu %14.1f %16.1f\n", subs, shared, each);
+    fflush(stdout);
+  }
+
+  lock_stripes(ht, stripe, true);
+  for (size_t i = 0; i < subscribed; i++) {
+    removeSubscription(ht, &clients[i], key);
+  }
+  unlock_stripes(ht, stripe);
+  bench_free_clients(clients, max_subs);
+  free_table(ht);
+  return 0;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+// inclui a tabela inteira para chegar as comparacoes de chaves (static)
+#include "src/server/kvs.c"
+
+// Comparacao de chaves ao percorrer listas longas de pares com chaves que
+// so diferem no fim (como "tenant07:eu-west:object:00000123"), procurando a
+// ultima da lista: com strcmp (como antes das chaves com padding), com a
+// comparacao escalar de 8 em 8 bytes e com SSE2 e AVX2. Todos os pares tem
+// o mesmo hash, como numa colisao, para cada passo comparar as chaves; a
+// ultima coluna e a procura normal, que compara primeiro os hashes.
+// uso: bench/keycmp [max_lista] [procuras]
+
+typedef bool (*KeyEqual)(const char *, const char *);
+
+//ns por par percorrido com esta comparacao (strcmp se equal e NULL)
+static double walk(KeyNode *head, const char *probe, uint64_t h,
+                   KeyEqual equal, size_t lookups, size_t length) {
+  size_t hits = 0;
+  double start = bench_now();
+  for (size_t i = 0; i < lookups; i++) {
+    for (KeyNode *keyNode = head; keyNode != NULL; keyNode = keyNode->next) {
+      if (keyNode->hash == h &&
+          (equal != NULL ? equal(keyNode->key, probe)
+                         : strcmp(keyNode->key, probe) == 0)) {
+        hits++;
+        break;
+      }
+    }
+  }
+  double elapsed = bench_now() - start;
+  return hits == lookups ? elapsed / (double)(lookups * length) * 1e9 : -1;
+}
+
+int main(int argc, char **argv) {
+  size_t max_length = bench_arg(argc, argv, 1, 256);
+  size_t lookups = bench_arg(argc, argv, 2, 200000);
+  KeyNode *nodes = aligned_alloc(_Alignof(KeyNode), max_length * sizeof(KeyNode));
+  if (nodes == NULL || max_length == 0) {
+    fprintf(stderr, "usage: %s [max_length] [lookups]\n", argv[0]);
+    return 1;
+  }
+  __builtin_cpu_init();
+  bool avx2 = __builtin_cpu_supports("avx2");
+
+  printf("%8s %10s %10s %10s %10s %10s\n", "chain", "strcmp", "scalar",
+         "sse2", "avx2", "hashed");
+  for (size_t length = 4; length <= max_length; length *= 4) {
+    //a lista e um array seguido, como um bucket cheio com os pares por ordem
+    for (size_t i = 0; i < length; i++) {
+      KeyNode *keyNode = &nodes[i];
+      memset(keyNode->key, 0, KEY_SLOT_SIZE);
+      snprintf(keyNode->key, KEY_SLOT_SIZE, "tenant07:eu-west:object:%08zu", i);
+      keyNode->hash = 1;
+      keyNode->next = i + 1 < length ? &nodes[i + 1] : NULL;
+    }
+    char probe[KEY_SLOT_SIZE];
+    memcpy(probe, nodes[length - 1].key, KEY_SLOT_SIZE);
+    size_t n = lookups / length + 1;
+    double with_strcmp = walk(nodes, probe, 1, NULL, n, length);
+    double scalar = walk(nodes, probe, 1, key_equal_scalar, n, length);
+    double sse2 = walk(nodes, probe, 1, key_equal_sse2, n, length);
+    double avx = avx2 ? walk(nodes, probe, 1, key_equal_avx2, n, length) : 0;
+    //hashes distintos: so o ultimo par compara a chave
+    for (size_t i = 0; i < length; i++) {
+      nodes[i].hash = hash(nodes[i].key);
+    }
+    double hashed = walk(nodes, probe, nodes[length - 1].hash, key_equal_sse2,
+                         n, length);
+    printf("%8zu %10.2f %10.2f %10.2f %10.2f %10.2f\n", length, with_strcmp,
+           scalar, sse2, avx, hashed);
+  }
+  free(nodes);
+  return 0;
+}
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench/bench.h"
+
+// Memoria e procuras com o par antes e depois de ter a chave e o valor no
+// proprio no. As duas disposicoes sao postas na mesma tabela simples (um
+// bucket por chave, escolhido pelo hash), para so mudar o no:
+// - ponteiros: o no de antes, com a chave e o valor em blocos a parte
+//   (tres alocacoes por par, a chave comparada com strcmp atraves do ponteiro)
+// - inline: o no de 128 bytes alinhado as linhas de cache, com o hash
+//   guardado, a chave e o valor la dentro (uma alocacao por par)
+// A ultima coluna e a tabela do servidor como esta agora (com as versoes do
+// MVCC e o indice ordenado, que tambem ocupam memoria por par).
+// uso: bench/layout [max_chaves] [procuras]
+
+typedef struct PointerNode {
+  char *key;
+  char *value;
+  void *subscribers; //nunca usado aqui, so para o no ter o tamanho de antes
+  struct PointerNode *next;
+} PointerNode;
+
+typedef struct InlineNode {
+  _Alignas(64) uint64_t hash;
+  struct InlineNode *next;
+  char key[KEY_SLOT_SIZE];
+  void *subscribers; //nunca usado aqui
+  uint8_t key_len;
+  uint8_t value_len;
+  char value[MAX_STRING_SIZE + 1];
+} InlineNode;
+
+_Static_assert(sizeof(InlineNode) == 128, "o no inline ocupa duas linhas de cache");
+
+typedef struct Result {
+  double bytes; //bytes do heap por par
+  double ns; //ns por procura
+} Result;
+
+static size_t buckets_for(size_t n) {
+  size_t size = 1;
+  while (size < n) {
+    size *= 2;
+  }
+  return size;
+}
+
+static int pointer_run(size_t n, char (*probes)[BENCH_KEY_SIZE],
+                       size_t lookups, Result *result) {
+  size_t size = buckets_for(n);
+  size_t before = bench_heap_used();
+  PointerNode **buckets = calloc(size, sizeof(PointerNode *));
+  if (buckets == NULL) {
+    return 1;
+  }
+  char key[BENCH_KEY_SIZE];
+  for (size_t i = 0; i < n; i++) {
+    bench_key(key, i);
+    PointerNode *node = malloc(sizeof(PointerNode));
+    if (node == NULL) {
+      return 1;
+    }
+    node->key = strdup(key);
+    node->value = strdup("value");
+    node->subscribers = NULL;
+    size_t b = hash(key) & (size - 1);
+    node->next = buckets[b];
+    buckets[b] = node;
+  }
+  result->bytes = (double)(bench_heap_used() - before) / (double)n;
+
+  char value[MAX_STRING_SIZE + 1];
+  size_t hits = 0;
+  double start = bench_now();
+  for (size_t i = 0; i < lookups; i++) {
+    for (PointerNode *node = buckets[hash(probes[i]) & (size - 1)];
+         node != NULL; node = node->next) {
+      if (strcmp(node->key, probes[i]) == 0) {
+        memcpy(value, node->value, strlen(node->value) + 1);
+        hits++;
+        break;
+      }
+    }
+  }
+  result->ns = (bench_now() - start) / (double)lookups * 1e9;
+
+  for (size_t b = 0; b < size; b++) {
+    PointerNode *node = buckets[b];
+    while (node != NULL) {
+      PointerNode *next = node->next;
+      free(node->key);
+      free(node->value);
+      free(node);
+      node = next;
+    }
+  }
+  free(buckets);
+  return hits != lookups;
+}
+
+static int inline_run(size_t n, char (*probes)[BENCH_KEY_SIZE],
+                      size_t lookups, Result *result) {
+  size_t size = buckets_for(n);
+  size_t before = bench_heap_used();
+  InlineNode **buckets = calloc(size, sizeof(InlineNode *));
+  if (buckets == NULL) {
+    return 1;
+  }
+  char key[BENCH_KEY_SIZE];
+  for (size_t i = 0; i < n; i++) {
+    bench_key(key, i);
+    InlineNode *node = aligned_alloc(_Alignof(InlineNode), sizeof(InlineNode));
+    if (node == NULL) {
+      return 1;
+    }
+    memset(node->key, 0, sizeof(node->key));
+    node->key_len = (uint8_t)strlen(key);
+    memcpy(node->key, key, node->key_len);
+    node->value_len = (uint8_t)strlen("value");
+    memcpy(node->value, "value", node->value_len + 1);
+    node->subscribers = NULL;
+    node->hash = hash(key);
+    size_t b = node->hash & (size - 1);
+    node->next = buckets[b];
+    buckets[b] = node;
+  }
+  result->bytes = (double)(bench_heap_used() - before) / (double)n;
+
+  char value[MAX_STRING_SIZE + 1];
+  size_t hits = 0;
+  double start = bench_now();
+  for (size_t i = 0; i < lookups; i++) {
+    uint64_t h = hash(probes[i]);
+    for (InlineNode *node = buckets[h & (size - 1)]; node != NULL;
+         node = node->next) {
+      if (node->hash == h && strcmp(node->key, probes[i]) == 0) {
+        memcpy(value, node->value, node->value_len + 1u);
+        hits++;
+        break;
+      }
+    }
+  }
+  result->ns = (bench_now() - start) / (double)lookups * 1e9;
+
+  for (size_t b = 0; b < size; b++) {
+    InlineNode *node = buckets[b];
+    while (node != NULL) {
+      InlineNode *next = node->next;
+      free(node);
+      node = next;
+    }
+  }
+  free(buckets);
+  return hits != lookups;
+}
+
+static int table_run(size_t n, char (*probes)[BENCH_KEY_SIZE],
+                     size_t lookups, Result *result) {
+  size_t before = bench_heap_used();
+  HashTable *ht = bench_table();
+  if (ht == NULL) {
+    return 1;
+  }
+  char key[BENCH_KEY_SIZE];
+  for (size_t i = 0; i < n; i++) {
+    bench_key(key, i);
+    if (bench_put(ht, key, "value") != 0) {
+      free_table(ht);
+      return 1;
+    }
+  }
+  result->bytes = (double)(bench_heap_used() - before) / (double)n;
+
+  char value[MAX_STRING_SIZE + 1];
+  size_t hits = 0;
+  double start = bench_now();
+  for (size_t i = 0; i < lookups; i++) {
+    hits += read_pair(ht, probes[i], value, sizeof(value), SNAPSHOT_LATEST) == 0;
+  }
+  result->ns = (bench_now() - start) / (double)lookups * 1e9;
+  free_table(ht);
+  return hits != lookups;
+}
+
+int main(int argc, char **argv) {
+  size_t max_keys = bench_arg(argc, argv, 1, 1000000);
+  size_t lookups = bench_arg(argc, argv, 2, 1000000);
+  char (*probes)[BENCH_KEY_SIZE] = malloc(lookups * BENCH_KEY_SIZE);
+  if (probes == NULL || lookups == 0) {
+    fprintf(stderr, "usage: %s [max_keys] [lookups]\n", argv[0]);
+    return 1;
+  }
+  //a tabela ancora de bench_table fica fora das contas
+  HashTable *warmup = bench_table();
+  if (warmup == NULL) {
+    return 1;
+  }
+  free_table(warmup);
+
+  printf("%10s %10s %10s %10s %10s %10s %10s\n", "keys", "ptr B", "ptr ns",
+         "inline B", "inline ns", "table B", "table ns");
+  for (size_t n = 1000; n <= max_keys; n *= 10) {
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < lookups; i++) {
+      bench_key(probes[i], bench_rand(&seed) % n);
+    }
+    Result pointers, inlined, table;
+    if (pointer_run(n, probes, lookups, &pointers) != 0 ||
+        inline_run(n, probes, lookups, &inlined) != 0 ||
+        table_run(n, probes, lookups, &table) != 0) {
+      fprintf(stderr, "Failed to fill the tables with %zu keys\n", n);
+      free(probes);
+      return 1;
+    }
+    printf("%10zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", n,
+           pointers.bytes, pointers.ns, inlined.bytes, inlined.ns, table.bytes,
+           table.ns);
+    fflush(stdout);
+  }
+  free(probes);
+  return 0;
+}
@@ -0,0 +1,165 @@
+#include "legacy.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+//hash original: a primeira letra da chave
+static int legacy_hash(const char *key) {
+  int firstLetter = tolower(key[0]);
+  if (firstLetter >= 'a' && firstLetter <= 'z') {
+    return firstLetter - 'a';
+  } else if (firstLetter >= '0' && firstLetter <= '9') {
+    return firstLetter - '0';
+  }
+  return -1;
+}
+
+LegacyTable *legacy_create(void) {
+  return calloc(1, sizeof(LegacyTable));
+}
+
+int legacy_insert(LegacyTable *lt, const char *key, const char *value) {
+  int index = legacy_hash(key);
+  if (index < 0) {
+    return 1;
+  }
+  LegacyNode *keyNode = malloc(sizeof(LegacyNode));
+  if (keyNode == NULL) {
+    return 1;
+  }
+  keyNode->key = strdup(key);
+  keyNode->value = strdup(value);
+  keyNode->head_subscribers = NULL;
+  keyNode->next = lt->table[index];
+  lt->table[index] = keyNode;
+  return 0;
+}
+
+//par com a chave, NULL se nao existe
+static LegacyNode *legacy_find(LegacyTable *lt, const char *key) {
+  int index = legacy_hash(key);
+  if (index < 0) {
+    return NULL;
+  }
+  for (LegacyNode *keyNode = lt->table[index]; keyNode != NULL;
+       keyNode = keyNode->next) {
+    if (strcmp(keyNode->key, key) == 0) {
+      return keyNode;
+    }
+  }
+  return NULL;
+}
+
+char *legacy_read(LegacyTable *lt, const char *key) {
+  LegacyNode *keyNode = legacy_find(lt, key);
+  return keyNode != NULL ? strdup(keyNode->value) : NULL;
+}
+
+int legacy_subscribe(LegacyTable *lt, LegacyClient *cliente, const char *key) {
+  LegacyNode *par = legacy_find(lt, key);
+  if (par == NULL) {
+    return 1;
+  }
+  //alreadySubbed: percorre os subscritores do par
+  for (LegacySubscribers *subAtual = par->head_subscribers; subAtual != NULL;
+       subAtual = subAtual->next) {
+    if (subAtual->subscriber->id == cliente->id) {
+      return 0;
+    }
+  }
+  LegacySubscribers *newSubscriber = malloc(sizeof(LegacySubscribers));
+  LegacySubscriptions *newSub = malloc(sizeof(LegacySubscriptions));
+  if (newSubscriber == NULL || newSub == NULL) {
+    free(newSubscriber);
+    free(newSub);
+    return 1;
+  }
+  newSubscriber->subscriber = cliente;
+  newSubscriber->next = par->head_subscribers;
+  par->head_subscribers = newSubscriber;
+  newSub->par = par;
+  newSub->next = cliente->head_subscricoes;
+  cliente->head_subscricoes = newSub;
+  cliente->num_subscricoes++;
+  return 0;
+}
+
+//removeSubscriberTable: procura o cliente na lista dos subscritores do par
+static int legacy_remove_subscriber(LegacyNode *par, LegacyClient *cliente) {
+  LegacySubscribers *subscriber_prev = NULL;
+  for (LegacySubscribers *subscriber_atual = par->head_subscribers;
+       subscriber_atual != NULL; subscriber_atual = subscriber_atual->next) {
+    if (subscriber_atual->subscriber->id == cliente->id) {
+      if (subscriber_prev != NULL) {
+        subscriber_prev->next = subscriber_atual->next;
+      } else {
+        par->head_subscribers = subscriber_atual->next;
+      }
+      free(subscriber_atual);
+      return 0;
+    }
+    subscriber_prev = subscriber_atual;
+  }
+  return 1;
+}
+
+//removeSubscription: procura a chave na lista das subscricoes do cliente
+static int legacy_unsubscribe(LegacyClient *cliente, const char *key) {
+  LegacySubscriptions *subscricao_prev = NULL;
+  for (LegacySubscriptions *subscricao_atual = cliente->head_subscricoes;
+       subscricao_atual != NULL; subscricao_atual = subscricao_atual->next) {
+    if (strcmp(subscricao_atual->par->key, key) == 0) {
+      if (legacy_remove_subscriber(subscricao_atual->par, cliente) != 0) {
+        return 1;
+      }
+      if (subscricao_prev != NULL) {
+        subscricao_prev->next = subscricao_atual->next;
+      } else {
+        cliente->head_subscricoes = subscricao_atual->next;
+      }
+      free(subscricao_atual);
+      cliente->num_subscricoes--;
+      return 0;
+    }
+    subscricao_prev = subscricao_atual;
+  }
+  return 1;
+}
+
+int legacy_disconnect(LegacyClient *cliente) {
+  LegacySubscriptions *subscricao_atual = cliente->head_subscricoes;
+  while (subscricao_atual != NULL) {
+    const char *key = subscricao_atual->par->key;
+    //tem de ser antes, pois a subscricao e libertada
+    subscricao_atual = subscricao_atual->next;
+    if (legacy_unsubscribe(cliente, key) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void legacy_free(LegacyTable *lt) {
+  for (int i = 0; i < LEGACY_TABLE_SIZE; i++) {
+    LegacyNode *keyNode = lt->table[i];
+    while (keyNode != NULL) {
+      LegacyNode *next = keyNode->next;
+      free(keyNode->key);
+      free(keyNode->value);
+      free(keyNode);
+      keyNode = next;
+    }
+  }
+  free(lt);
+}
+
+void legacy_pad_string(char *message, const char *str, int length) {
+  for (size_t i = 0; i < (size_t)length; i++) {
+    if (i < strlen(str)) {
+      message[i] = str[i];
+    } else {
+      message[i] = '\0';
+    }
+  }
+}
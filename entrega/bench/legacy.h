@@ -0,0 +1,90 @@
+#ifndef KVS_BENCH_LEGACY_H
+#define KVS_BENCH_LEGACY_H
+
+#include <stddef.h>
+
+// Copia da tabela do servidor original, so para comparar com a atual nos
+// benchmarks: 26 listas ligadas escolhidas pela primeira letra da chave
+// (os digitos caem nas listas de 'a' a 'j'), com a chave e o valor em blocos
+// a parte do no e um strdup do valor em cada leitura. Tem tambem as
+// subscricoes originais (uma lista ligada de pares em cada cliente e uma
+// de clientes em cada par, percorridas para tirar uma subscricao) e o
+// pad_string original, que fazia as mensagens das notificacoes.
+
+#define LEGACY_TABLE_SIZE 26
+
+struct LegacyClient;
+
+typedef struct LegacySubscribers {
+  struct LegacyClient *subscriber; //cliente associado a subscricao
+  struct LegacySubscribers *next; //proximo subscritor
+} LegacySubscribers;
+
+typedef struct LegacyNode {
+  char *key; //chave
+  char *value; //valor
+  LegacySubscribers *head_subscribers; //clientes subscritos a esta chave
+  struct LegacyNode *next; //proximo par
+} LegacyNode;
+
+typedef struct LegacySubscriptions {
+  LegacyNode *par; //par associado a subscricao
+  struct LegacySubscriptions *next; //proxima subscricao
+} LegacySubscriptions;
+
+typedef struct LegacyClient {
+  int id;
+  LegacySubscriptions *head_subscricoes; //subscricoes do cliente
+  int num_subscricoes; //numero de subscricoes do cliente
+} LegacyClient;
+
+typedef struct LegacyTable {
+  LegacyNode *table[LEGACY_TABLE_SIZE];
+} LegacyTable;
+
+/// @brief cria uma tabela original vazia
+/// @return a tabela, NULL se nao havia memoria
+LegacyTable *legacy_create(void);
+
+/// @brief acrescenta um par no inicio da sua lista; ao contrario do
+/// write_pair original nao procura a chave antes, pois os benchmarks so
+/// escrevem chaves novas (senao encher a tabela seria quadratico)
+/// @param lt a tabela
+/// @param key a chave
+/// @param value o valor
+/// @return 0 se deu certo, 1 se deu errado
+int legacy_insert(LegacyTable *lt, const char *key, const char *value);
+
+/// @brief le um par como o read_pair original
+/// @param lt a tabela
+/// @param key a chave
+/// @return copia do valor (o chamador liberta-a), NULL se nao existe
+char *legacy_read(LegacyTable *lt, const char *key);
+
+/// @brief subscreve um par como o addSubscription original (a subscricao
+/// fica no inicio das duas listas), mas sem o limite de subscricoes por
+/// cliente
+/// @param lt a tabela
+/// @param cliente o cliente
+/// @param key a chave
+/// @return 0 se deu certo, 1 se deu errado
+int legacy_subscribe(LegacyTable *lt, LegacyClient *cliente, const char *key);
+
+/// @brief tira todas as subscricoes de um cliente como o disconnectClient
+/// original, que procurava cada uma na lista do cliente e na do par
+/// @param cliente o cliente
+/// @return 0 se deu certo, 1 se deu errado
+int legacy_disconnect(LegacyClient *cliente);
+
+/// @brief liberta a tabela e os pares (ja sem subscricoes)
+/// @param lt a tabela
+void legacy_free(LegacyTable *lt);
+
+/// @brief pad_string original, que media a string (strlen) a cada byte
+/// escrito
+/// @param message onde fica a string com padding
+/// @param str a string
+/// @param length bytes escritos em message
+void legacy_pad_string(char *message, const char *str, int length);
+
+#endif // KVS_BENCH_LEGACY_H
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "bench/legacy.h"
+
+// Procuras (READ de uma chave que existe, por ordem aleatoria) na tabela
+// atual e na tabela original, de 1k a 10M chaves. Na original cada procura
+// percorre uma lista com ~1/26 das chaves, por isso so faz as procuras que
+// cabem em LEGACY_BUDGET segundos.
+// uso: bench/lookup [max_chaves] [procuras]
+
+#define LEGACY_BUDGET 1.0 // segundos de procuras na tabela original
+
+//ns por procura na tabela atual, -1 se deu erro
+static double lookup_current(size_t n, char (*probes)[BENCH_KEY_SIZE],
+                             size_t lookups) {
+  HashTable *ht = bench_table();
+  if (ht == NULL) {
+    return -1;
+  }
+  char key[BENCH_KEY_SIZE];
+  for (size_t i = 0; i < n; i++) {
+    bench_key(key, i);
+    if (bench_put(ht, key, "value") != 0) {
+      free_table(ht);
+      return -1;
+    }
+  }
+  char value[MAX_STRING_SIZE + 1];
+  size_t hits = 0;
+  double start = bench_now();
+  for (size_t i = 0; i < lookups; i++) {
+    hits += read_pair(ht, probes[i], value, sizeof(value), SNAPSHOT_LATEST) == 0;
+  }
+  double elapsed = bench_now() - start;
+  free_table(ht);
+  return hits == lookups ? elapsed / (double)lookups * 1e9 : -1;
+}
+
+//ns por procura na tabela original, -1 se deu erro; done fica com o num de
+//procuras feitas
+static double lookup_legacy(size_t n, char (*probes)[BENCH_KEY_SIZE],
+                            size_t lookups, size_t *done) {
+  LegacyTable *lt = legacy_create();
+  if (lt == NULL) {
+    return -1;
+  }
+  char key[BENCH_KEY_SIZE];
+  for (size_t i = 0; i < n; i++) {
+    bench_key(key, i);
+    if (legacy_insert(lt, key, "value") != 0) {
+      legacy_free(lt);
+      return -1;
+    }
+  }
+  size_t hits = 0, i = 0;
+  double start = bench_now(), elapsed = 0;
+  while (i < lookups && elapsed < LEGACY_BUDGET) {
+    char *value = legacy_read(lt, probes[i++]);
+    hits += value != NULL;
+    free(value);
+    if (i % 16 == 0) {
+      elapsed = bench_now() - start;
+    }
+  }
+  elapsed = bench_now() - start;
+  legacy_free(lt);
+  *done = i;
+  return hits == i ? elapsed / (double)i * 1e9 : -1;
+}
+
+int main(int argc, char **argv) {
+  size_t max_keys = bench_arg(argc, argv, 1, 10000000);
+  size_t lookups = bench_arg(argc, argv, 2, 1000000);
+  char (*probes)[BENCH_KEY_SIZE] = malloc(lookups * BENCH_KEY_SIZE);
+  if (probes == NULL || lookups == 0) {
+    fprintf(stderr, "usage: %s [max_keys] [lookups]\n", argv[0]);
+    return 1;
+  }
+  printf("%10s %12s %12s %10s\n", "keys", "ns/lookup", "original", "(lookups)");
+  for (size_t n = 1000; n <= max_keys; n *= 10) {
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < lookups; i++) {
+      bench_key(probes[i], bench_rand(&seed) % n);
+    }
+    double current = lookup_current(n, probes, lookups);
+    size_t done = 0;
+    double legacy = lookup_legacy(n, probes, lookups, &done);
+    if (current < 0 || legacy < 0) {
+      fprintf(stderr, "Failed to fill the tables with %zu keys\n", n);
+      free(probes);
+      return 1;
+    }
+    printf("%10zu %12.1f %12.1f %10zu\n", n, current, legacy, done);
+    fflush(stdout);
+  }
+  free(probes);
+  return 0;
+}
@@ -0,0 +1,124 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "src/server/snapshot.h"
+
+// Velocidade (e memoria da tabela toda) com o indice ordenado na skiplist e
+// na arvore radix, com chaves com prefixos longos em comum, como as de um servidor
+// com varios clientes (tenant07:eu-west:object:00000123). Para cada indice
+// mede os bytes do heap por par da tabela toda, o tempo de inserir, o de
+// um SCAN da tabela toda e o de SCANs curtos (os primeiros 100 pares a
+// partir de uma chave ao acaso, como um PREFIX), que contam sobretudo o
+// tempo de chegar a primeira chave.
+// uso: bench/radix [max_chaves] [scans_curtos]
+
+#define SHORT_SCAN 100 // pares lidos por cada SCAN curto
+#define TENANTS 16
+
+typedef struct Result {
+  double bytes; //bytes do heap por par
+  double insert_ns; //ns por insercao
+  double scan_ns; //ns por par no SCAN da tabela toda
+  double short_us; //us por SCAN curto
+} Result;
+
+typedef struct Counter {
+  size_t pairs;
+  size_t limit;
+} Counter;
+
+static void prefixed_key(char *key, size_t i) {
+  snprintf(key, MAX_STRING_SIZE + 1, "tenant%02zu:eu-west:object:%08zu",
+           i % TENANTS, i / TENANTS % 100000000);
+}
+
+static bool count_pair(const char *key, const char *value, void *arg) {
+  (void)key;
+  (void)value;
+  Counter *counter = arg;
+  return ++counter->pairs < counter->limit;
+}
+
+//le os pares a partir de from, ate limit; retorna quantos leu
+static size_t scan(HashTable *ht, const char *from, size_t limit) {
+  Counter counter = {0, limit};
+  uint64_t snapshot = snapshot_begin(&ht->clock->visible_commit);
+  scan_pairs(ht, from, snapshot, count_pair, &counter);
+  snapshot_end();
+  return counter.pairs;
+}
+
+static int run(size_t n, bool radix, size_t scans, Result *result) {
+  size_t before = bench_heap_used();
+  HashTable *ht = bench_table();
+  if (ht == NULL || (radix && enable_radix_index(ht) != 0)) {
+    return 1;
+  }
+  //insere por uma ordem ao acaso, como chegariam os WRITEs
+  char key[MAX_STRING_SIZE + 1];
+  size_t stride = 7919; //primo, por isso i * stride % n percorre todas
+  double start = bench_now();
+  for (size_t i = 0; i < n; i++) {
+    prefixed_key(key, i * stride % n);
+    if (bench_put(ht, key, "value") != 0) {
+      free_table(ht);
+      return 1;
+    }
+  }
+  result->insert_ns = (bench_now() - start) / (double)n * 1e9;
+  result->bytes = (double)(bench_heap_used() - before) / (double)n;
+
+  //a tabela toda pelo menos 1M pares no total, para as tabelas pequenas
+  size_t rounds = n < 1000000 ? 1000000 / n : 1;
+  size_t pairs = 0;
+  start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    pairs += scan(ht, "", n + 1);
+  }
+  result->scan_ns = (bench_now() - start) / (double)(n * rounds) * 1e9;
+
+  uint64_t seed = 0x9E3779B97F4A7C15ULL;
+  size_t short_pairs = 0;
+  start = bench_now();
+  for (size_t i = 0; i < scans; i++) {
+    prefixed_key(key, bench_rand(&seed) % n);
+    short_pairs += scan(ht, key, SHORT_SCAN);
+  }
+  result->short_us = (bench_now() - start) / (double)scans * 1e6;
+  free_table(ht);
+  return pairs != n * rounds || short_pairs == 0;
+}
+
+int main(int argc, char **argv) {
+  size_t max_keys = bench_arg(argc, argv, 1, 1000000);
+  size_t scans = bench_arg(argc, argv, 2, 100000);
+  if (scans == 0) {
+    fprintf(stderr, "usage: %s [max_keys] [short_scans]\n", argv[0]);
+    return 1;
+  }
+  //a tabela ancora de bench_table fica fora das contas
+  HashTable *warmup = bench_table();
+  if (warmup == NULL) {
+    return 1;
+  }
+  free_table(warmup);
+
+  printf("%10s %9s %9s %10s %12s %12s\n", "keys", "index", "bytes", "insert ns",
+         "scan ns/key", "short us");
+  for (size_t n = 1000; n <= max_keys; n *= 10) {
+    for (int radix = 0; radix <= 1; radix++) {
+      Result result;
+      if (run(n, radix, scans, &result) != 0) {
+        fprintf(stderr, "Failed to fill the table with %zu keys\n", n);
+        return 1;
+      }
+      printf("%10zu %9s %9.1f %10.1f %12.1f %12.2f\n", n,
+             radix ? "radix" : "skiplist", result.bytes, result.insert_ns,
+             result.scan_ns, result.short_us);
+      fflush(stdout);
+    }
+  }
+  return 0;
+}
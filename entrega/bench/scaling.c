@@ -0,0 +1,145 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench/bench.h"
+#include "src/server/operations.h"
+
+// Escala de 1 a 64 threads (como as dos .job e das sessoes) a fazer WRITE
+// e READ de uma chave ao acaso pelas operacoes do servidor, com uma so
+// tabela e no modo particionado (os WRITE de um shard vao para a thread
+// dona dele, o resto corre como com uma tabela). O estado do
+// servidor so pode ser inicializado uma vez por processo, por isso cada
+// modo corre num processo filho.
+// uso: bench/scaling [max_threads] [shards] [ms_por_medida]
+
+#define KEYS 100000
+
+typedef struct Run {
+  atomic_bool stop;
+  atomic_size_t ops;
+  int out; //descritor para a saida dos READ (/dev/null)
+} Run;
+
+static void *worker(void *arg) {
+  Run *run = arg;
+  uint64_t state = (uint64_t)pthread_self() | 1;
+  char keys[1][MAX_STRING_SIZE], values[1][MAX_STRING_SIZE];
+  unsigned int ttls[1] = {0};
+  size_t ops = 0;
+  while (!atomic_load_explicit(&run->stop, memory_order_relaxed)) {
+    bench_key(keys[0], bench_rand(&state) % KEYS);
+    if (ops % 2 == 0) {
+      snprintf(values[0], MAX_STRING_SIZE, "v%zu", ops);
+      kvs_write(1, keys, values, ttls);
+    } else {
+      kvs_read(1, keys, run->out);
+    }
+    ops++;
+  }
+  atomic_fetch_add(&run->ops, ops);
+  return NULL;
+}
+
+//ops por segundo com threads threads durante ms milissegundos, -1 se deu
+//erro
+static double measure(Run *run, size_t threads, unsigned ms) {
+  pthread_t tids[threads];
+  atomic_store(&run->stop, false);
+  atomic_store(&run->ops, 0);
+  for (size_t i = 0; i < threads; i++) {
+    if (pthread_create(&tids[i], NULL, worker, run) != 0) {
+      return -1;
+    }
+  }
+  double start = bench_now();
+  struct timespec duration = {ms / 1000, (long)(ms % 1000) * 1000000};
+  nanosleep(&duration, NULL);
+  atomic_store(&run->stop, true);
+  for (size_t i = 0; i < threads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  return (double)atomic_load(&run->ops) / (bench_now() - start);
+}
+
+//corre um modo num processo filho; as ops/s de cada num de threads vao
+//para o pipe
+static int run_mode(size_t shards, size_t max_threads, unsigned ms, int fd) {
+  static Run run;
+  set_shards(shards);
+  run.out = open("/dev/null", O_WRONLY);
+  if (run.out < 0 || kvs_init() != 0) {
+    return 1;
+  }
+  char keys[1][MAX_STRING_SIZE], values[1][MAX_STRING_SIZE] = {"value"};
+  unsigned int ttls[1] = {0};
+  for (size_t i = 0; i < KEYS; i++) {
+    bench_key(keys[0], i);
+    kvs_write(1, keys, values, ttls);
+  }
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    double ops = measure(&run, threads, ms);
+    if (write(fd, &ops, sizeof(ops)) != sizeof(ops) || ops < 0) {
+      return 1;
+    }
+  }
+  kvs_terminate();
+  close(run.out);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t max_threads = bench_arg(argc, argv, 1, 64);
+  size_t shards = bench_arg(argc, argv, 2, 8);
+  unsigned ms = (unsigned)bench_arg(argc, argv, 3, 1000);
+  size_t modes[2] = {1, shards};
+  size_t num_results = 0;
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    num_results++;
+  }
+  double results[2][num_results];
+
+  for (int mode = 0; mode < 2; mode++) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      return 1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      return 1;
+    }
+    if (pid == 0) {
+      close(fds[0]);
+      _exit(run_mode(modes[mode], max_threads, ms, fds[1]));
+    }
+    close(fds[1]);
+    //o filho escreve um resultado de cada vez
+    size_t size = sizeof(results[mode]), got = 0;
+    ssize_t n = 1;
+    while (got < size && n > 0) {
+      n = read(fds[0], (char *)results[mode] + got, size - got);
+      got += n > 0 ? (size_t)n : 0;
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    close(fds[0]);
+    if (got != size || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "Failed to run with %zu shards\n", modes[mode]);
+      return 1;
+    }
+  }
+
+  printf("%8s %14s %14s\n", "threads", "1 table", "sharded");
+  size_t i = 0;
+  for (size_t threads = 1; threads <= max_threads; threads *= 2, i++) {
+    printf("%8zu %14.0f %14.0f\n", threads, results[0][i], results[1][i]);
+  }
+  return 0;
+}
@@ -0,0 +1,187 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench/bench.h"
+#include "src/server/epoch.h"
+#include "src/server/snapshot.h"
+
+// Escritas por segundo de um escritor enquanto 0, 1, 2, ... threads fazem
+// SHOWs seguidos da tabela toda: com o snapshot e sem locks, como o
+// kvs_show, ou com todas as stripes bloqueadas para leitura, como antes das
+// versoes. Cada SHOW copia as chaves e os valores para um buffer, como o
+// show_pair.
+// uso: bench/show [max_shows] [chaves] [ms_por_medida]
+
+#define READ_RETRIES 3 // como no kvs_show: depois disto bloqueia as stripes
+
+typedef struct Run {
+  HashTable *ht;
+  size_t keys;
+  bool snapshot;
+  atomic_bool stop;
+  atomic_size_t shows;
+  atomic_size_t writes;
+} Run;
+
+typedef struct ShowBuf {
+  char *data;
+  size_t len;
+} ShowBuf;
+
+static void show_pair(KeyNode *keyNode, const ValueVersion *version,
+                      void *arg) {
+  ShowBuf *buf = arg;
+  memcpy(buf->data + buf->len, keyNode->key, keyNode->key_len);
+  buf->len += keyNode->key_len;
+  memcpy(buf->data + buf->len, version->value, version->value_len);
+  buf->len += version->value_len;
+}
+
+//SHOW sem locks, com as versoes de um snapshot
+static void show_snapshot(HashTable *ht, ShowBuf *buf) {
+  uint64_t snapshot = snapshot_begin(&ht->clock->visible_commit);
+  unsigned seqs[NUM_STRIPES];
+  bool consistente = false;
+  for (int tentativa = 0; tentativa < READ_RETRIES && !consistente;
+       tentativa++) {
+    if (!read_stripes_begin(ht, UINT64_MAX, seqs)) {
+      break;
+    }
+    buf->len = 0;
+    epoch_enter();
+    foreach_pair(ht, snapshot, show_pair, buf);
+    epoch_exit();
+    consistente = read_stripes_validate(ht, UINT64_MAX, seqs);
+  }
+  if (!consistente) {
+    buf->len = 0;
+    lock_stripes(ht, UINT64_MAX, false);
+    foreach_pair(ht, snapshot, show_pair, buf);
+    unlock_stripes(ht, UINT64_MAX);
+  }
+  snapshot_end();
+}
+
+//SHOW com a tabela toda bloqueada para leitura
+static void show_locked(HashTable *ht, ShowBuf *buf) {
+  buf->len = 0;
+  lock_stripes(ht, UINT64_MAX, false);
+  foreach_pair(ht, SNAPSHOT_LATEST, show_pair, buf);
+  unlock_stripes(ht, UINT64_MAX);
+}
+
+static void *shower(void *arg) {
+  Run *run = arg;
+  ShowBuf buf = {malloc(run->keys * (BENCH_KEY_SIZE + MAX_STRING_SIZE)), 0};
+  if (buf.data == NULL) {
+    return NULL;
+  }
+  size_t shows = 0;
+  while (!atomic_load_explicit(&run->stop, memory_order_relaxed)) {
+    if (run->snapshot) {
+      show_snapshot(run->ht, &buf);
+    } else {
+      show_locked(run->ht, &buf);
+    }
+    shows++;
+  }
+  atomic_fetch_add(&run->shows, shows);
+  free(buf.data);
+  return NULL;
+}
+
+//reescreve chaves ao acaso, cada uma no seu commit
+static void *writer(void *arg) {
+  Run *run = arg;
+  uint64_t state = 0x9e3779b97f4a7c15;
+  char key[BENCH_KEY_SIZE], value[BENCH_KEY_SIZE];
+  size_t writes = 0;
+  while (!atomic_load_explicit(&run->stop, memory_order_relaxed)) {
+    bench_key(key, bench_rand(&state) % run->keys);
+    snprintf(value, sizeof(value), "v%zu", writes);
+    uint64_t stripes = stripe_bit(key);
+    lock_stripes(run->ht, stripes, true);
+    uint64_t commit = commit_begin(run->ht);
+    write_pair(run->ht, key, value, 0, commit);
+    commit_end(run->ht, commit);
+    unlock_stripes(run->ht, stripes);
+    table_maintenance(run->ht);
+    writes++;
+  }
+  atomic_fetch_add(&run->writes, writes);
+  return NULL;
+}
+
+//mede durante ms milissegundos; retorna 0 se deu certo
+static int measure(Run *run, size_t showers, unsigned ms) {
+  pthread_t threads[showers + 1];
+  atomic_store(&run->stop, false);
+  atomic_store(&run->shows, 0);
+  atomic_store(&run->writes, 0);
+  for (size_t i = 0; i < showers; i++) {
+    if (pthread_create(&threads[i], NULL, shower, run) != 0) {
+      return 1;
+    }
+  }
+  if (pthread_create(&threads[showers], NULL, writer, run) != 0) {
+    return 1;
+  }
+  double start = bench_now();
+  struct timespec duration = {ms / 1000, (long)(ms % 1000) * 1000000};
+  nanosleep(&duration, NULL);
+  atomic_store(&run->stop, true);
+  for (size_t i = 0; i <= showers; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double elapsed = bench_now() - start;
+  printf("%8zu %10s %12.1f %12.0f\n", showers,
+         run->snapshot ? "snapshot" : "locked",
+         (double)atomic_load(&run->shows) / elapsed,
+         (double)atomic_load(&run->writes) / elapsed);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t max_showers = bench_arg(argc, argv, 1, 4);
+  size_t keys = bench_arg(argc, argv, 2, 100000);
+  unsigned ms = (unsigned)bench_arg(argc, argv, 3, 2000);
+
+  static Run run;
+  run.ht = bench_table();
+  run.keys = keys;
+  if (run.ht == NULL) {
+    fprintf(stderr, "Failed to create table\n");
+    return 1;
+  }
+  char key[BENCH_KEY_SIZE];
+  for (size_t i = 0; i < keys; i++) {
+    bench_key(key, i);
+    if (bench_put(run.ht, key, "value") != 0) {
+      fprintf(stderr, "Failed to write pair\n");
+      return 1;
+    }
+  }
+
+  printf("%8s %10s %12s %12s\n", "shows", "mode", "shows/s", "writes/s");
+  run.snapshot = true;
+  if (measure(&run, 0, ms) != 0) {
+    return 1;
+  }
+  for (size_t showers = 1; showers <= max_showers; showers *= 2) {
+    run.snapshot = true;
+    if (measure(&run, showers, ms) != 0) {
+      return 1;
+    }
+    run.snapshot = false;
+    if (measure(&run, showers, ms) != 0) {
+      return 1;
+    }
+  }
+  free_table(run.ht);
+  return 0;
+}
@@ -0,0 +1,152 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench/bench.h"
+#include "src/common/io.h"
+#include "src/server/operations.h"
+
+// Verificacao (nao e uma medida): um cliente subscreve mais chaves do que
+// as 256 que a fila das notificacoes guardava antes e recebe a ultima
+// alteracao de todas. Cada chave e escrita varias vezes e uma em cada tres
+// e apagada antes de o cliente abrir o pipe, por isso a fila tem de ficar
+// com uma notificacao por chave. As notificacoes sao lidas de um FIFO, como
+// no cliente, e falha se alguma chave nao acabar com o ultimo valor escrito
+// (ou DELETED).
+// uso: bench/subscribe [chaves] [escritas_por_chave]
+
+#define WAIT_MS 10000 // espera max pelas notificacoes
+
+typedef struct Reader {
+  int fd;
+  size_t keys;
+  char (*expected)[MAX_STRING_SIZE + 1]; //ultimo valor de cada chave
+  char (*received)[MAX_STRING_SIZE + 1]; //ultimo valor que chegou
+  atomic_size_t frames;
+  atomic_size_t matched; //chaves em que o que chegou e o esperado
+} Reader;
+
+static void subscribe_key(char *key, size_t i) {
+  snprintf(key, MAX_STRING_SIZE, "sub%05zu", i);
+}
+
+//le as notificacoes ate o pipe fechar
+static void *read_notifications(void *arg) {
+  Reader *reader = arg;
+  char frame[NOTIFY_FRAME_SIZE];
+  while (read_all(reader->fd, frame, NOTIFY_FRAME_SIZE, NULL) == 1) {
+    size_t i = strtoul(&frame[3], NULL, 10);
+    if (strncmp(frame, "sub", 3) != 0 || i >= reader->keys) {
+      continue;
+    }
+    bool was = strcmp(reader->received[i], reader->expected[i]) == 0;
+    memcpy(reader->received[i], &frame[41], MAX_STRING_SIZE);
+    bool is = strcmp(reader->received[i], reader->expected[i]) == 0;
+    if (is && !was) {
+      atomic_fetch_add(&reader->matched, 1);
+    } else if (was && !is) {
+      atomic_fetch_sub(&reader->matched, 1);
+    }
+    atomic_fetch_add(&reader->frames, 1);
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  size_t keys = bench_arg(argc, argv, 1, 1000);
+  size_t writes = bench_arg(argc, argv, 2, 3);
+  if (keys == 0 || writes == 0) {
+    fprintf(stderr, "usage: %s [keys] [writes_per_key]\n", argv[0]);
+    return 1;
+  }
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/kvs_subscribe_%d", (int)getpid());
+  unlink(path);
+  int out = open("/dev/null", O_WRONLY);
+  Reader reader = {.keys = keys};
+  reader.expected = calloc(keys, sizeof(*reader.expected));
+  reader.received = calloc(keys, sizeof(*reader.received));
+  if (mkfifo(path, 0640) != 0 || out < 0 || reader.expected == NULL ||
+      reader.received == NULL || kvs_init() != 0) {
+    fprintf(stderr, "Failed to set up the check\n");
+    return 1;
+  }
+  Cliente *cliente = bench_clients(1, path);
+  if (cliente == NULL) {
+    fprintf(stderr, "Failed to set up the check\n");
+    return 1;
+  }
+
+  char key[1][MAX_STRING_SIZE], value[1][MAX_STRING_SIZE];
+  unsigned int ttls[1] = {0};
+  for (size_t i = 0; i < keys; i++) {
+    subscribe_key(key[0], i);
+    strcpy(value[0], "initial");
+    if (kvs_write(1, key, value, ttls) != 0 ||
+        addSubscriber(cliente, key[0]) != 0) {
+      fprintf(stderr, "Failed to subscribe %s\n", key[0]);
+      return 1;
+    }
+  }
+  //o cliente ainda nao abriu o pipe: tudo fica na fila dele
+  for (size_t w = 0; w < writes; w++) {
+    for (size_t i = 0; i < keys; i++) {
+      subscribe_key(key[0], i);
+      snprintf(value[0], MAX_STRING_SIZE, "v%u-%u", (unsigned)w, (unsigned)i);
+      kvs_write(1, key, value, ttls);
+      strcpy(reader.expected[i], value[0]);
+    }
+  }
+  for (size_t i = 0; i < keys; i += 3) {
+    subscribe_key(key[0], i);
+    kvs_delete(1, key, out);
+    strcpy(reader.expected[i], "DELETED");
+  }
+
+  reader.fd = open(path, O_RDONLY);
+  pthread_t thread;
+  if (reader.fd < 0 ||
+      pthread_create(&thread, NULL, read_notifications, &reader) != 0) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return 1;
+  }
+  double start = bench_now();
+  while (atomic_load(&reader.matched) < keys &&
+         bench_now() - start < WAIT_MS / 1000.0) {
+    delay(10);
+  }
+  size_t matched = atomic_load(&reader.matched);
+  size_t sent, coalesced, dropped, stalls;
+  notify_get_stats(&sent, &coalesced, &dropped, &stalls);
+
+  disconnectClient(cliente);
+  bench_free_clients(cliente, 1); //fecha o pipe e o leitor acaba
+  pthread_join(thread, NULL);
+  close(reader.fd);
+  kvs_terminate();
+  unlink(path);
+  close(out);
+
+  printf("%zu keys, %zu notifications read, %zu coalesced, %zu dropped\n",
+         keys, atomic_load(&reader.frames), coalesced, dropped);
+  for (size_t i = 0; i < keys && matched < keys; i++) {
+    if (strcmp(reader.received[i], reader.expected[i]) != 0) {
+      subscribe_key(key[0], i);
+      printf("%s: got \"%s\", expected \"%s\"\n", key[0], reader.received[i],
+             reader.expected[i]);
+    }
+  }
+  free(reader.expected);
+  free(reader.received);
+  if (matched < keys || dropped > 0) {
+    printf("FAILED: %zu of %zu keys with the last value\n", matched, keys);
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
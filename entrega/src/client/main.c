@@ -39,7 +39,7 @@ static void *thread_principal_work(void *arguments){
   char notif_pipe[40];
   strcpy(notif_pipe, thread_data->notif_pipe_path);
 
-  char keys[MAX_NUMBER_SUB][MAX_STRING_SIZE] = {0};
+  char keys[1][MAX_STRING_SIZE] = {0};
   unsigned int delay_ms;
   size_t num;
 
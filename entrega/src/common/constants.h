@@ -4,4 +4,3 @@
 #define STATE_ACCESS_DELAY_US   // delay a aplicar no server
 #define MAX_PIPE_PATH_LENGTH 40 // tamanho max do caminho do pipe
 #define MAX_STRING_SIZE 40
-#define MAX_NUMBER_SUB 10
@@ -83,11 +83,8 @@ void write_str(int fd, const char *str) {
 
 //adiciona \0 até a string tar de tamanho length
 void pad_string(char *message,const char *str, int length) {
-  for(size_t i=0; i< (size_t) length; i++){
-    if(i<strlen(str)){
-      message[i] = str[i];
-    }else{
-      message[i] = '\0';
-    }
-  }
+  //o tamanho e medido uma vez, e nao a cada byte
+  size_t len = strnlen(str, (size_t)length);
+  memcpy(message, str, len);
+  memset(message + len, '\0', (size_t)length - len);
 }
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include "bloom.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOOM_SATURATED 255
+
+Bloom *bloom_create(size_t counters, unsigned hashes) {
+  if (hashes == 0 || hashes > BLOOM_MAX_HASHES) {
+    return NULL;
+  }
+  size_t num_blocks = 1;
+  while (num_blocks * BLOOM_BLOCK_SIZE < counters) {
+    num_blocks *= 2;
+  }
+  Bloom *bloom = aligned_alloc(_Alignof(Bloom), sizeof(Bloom));
+  if (bloom == NULL) {
+    return NULL;
+  }
+  size_t size = num_blocks * BLOOM_BLOCK_SIZE;
+  bloom->counters = aligned_alloc(BLOOM_BLOCK_SIZE, size);
+  if (bloom->counters == NULL) {
+    free(bloom);
+    return NULL;
+  }
+  memset((void *)bloom->counters, 0, size);
+  bloom->num_blocks = num_blocks;
+  bloom->hashes = hashes;
+  for (int i = 0; i < BLOOM_STAT_SLOTS; i++) {
+    atomic_init(&bloom->stats[i].checks, 0);
+    atomic_init(&bloom->stats[i].negatives, 0);
+    atomic_init(&bloom->stats[i].false_positives, 0);
+  }
+  return bloom;
+}
+
+//bloco da chave; o hash ja passou pelo avalanche final, por isso usa bits
+//diferentes dos que escolhem o bucket e as posicoes no bloco
+static _Atomic(uint8_t) *block_of(Bloom *bloom, uint64_t h) {
+  return &bloom->counters[((h >> 28) & (bloom->num_blocks - 1)) *
+                          BLOOM_BLOCK_SIZE];
+}
+
+//posicao do contador i da chave no bloco (double hashing; o passo e impar,
+//por isso as posicoes sao todas diferentes)
+static size_t position(uint64_t h, unsigned i) {
+  size_t first = (h >> 16) & (BLOOM_BLOCK_SIZE - 1);
+  size_t step = ((h >> 22) & (BLOOM_BLOCK_SIZE - 1)) | 1;
+  return (first + i * step) & (BLOOM_BLOCK_SIZE - 1);
+}
+
+void bloom_add(Bloom *bloom, uint64_t h) {
+  _Atomic(uint8_t) *block = block_of(bloom, h);
+  for (unsigned i = 0; i < bloom->hashes; i++) {
+    _Atomic(uint8_t) *counter = &block[position(h, i)];
+    uint8_t value = atomic_load_explicit(counter, memory_order_relaxed);
+    while (value != BLOOM_SATURATED &&
+           !atomic_compare_exchange_weak(counter, &value, (uint8_t)(value + 1)))
+      ;
+  }
+}
+
+void bloom_remove(Bloom *bloom, uint64_t h) {
+  _Atomic(uint8_t) *block = block_of(bloom, h);
+  for (unsigned i = 0; i < bloom->hashes; i++) {
+    _Atomic(uint8_t) *counter = &block[position(h, i)];
+    uint8_t value = atomic_load_explicit(counter, memory_order_relaxed);
+    //um contador saturado ja perdeu a conta, fica assim
+    while (value != BLOOM_SATURATED && value != 0 &&
+           !atomic_compare_exchange_weak(counter, &value, (uint8_t)(value - 1)))
+      ;
+  }
+}
+
+//os leitores sem locks validam depois a sequencia da stripe; o acquire
+//garante que essa validacao e feita depois de lidos os contadores
+bool bloom_maybe_contains(Bloom *bloom, uint64_t h) {
+  BloomStats *stats = &bloom->stats[h & (BLOOM_STAT_SLOTS - 1)];
+  atomic_fetch_add_explicit(&stats->checks, 1, memory_order_relaxed);
+  _Atomic(uint8_t) *block = block_of(bloom, h);
+  for (unsigned i = 0; i < bloom->hashes; i++) {
+    if (atomic_load_explicit(&block[position(h, i)], memory_order_acquire) == 0) {
+      atomic_fetch_add_explicit(&stats->negatives, 1, memory_order_relaxed);
+      return false;
+    }
+  }
+  return true;
+}
+
+void bloom_false_positive(Bloom *bloom, uint64_t h) {
+  BloomStats *stats = &bloom->stats[h & (BLOOM_STAT_SLOTS - 1)];
+  atomic_fetch_add_explicit(&stats->false_positives, 1, memory_order_relaxed);
+}
+
+void bloom_get_stats(Bloom *bloom, size_t *checks, size_t *negatives,
+                     size_t *false_positives) {
+  *checks = *negatives = *false_positives = 0;
+  for (int i = 0; i < BLOOM_STAT_SLOTS; i++) {
+    *checks += atomic_load_explicit(&bloom->stats[i].checks, memory_order_relaxed);
+    *negatives +=
+        atomic_load_explicit(&bloom->stats[i].negatives, memory_order_relaxed);
+    *false_positives += atomic_load_explicit(&bloom->stats[i].false_positives,
+                                             memory_order_relaxed);
+  }
+}
+
+void bloom_destroy(Bloom *bloom) {
+  free((void *)bloom->counters);
+  free(bloom);
+}
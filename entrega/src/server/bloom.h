@@ -0,0 +1,71 @@
+#ifndef KVS_BLOOM_H
+#define KVS_BLOOM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLOOM_BLOCK_SIZE 64 // contadores por bloco (uma linha de cache)
+#define BLOOM_MAX_HASHES 16 // num max de contadores por chave
+#define BLOOM_DEFAULT_HASHES 4
+#define BLOOM_STAT_SLOTS 64 // estatisticas repartidas para nao haver contencao
+
+//estatisticas de uma parte das chaves (escolhida pelo hash)
+typedef struct BloomStats {
+  _Alignas(64) atomic_size_t checks; //procuras que passaram pelo filtro
+  atomic_size_t negatives; //procuras respondidas pelo filtro (chave ausente)
+  atomic_size_t false_positives; //o filtro disse talvez mas a chave nao existia
+} BloomStats;
+
+// Filtro de Bloom com contadores (para suportar remocoes), em blocos: os
+// contadores de uma chave estao todos no mesmo bloco de 64 bytes, por isso
+// cada procura toca numa so linha de cache. Os contadores saturam em 255 e
+// a partir dai nunca mais descem, para nunca haver falsos negativos.
+typedef struct Bloom {
+  _Atomic(uint8_t) *counters; //num_blocks * BLOOM_BLOCK_SIZE contadores
+  size_t num_blocks; //potencia de 2
+  unsigned hashes; //contadores por chave
+  BloomStats stats[BLOOM_STAT_SLOTS];
+} Bloom;
+
+/// @brief cria um filtro vazio
+/// @param counters num de contadores (arredondado a blocos em potencia de 2)
+/// @param hashes num de contadores por chave (1 a BLOOM_MAX_HASHES)
+/// @return o filtro, NULL se nao ha memoria
+Bloom *bloom_create(size_t counters, unsigned hashes);
+
+/// @brief acrescenta uma chave ao filtro
+/// @param bloom o filtro
+/// @param h hash da chave
+void bloom_add(Bloom *bloom, uint64_t h);
+
+/// @brief tira uma chave que foi acrescentada com bloom_add
+/// @param bloom o filtro
+/// @param h hash da chave
+void bloom_remove(Bloom *bloom, uint64_t h);
+
+/// @brief verifica se a chave pode estar no filtro (e conta a procura)
+/// @param bloom o filtro
+/// @param h hash da chave
+/// @return false se a chave de certeza que nao existe
+bool bloom_maybe_contains(Bloom *bloom, uint64_t h);
+
+/// @brief regista que bloom_maybe_contains deu true para uma chave ausente
+/// @param bloom o filtro
+/// @param h hash da chave
+void bloom_false_positive(Bloom *bloom, uint64_t h);
+
+/// @brief soma as estatisticas do filtro
+/// @param bloom o filtro
+/// @param checks procuras feitas
+/// @param negatives procuras respondidas so pelo filtro
+/// @param false_positives falsos positivos
+void bloom_get_stats(Bloom *bloom, size_t *checks, size_t *negatives,
+                     size_t *false_positives);
+
+/// @brief liberta o filtro
+/// @param bloom o filtro
+void bloom_destroy(Bloom *bloom);
+
+#endif // KVS_BLOOM_H
@@ -0,0 +1,147 @@
+#include "epoch.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "src/common/io.h"
+#include "thread_registry.h"
+
+#define EPOCH_SLOTS 3 // listas de retirados: epoca atual e as duas anteriores
+#define EPOCH_ADVANCE_INTERVAL 64 // retiradas entre tentativas de avancar
+
+//bloco a espera de ser libertado
+typedef struct Retired {
+  void *ptr;
+  void (*free_fn)(void *);
+} Retired;
+
+//blocos retirados por uma thread na mesma epoca
+typedef struct RetireList {
+  Retired *items;
+  size_t count;
+  size_t capacity;
+  uint64_t epoch; //epoca global em que foram retirados
+} RetireList;
+
+//registo de uma thread
+typedef struct ThreadEpoch {
+  _Alignas(64) ThreadRecord record; //tem de ser o primeiro membro
+  //(epoca << 1) | 1 enquanto a thread esta numa secao de leitura, 0 fora
+  atomic_uint_fast64_t state;
+  unsigned depth; //num de epoch_enter encadeados
+  unsigned retired_since_advance; //retiradas desde a ultima tentativa
+  RetireList limbo[EPOCH_SLOTS];
+} ThreadEpoch;
+
+static atomic_uint_fast64_t global_epoch = 1;
+
+//quando uma thread acaba o registo pode ser reutilizado por outra thread
+//(os blocos que ainda tiver retirados sao libertados por essa thread)
+static void release_self(ThreadRecord *record) {
+  atomic_store(&((ThreadEpoch *)record)->state, 0);
+}
+
+static ThreadRegistry registry = THREAD_REGISTRY_INIT(
+    ThreadEpoch, NULL, release_self, "Failed to allocate epoch record\n");
+static _Thread_local ThreadEpoch *self = NULL; //registo desta thread
+
+//retorna o registo desta thread, criando-o na primeira utilizacao
+static ThreadEpoch *get_self(void) {
+  if (self == NULL) {
+    self = (ThreadEpoch *)thread_registry_acquire(&registry);
+  }
+  return self;
+}
+
+void epoch_enter(void) {
+  ThreadEpoch *te = get_self();
+  if (te->depth++ == 0) {
+    atomic_store(&te->state, (atomic_load(&global_epoch) << 1) | 1);
+  }
+}
+
+void epoch_exit(void) {
+  ThreadEpoch *te = self;
+  if (--te->depth == 0) {
+    atomic_store(&te->state, 0);
+  }
+}
+
+//liberta todos os blocos de uma lista
+static void free_list(RetireList *list) {
+  for (size_t i = 0; i < list->count; i++) {
+    list->items[i].free_fn(list->items[i].ptr);
+  }
+  list->count = 0;
+}
+
+//avanca a epoca global se todas as threads em secoes de leitura ja a viram
+static void try_advance(void) {
+  uint64_t epoch = atomic_load(&global_epoch);
+  for (ThreadRecord *record = thread_registry_first(&registry);
+       record != NULL; record = record->next) {
+    uint64_t state = atomic_load(&((ThreadEpoch *)record)->state);
+    if ((state & 1) && (state >> 1) != epoch) {
+      //ainda ha uma thread a ler na epoca anterior
+      return;
+    }
+  }
+  atomic_compare_exchange_strong(&global_epoch, &epoch, epoch + 1);
+}
+
+//liberta as listas desta thread retiradas ha pelo menos duas epocas
+static void collect(ThreadEpoch *te) {
+  uint64_t epoch = atomic_load(&global_epoch);
+  for (int i = 0; i < EPOCH_SLOTS; i++) {
+    if (te->limbo[i].count > 0 && te->limbo[i].epoch + 2 <= epoch) {
+      free_list(&te->limbo[i]);
+    }
+  }
+}
+
+void epoch_retire(void *ptr, void (*free_fn)(void *)) {
+  ThreadEpoch *te = get_self();
+  uint64_t epoch = atomic_load(&global_epoch);
+  RetireList *list = &te->limbo[epoch % EPOCH_SLOTS];
+  if (list->epoch != epoch) {
+    //a lista e de ha pelo menos tres epocas, ja ninguem a pode ver
+    free_list(list);
+    list->epoch = epoch;
+  }
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+    Retired *items = realloc(list->items, capacity * sizeof(Retired));
+    if (items == NULL) {
+      //sem memoria para o guardar: perde-o em vez de o libertar cedo demais
+      write_str(STDERR_FILENO, "Failed to retire block, leaking it\n");
+      return;
+    }
+    list->items = items;
+    list->capacity = capacity;
+  }
+  list->items[list->count++] = (Retired){ptr, free_fn};
+
+  if (++te->retired_since_advance >= EPOCH_ADVANCE_INTERVAL) {
+    te->retired_since_advance = 0;
+    try_advance();
+    collect(te);
+  }
+}
+
+void epoch_drain(void) {
+  for (ThreadRecord *record = thread_registry_first(&registry);
+       record != NULL; record = record->next) {
+    ThreadEpoch *te = (ThreadEpoch *)record;
+    for (int i = 0; i < EPOCH_SLOTS; i++) {
+      free_list(&te->limbo[i]);
+      free(te->limbo[i].items);
+      te->limbo[i].items = NULL;
+      te->limbo[i].capacity = 0;
+    }
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef KVS_EPOCH_H
+#define KVS_EPOCH_H
+
+// Reclamacao de memoria por epocas (epoch-based reclamation).
+// Os leitores que percorrem a tabela sem locks ficam dentro de uma secao
+// epoch_enter/epoch_exit; tudo o que os escritores tiram da tabela e passado
+// a epoch_retire e so e libertado quando nenhuma thread o pode estar a ler.
+
+/// @brief entra numa secao de leitura; pode ser chamada de forma encadeada
+void epoch_enter(void);
+
+/// @brief sai da secao de leitura aberta com epoch_enter
+void epoch_exit(void);
+
+/// @brief retira um bloco que ja nao esta acessivel a partir da tabela
+/// @param ptr o bloco
+/// @param free_fn funcao que o liberta quando ja nenhum leitor o pode ver
+void epoch_retire(void *ptr, void (*free_fn)(void *));
+
+/// @brief liberta tudo o que foi retirado; so pode ser chamada quando mais
+/// nenhuma thread usa a tabela (no fim do servidor)
+void epoch_drain(void);
+
+#endif // KVS_EPOCH_H
@@ -1,8 +1,13 @@
+#include "io.h"
+
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "src/common/io.h"
 
 void write_uint(int fd, int value) {
   char buffer[16];
@@ -27,3 +32,70 @@ size_t strn_memcpy(char *dest, const char *src, size_t n) {
   memcpy(dest, src, bytes_to_copy);
   return bytes_to_copy;
 }
+
+static _Thread_local OutBuf outbuf = {NULL, 0, 0, -1};
+static pthread_key_t outbuf_key; //liberta o buffer quando a thread acaba
+static pthread_once_t outbuf_key_once = PTHREAD_ONCE_INIT;
+
+static void free_outbuf(void *arg) {
+  OutBuf *buf = arg;
+  free(buf->data);
+  buf->data = NULL;
+  buf->cap = 0;
+}
+
+static void create_outbuf_key(void) {
+  pthread_key_create(&outbuf_key, free_outbuf);
+}
+
+OutBuf *outbuf_begin(int fd) {
+  if (outbuf.data == NULL) {
+    pthread_once(&outbuf_key_once, create_outbuf_key);
+    pthread_setspecific(outbuf_key, &outbuf);
+  }
+  outbuf.len = 0;
+  outbuf.fd = fd;
+  return &outbuf;
+}
+
+//escreve diretamente no fd o que nao coube no buffer
+static void write_direct(OutBuf *buf, const char *data, size_t n) {
+  outbuf_flush(buf);
+  write_all(buf->fd, data, n);
+}
+
+void outbuf_write(OutBuf *buf, const char *data, size_t n) {
+  if (buf->len + n > buf->cap) {
+    size_t cap = buf->cap == 0 ? OUTBUF_INITIAL_SIZE : buf->cap;
+    while (cap < buf->len + n) {
+      cap *= 2;
+    }
+    char *aux = realloc(buf->data, cap);
+    if (aux == NULL) {
+      //sem memoria: perde o buffer mas nao a saida
+      write_direct(buf, data, n);
+      return;
+    }
+    buf->data = aux;
+    buf->cap = cap;
+  }
+  memcpy(buf->data + buf->len, data, n);
+  buf->len += n;
+}
+
+void outbuf_str(OutBuf *buf, const char *str) {
+  outbuf_write(buf, str, strlen(str));
+}
+
+void outbuf_flush(OutBuf *buf) {
+  if (buf->len > 0) {
+    write_all(buf->fd, buf->data, buf->len);
+    buf->len = 0;
+  }
+  if (buf->cap > OUTBUF_MAX_KEEP) {
+    //nao guarda o buffer de um SHOW grande para sempre
+    free(buf->data);
+    buf->data = NULL;
+    buf->cap = 0;
+  }
+}
@@ -15,4 +15,37 @@ void write_uint(int fd, int value);
 /// @return Number of bytes copied
 size_t strn_memcpy(char *dest, const char *src, size_t n);
 
+#define OUTBUF_INITIAL_SIZE 4096 // tamanho inicial do buffer de saida
+#define OUTBUF_MAX_KEEP (1 << 20) // acima disto o buffer e libertado no flush
+
+/// Per-thread output buffer: a command appends its whole output while it
+/// holds the locks and writes it with a single write after releasing them.
+typedef struct OutBuf {
+  char *data;
+  size_t len;
+  size_t cap;
+  int fd; // where outbuf_flush writes
+} OutBuf;
+
+/// @brief returns this thread's output buffer, empty and bound to fd
+/// @param fd File descriptor where the buffer will be flushed
+/// @return the buffer (never NULL)
+OutBuf *outbuf_begin(int fd);
+
+/// @brief appends n bytes to the buffer, growing it; if there is no memory
+/// to grow, what is already buffered is written to the fd first
+/// @param buf the buffer
+/// @param data bytes to append
+/// @param n number of bytes
+void outbuf_write(OutBuf *buf, const char *data, size_t n);
+
+/// @brief appends a string to the buffer (without the '\0')
+/// @param buf the buffer
+/// @param str the string
+void outbuf_str(OutBuf *buf, const char *str);
+
+/// @brief writes everything in the buffer to its fd and empties it
+/// @param buf the buffer
+void outbuf_flush(OutBuf *buf);
+
 #endif // KVS_IO_H
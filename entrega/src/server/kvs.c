@@ -1,326 +1,1453 @@
 #include "kvs.h"
 
-#include <ctype.h>
 #include <stdlib.h>
+#include <sched.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdbool.h>
 
 #include "string.h"
+#include "io.h"
 #include "src/common/io.h"
 #include "src/common/constants.h"
+#include "epoch.h"
+#include "pool.h"
+#include "reclaim.h"
+#include "snapshot.h"
+#include "timer.h"
 
-// Hash function based on key initial.
-// @param key Lowercase alphabetical string.
-// @return hash.
-// NOTE: This is not an ideal hash function, but is useful for test purposes of
-// the project
-int hash(const char *key) {
-  int firstLetter = tolower(key[0]);
-  if (firstLetter >= 'a' && firstLetter <= 'z') {
-    return firstLetter - 'a';
-  } else if (firstLetter >= '0' && firstLetter <= '9') {
-    return firstLetter - '0';
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KEY_COMPARE_SIMD 1
+#endif
+
+uint64_t hash(const char *key) {
+  uint64_t h = 14695981039346656037ULL; // FNV offset basis
+  for (const unsigned char *c = (const unsigned char *)key; *c != '\0'; c++) {
+    h ^= *c;
+    h *= 1099511628211ULL; // FNV prime
+  }
+  // avalanche final para os bits baixos (usados no indice) dependerem de
+  // todos os bytes da chave
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static atomic_size_t num_allocs = 0; //blocos alocados pela tabela
+static atomic_size_t num_frees = 0; //blocos libertados pela tabela
+
+//calloc/aligned_alloc/realloc/free da tabela, contados para as estatisticas
+static void *kvs_calloc(size_t num, size_t size) {
+  atomic_fetch_add_explicit(&num_allocs, 1, memory_order_relaxed);
+  return calloc(num, size);
+}
+
+static void *kvs_aligned_alloc(size_t alignment, size_t size) {
+  atomic_fetch_add_explicit(&num_allocs, 1, memory_order_relaxed);
+  return aligned_alloc(alignment, size);
+}
+
+//um realloc de NULL conta como um bloco novo; mudar o tamanho de um bloco
+//nao muda as contas
+static void *kvs_realloc(void *ptr, size_t size) {
+  void *result = realloc(ptr, size);
+  if (ptr == NULL && result != NULL) {
+    atomic_fetch_add_explicit(&num_allocs, 1, memory_order_relaxed);
+  }
+  return result;
+}
+
+static void kvs_free(void *ptr) {
+  if (ptr != NULL) {
+    atomic_fetch_add_explicit(&num_frees, 1, memory_order_relaxed);
+    free(ptr);
   }
-  return -1; // Invalid index for non-alphabetic or number strings
+}
+
+//nos das listas de subscricoes dos clientes
+static Pool subscriptions_pool;
+//versoes dos valores dos pares
+static Pool versions_pool;
+
+//trabalho do reclaimer para os subscritores de um par apagado
+typedef struct DeferredDelete {
+  ReclaimJob job;
+  KeyNode *par; //o par, com uma referencia do trabalho
+  SubscriberSet *subs; //subscritores tirados ao par
+} DeferredDelete;
+
+static Pool deferred_pool;
+static int num_tables = 0; //tabelas que usam as pools (muda so no kvs_init)
+
+void get_alloc_stats(size_t *allocs, size_t *frees) {
+  *allocs = atomic_load_explicit(&num_allocs, memory_order_relaxed);
+  *frees = atomic_load_explicit(&num_frees, memory_order_relaxed);
+}
+
+_Static_assert(KEY_SLOT_SIZE == 48, "as comparacoes assumem chaves de 48 bytes");
+
+//as chaves dos pares e a chave procurada tem todas padding a zeros ate
+//KEY_SLOT_SIZE, por isso compara-las e comparar 48 bytes sem procurar o '\0'
+static bool key_equal_scalar(const char *a, const char *b) {
+  uint64_t diff = 0;
+  for (size_t i = 0; i < KEY_SLOT_SIZE; i += sizeof(uint64_t)) {
+    uint64_t x, y;
+    memcpy(&x, a + i, sizeof(x));
+    memcpy(&y, b + i, sizeof(y));
+    diff |= x ^ y;
+  }
+  return diff == 0;
+}
+
+#ifdef KEY_COMPARE_SIMD
+//tres blocos de 16 bytes
+__attribute__((target("sse2"))) static bool key_equal_sse2(const char *a,
+                                                           const char *b) {
+  __m128i d0 = _mm_xor_si128(_mm_loadu_si128((const __m128i_u *)a),
+                             _mm_loadu_si128((const __m128i_u *)b));
+  __m128i d1 = _mm_xor_si128(_mm_loadu_si128((const __m128i_u *)(a + 16)),
+                             _mm_loadu_si128((const __m128i_u *)(b + 16)));
+  __m128i d2 = _mm_xor_si128(_mm_loadu_si128((const __m128i_u *)(a + 32)),
+                             _mm_loadu_si128((const __m128i_u *)(b + 32)));
+  __m128i d = _mm_or_si128(_mm_or_si128(d0, d1), d2);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(d, _mm_setzero_si128())) == 0xFFFF;
+}
+
+//um bloco de 32 bytes e um de 16
+__attribute__((target("avx2"))) static bool key_equal_avx2(const char *a,
+                                                           const char *b) {
+  __m256i d0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i_u *)a),
+                                _mm256_loadu_si256((const __m256i_u *)b));
+  __m128i d1 = _mm_xor_si128(_mm_loadu_si128((const __m128i_u *)(a + 32)),
+                             _mm_loadu_si128((const __m128i_u *)(b + 32)));
+  return _mm256_testz_si256(d0, d0) && _mm_testz_si128(d1, d1);
+}
+#endif
+
+//comparacao de chaves escolhida em create_hash_table conforme o CPU
+static bool (*key_equal)(const char *, const char *) = key_equal_scalar;
+
+static void select_key_equal(void) {
+#ifdef KEY_COMPARE_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    key_equal = key_equal_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    key_equal = key_equal_sse2;
+  }
+#endif
+}
+
+//copia a chave para probe com padding a zeros, no formato das chaves dos pares
+static void pad_key(char probe[KEY_SLOT_SIZE], const char *key) {
+  size_t len = strnlen(key, KEY_SLOT_SIZE - 1);
+  memcpy(probe, key, len);
+  memset(probe + len, 0, KEY_SLOT_SIZE - len);
+}
+
+//memoria contada por cada par: o no e, em media, o no da skiplist (as
+//versoes do valor sao contadas a parte, tal como os nos da arvore radix)
+static size_t pair_memory(HashTable *ht) {
+  return ht->radix != NULL
+             ? sizeof(KeyNode)
+             : sizeof(KeyNode) + sizeof(SkipNode) + 2 * sizeof(void *);
+}
+
+//acrescenta o par ao indice ordenado
+static int index_insert(HashTable *ht, KeyNode *keyNode) {
+  return ht->radix != NULL ? radix_insert(ht->radix, keyNode)
+                           : skiplist_insert(&ht->index, keyNode);
+}
+
+//tira a chave do indice ordenado
+static void index_remove(HashTable *ht, const char *key) {
+  if (ht->radix != NULL) {
+    radix_remove(ht->radix, key);
+  } else {
+    skiplist_remove(&ht->index, key);
+  }
+}
+
+//memoria de um array de buckets
+static size_t buckets_memory(size_t size) {
+  return sizeof(BucketArray) + size * sizeof(_Atomic(KeyNode *));
+}
+
+//cria um array de buckets vazio
+static BucketArray *new_buckets(size_t size) {
+  BucketArray *buckets =
+      kvs_calloc(1, sizeof(BucketArray) + size * sizeof(_Atomic(KeyNode *)));
+  if (buckets != NULL) {
+    buckets->size = size;
+  }
+  return buckets;
 }
 
 struct HashTable *create_hash_table() {
-  HashTable *ht = malloc(sizeof(HashTable));
+  HashTable *ht = kvs_aligned_alloc(_Alignof(HashTable), sizeof(HashTable));
   if (!ht)
     return NULL;
-  for (int i = 0; i < TABLE_SIZE; i++) {
-    ht->table[i] = NULL;
+  BucketArray *table = new_buckets(TABLE_INITIAL_SIZE);
+  if (!table) {
+    kvs_free(ht);
+    return NULL;
+  }
+  atomic_init(&ht->table, table);
+  atomic_init(&ht->old_table, NULL);
+  atomic_init(&ht->count, 0);
+  atomic_init(&ht->stripes_rehashed, 0);
+  for (int i = 0; i < NUM_STRIPES; i++) {
+    pthread_rwlock_init(&ht->stripes[i].lock, NULL);
+    atomic_init(&ht->stripes[i].seq, 0);
+    ht->stripes[i].rehash_pos = 0;
   }
   pthread_rwlock_init(&ht->tablelock, NULL);
+  skiplist_init(&ht->index);
+  ht->radix = NULL;
+  ht->bloom = NULL;
+  ht->mem_budget = 0;
+  atomic_init(&ht->mem_used, buckets_memory(TABLE_INITIAL_SIZE));
+  atomic_init(&ht->clock_hand, 0);
+  atomic_init(&ht->evictions, 0);
+  ht->clock = &ht->own_clock;
+  atomic_init(&ht->own_clock.next_commit, 0);
+  atomic_init(&ht->own_clock.visible_commit, 0);
+  atomic_init(&ht->own_clock.horizon, 0);
+  atomic_init(&ht->versions_freed, 0);
+  pthread_mutex_init(&ht->tombstones_lock, NULL);
+  ht->tombstones = NULL;
+  ht->tombstones_head = 0;
+  ht->num_tombstones = 0;
+  ht->tombstones_capacity = 0;
+  select_key_equal();
+  //as pools sao partilhadas por todas as tabelas (shards)
+  if (num_tables++ == 0) {
+    pool_init(&subscriptions_pool, "subscriptions", sizeof(Subscriptions));
+    pool_init(&versions_pool, "versions", sizeof(ValueVersion));
+    pool_init(&deferred_pool, "deferred", sizeof(DeferredDelete));
+  }
   return ht;
 }
 
-//notifica todos os subs do par para informar que houve alteracao
-int notificarSubs(KeyNode *keyNode,const char *newValue){
-  Subscribers *currentSub = keyNode->head_subscribers;
-  while (currentSub != NULL) {
-    Cliente *cliente = currentSub->subscriber;
-    char mensagem[83];
-    pad_string(&mensagem[0], keyNode->key, 41);
-    pad_string(&mensagem[41], newValue, 41);
-    mensagem[82] = '\0';
-    if(cliente->notif_pipe==0){
-      cliente->notif_pipe = open(cliente->notif_pipe_path, O_WRONLY); //abre o pipe das notificacoes para escrita
-    }
-    if(write_all(cliente->notif_pipe, mensagem, 82)!=1){
-      //erro
+int enable_bloom_filter(HashTable *ht, size_t counters, unsigned hashes) {
+  if (ht->bloom != NULL || atomic_load(&ht->count) != 0) {
+    return 1;
+  }
+  ht->bloom = bloom_create(counters, hashes);
+  return ht->bloom == NULL;
+}
+
+int enable_radix_index(HashTable *ht) {
+  if (ht->radix != NULL || atomic_load(&ht->count) != 0) {
+    return 1;
+  }
+  ht->radix = radix_create(&ht->mem_used);
+  return ht->radix == NULL;
+}
+
+void set_memory_budget(HashTable *ht, size_t bytes) {
+  ht->mem_budget = bytes;
+}
+
+void share_commit_clock(HashTable *ht, HashTable *from) {
+  ht->clock = from->clock;
+}
+
+uint64_t commit_begin(HashTable *ht) {
+  //o horizonte e calculado uma vez por lote e nao em cada versao; um valor
+  //antigo so faz com que se guardem versoes a mais
+  CommitClock *clock = ht->clock;
+  atomic_store(&clock->horizon, snapshot_oldest(&clock->visible_commit));
+  return atomic_fetch_add(&clock->next_commit, 1) + 1;
+}
+
+void commit_end(HashTable *ht, uint64_t commit) {
+  //os commits ficam visiveis pela ordem em que foram reservados, para um
+  //snapshot nunca ver um commit sem ver tambem os anteriores
+  CommitClock *clock = ht->clock;
+  for (int spin = 0; atomic_load(&clock->visible_commit) != commit - 1;
+       spin++) {
+    if (spin >= COMMIT_SPINS) {
+      sched_yield();
+    }
+  }
+  atomic_store(&clock->visible_commit, commit);
+}
+
+//stripe de um hash; como os tamanhos das tabelas sao multiplos de
+//NUM_STRIPES, um bucket (antigo ou novo) pertence sempre a stripe do hash
+static size_t stripe_index(uint64_t h) {
+  return h & (NUM_STRIPES - 1);
+}
+
+uint64_t stripe_bit(const char *key) {
+  return 1ULL << stripe_index(hash(key));
+}
+
+void lock_stripes(HashTable *ht, uint64_t stripes, bool write) {
+  pthread_rwlock_rdlock(&ht->tablelock);
+  //por ordem crescente de stripe, para nao haver deadlocks entre lotes
+  for (size_t i = 0; i < NUM_STRIPES; i++) {
+    if (stripes & (1ULL << i)) {
+      if (write) {
+        pthread_rwlock_wrlock(&ht->stripes[i].lock);
+      } else {
+        pthread_rwlock_rdlock(&ht->stripes[i].lock);
+      }
+    }
+  }
+}
+
+void unlock_stripes(HashTable *ht, uint64_t stripes) {
+  for (size_t i = 0; i < NUM_STRIPES; i++) {
+    if (stripes & (1ULL << i)) {
+      pthread_rwlock_unlock(&ht->stripes[i].lock);
+    }
+  }
+  pthread_rwlock_unlock(&ht->tablelock);
+}
+
+bool read_stripes_begin(HashTable *ht, uint64_t stripes, unsigned *seqs) {
+  for (size_t i = 0; i < NUM_STRIPES; i++) {
+    if (stripes & (1ULL << i)) {
+      unsigned seq = atomic_load(&ht->stripes[i].seq);
+      for (int spin = 0; (seq & 1) && spin < STRIPE_READ_SPINS; spin++) {
+        seq = atomic_load(&ht->stripes[i].seq);
+      }
+      if (seq & 1) {
+        //a escrita esta a demorar, o leitor deve bloquear a stripe
+        return false;
+      }
+      seqs[i] = seq;
+    }
+  }
+  return true;
+}
+
+bool read_stripes_validate(HashTable *ht, uint64_t stripes,
+                           const unsigned *seqs) {
+  for (size_t i = 0; i < NUM_STRIPES; i++) {
+    if ((stripes & (1ULL << i)) && atomic_load(&ht->stripes[i].seq) != seqs[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//procura o par num bucket; pode ser usada sem locks dentro de uma epoca
+static KeyNode *find_in_bucket(_Atomic(KeyNode *) *bucket, const char *probe,
+                               uint64_t h) {
+  for (KeyNode *keyNode = atomic_load(bucket); keyNode != NULL;
+       keyNode = atomic_load(&keyNode->next)) {
+    //o hash esta na mesma linha de cache que a chave e quase sempre evita
+    //a comparacao das chaves
+    if (keyNode->hash == h && key_equal(keyNode->key, probe)) {
+      return keyNode;
+    }
+  }
+  return NULL;
+}
+
+//procura o par com esta chave (na tabela antiga ou na atual); sem locks tem
+//de ser chamada dentro de uma epoca, e so um resultado encontrado e certo
+//(um par a ser migrado pode escapar, o que se deteta pela sequencia)
+static KeyNode *find_node(HashTable *ht, const char *key, uint64_t h) {
+  //a tabela atual e lida antes da antiga: a troca escreve-as pela ordem
+  //inversa, por isso nunca se ve a tabela nova sem ver tambem a antiga
+  BucketArray *table = atomic_load(&ht->table);
+  BucketArray *old = atomic_load(&ht->old_table);
+  char probe[KEY_SLOT_SIZE];
+  pad_key(probe, key);
+  if (old != NULL) {
+    //os buckets ja migrados estao vazios; os pares novos vao sempre para a
+    //tabela atual, por isso se nao estiver aqui ainda pode estar la
+    KeyNode *keyNode =
+        find_in_bucket(&old->buckets[h & (old->size - 1)], probe, h);
+    if (keyNode != NULL) {
+      return keyNode;
+    }
+  }
+  return find_in_bucket(&table->buckets[h & (table->size - 1)], probe, h);
+}
+
+//retorna o endereco do ponteiro que aponta para o par com esta chave, ou
+//NULL se a chave nao existe (o chamador tem a stripe para escrita)
+static _Atomic(KeyNode *) *find_link(HashTable *ht, const char *key,
+                                     uint64_t h) {
+  BucketArray *arrays[2] = {atomic_load(&ht->old_table),
+                            atomic_load(&ht->table)};
+  char probe[KEY_SLOT_SIZE];
+  pad_key(probe, key);
+  for (int i = 0; i < 2; i++) {
+    if (arrays[i] == NULL) {
+      continue;
+    }
+    _Atomic(KeyNode *) *link = &arrays[i]->buckets[h & (arrays[i]->size - 1)];
+    for (KeyNode *keyNode = atomic_load(link); keyNode != NULL;
+         keyNode = atomic_load(link)) {
+      if (keyNode->hash == h && key_equal(keyNode->key, probe)) {
+        return link;
+      }
+      link = &keyNode->next;
+    }
+  }
+  return NULL;
+}
+
+//migra um bucket da tabela antiga para a atual; quem estiver a ler o bucket
+//sem locks pode perder pares, por isso a sequencia da stripe tem de estar
+//impar
+static void migrate_bucket(BucketArray *old, BucketArray *table,
+                           size_t old_index) {
+  KeyNode *keyNode = atomic_load(&old->buckets[old_index]);
+  while (keyNode != NULL) {
+    KeyNode *next = atomic_load(&keyNode->next);
+    size_t index = keyNode->hash & (table->size - 1);
+    atomic_store(&keyNode->next, atomic_load(&table->buckets[index]));
+    atomic_store(&table->buckets[index], keyNode);
+    keyNode = next;
+  }
+  atomic_store(&old->buckets[old_index], NULL);
+}
+
+//migra alguns buckets da stripe da tabela antiga para a atual, para que o
+//custo do rehash fique dividido pelas escritas em vez de parar uma so escrita
+//(o chamador tem o lock da stripe para escrita)
+static void rehash_step(HashTable *ht, size_t stripe) {
+  BucketArray *old = atomic_load(&ht->old_table);
+  if (old == NULL) {
+    return;
+  }
+  BucketArray *table = atomic_load(&ht->table);
+  Stripe *st = &ht->stripes[stripe];
+  size_t stripe_buckets = old->size / NUM_STRIPES;
+  if (st->rehash_pos >= stripe_buckets) {
+    return;
+  }
+  //limita tambem os buckets vazios visitados para o passo ser sempre curto
+  size_t empty_visits = REHASH_STEP * 10;
+  for (int moved = 0; moved < REHASH_STEP && st->rehash_pos < stripe_buckets;) {
+    size_t old_index = st->rehash_pos * NUM_STRIPES + stripe;
+    if (atomic_load(&old->buckets[old_index]) != NULL) {
+      //sequencia impar: os leitores sem locks sabem que ha pares a mudar de
+      //lista (as outras escritas nao mexem nas listas que eles percorrem)
+      atomic_fetch_add(&st->seq, 1);
+      migrate_bucket(old, table, old_index);
+      atomic_fetch_add(&st->seq, 1);
+      moved++;
+    } else if (--empty_visits == 0) {
+      st->rehash_pos++;
+      break;
+    }
+    st->rehash_pos++;
+  }
+  if (st->rehash_pos >= stripe_buckets) {
+    //esta stripe acabou, a tabela antiga e retirada em table_maintenance
+    atomic_fetch_add(&ht->stripes_rehashed, 1);
+  }
+}
+
+//true se a tabela atual tem mais pares do que o permitido
+static bool table_too_full(HashTable *ht) {
+  return atomic_load(&ht->count) >
+         atomic_load(&ht->table)->size * TABLE_MAX_LOAD;
+}
+
+void table_maintenance(HashTable *ht) {
+  bool rehash_done = atomic_load(&ht->old_table) != NULL &&
+                     atomic_load(&ht->stripes_rehashed) == NUM_STRIPES;
+  if (!rehash_done && !table_too_full(ht)) {
+    return;
+  }
+  pthread_rwlock_wrlock(&ht->tablelock);
+  //volta a verificar, outra thread pode ter feito o trabalho entretanto
+  BucketArray *old = atomic_load(&ht->old_table);
+  BucketArray *table = atomic_load(&ht->table);
+  if (old != NULL && table_too_full(ht)) {
+    //precisa de crescer outra vez mas ha stripes que nao acabaram o rehash
+    //(nao houve escritas nelas); acaba-o agora, ja com a tabela toda
+    for (int i = 0; i < NUM_STRIPES; i++) {
+      atomic_fetch_add(&ht->stripes[i].seq, 1);
+    }
+    for (size_t i = 0; i < old->size; i++) {
+      migrate_bucket(old, table, i);
+    }
+    for (int i = 0; i < NUM_STRIPES; i++) {
+      atomic_fetch_add(&ht->stripes[i].seq, 1);
+    }
+    atomic_store(&ht->stripes_rehashed, NUM_STRIPES);
+  }
+  if (old != NULL && atomic_load(&ht->stripes_rehashed) == NUM_STRIPES) {
+    //rehash terminado; ainda pode haver leitores sem locks na tabela antiga
+    atomic_store(&ht->old_table, NULL);
+    atomic_fetch_sub(&ht->mem_used, buckets_memory(old->size));
+    epoch_retire(old, kvs_free);
+    old = NULL;
+  }
+  if (old == NULL && table_too_full(ht)) {
+    //comeca um rehash para uma tabela com o dobro dos buckets; os pares so
+    //sao migrados em rehash_step
+    BucketArray *new_table = new_buckets(table->size * 2);
+    //sem memoria continua com a tabela atual, so fica mais lenta
+    if (new_table != NULL) {
+      atomic_fetch_add(&ht->mem_used, buckets_memory(new_table->size));
+      for (int i = 0; i < NUM_STRIPES; i++) {
+        ht->stripes[i].rehash_pos = 0;
+      }
+      atomic_store(&ht->stripes_rehashed, 0);
+      atomic_store(&ht->old_table, table);
+      atomic_store(&ht->table, new_table);
+    }
+  }
+  pthread_rwlock_unlock(&ht->tablelock);
+}
+
+//entrada inicial do cliente no indice (espalha os ids, que sao seguidos)
+static size_t subscriber_home(int id, size_t mask) {
+  return (size_t)(((uint64_t)(unsigned)id * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+//entrada do indice onde o cliente esta ou, se nao esta, a entrada vazia
+//onde ficaria (sondagem linear)
+static size_t subscriber_slot(const SubscriberSet *set, int id) {
+  size_t mask = 2 * set->capacity - 1;
+  size_t i = subscriber_home(id, mask);
+  while (set->index[i].pos != 0 && set->index[i].id != id) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+//conjunto vazio com espaco para capacity subscritores
+static SubscriberSet *subscriber_set_new(size_t capacity) {
+  SubscriberSet *set = kvs_calloc(1, sizeof(SubscriberSet) +
+                                         capacity * sizeof(Cliente *) +
+                                         capacity * sizeof(Subscriptions *) +
+                                         2 * capacity * sizeof(SubscriberSlot));
+  if (set == NULL) {
+    return NULL;
+  }
+  set->capacity = capacity;
+  set->members = (Cliente **)(set + 1);
+  set->edges = (Subscriptions **)(set->members + capacity);
+  set->index = (SubscriberSlot *)(set->edges + capacity);
+  return set;
+}
+
+//copia o conjunto para um bloco com outra capacidade e liberta o antigo
+//retorna o conjunto novo, NULL se nao havia memoria (o antigo fica)
+static SubscriberSet *subscriber_set_resize(SubscriberSet *set,
+                                            size_t capacity) {
+  SubscriberSet *new_set = subscriber_set_new(capacity);
+  if (new_set == NULL) {
+    return NULL;
+  }
+  for (size_t i = 0; i < set->count; i++) {
+    Cliente *cliente = set->members[i];
+    new_set->members[i] = cliente;
+    new_set->edges[i] = set->edges[i];
+    SubscriberSlot *slot = &new_set->index[subscriber_slot(new_set, cliente->id)];
+    slot->id = cliente->id;
+    slot->pos = (uint32_t)i + 1;
+  }
+  new_set->count = set->count;
+  kvs_free(set);
+  return new_set;
+}
+
+//junta o cliente da subscricao aos subscritores do par (o chamador tem a
+//stripe)
+//0 se certo, 1 se nao havia memoria
+static int subscriber_set_add(KeyNode *par, Subscriptions *sub) {
+  Cliente *cliente = sub->cliente;
+  SubscriberSet *set = par->subscribers;
+  if (set == NULL) {
+    set = subscriber_set_new(SUBSCRIBERS_INITIAL);
+    if (set == NULL) {
+      return 1;
+    }
+    par->subscribers = set;
+  } else if (set->index[subscriber_slot(set, cliente->id)].pos != 0) {
+    return 0; //ja estava
+  } else if (set->count == set->capacity) {
+    set = subscriber_set_resize(set, set->capacity * 2);
+    if (set == NULL) {
       return 1;
     }
-    currentSub = currentSub->next; //próximo subscritor
+    par->subscribers = set;
   }
+  SubscriberSlot *slot = &set->index[subscriber_slot(set, cliente->id)];
+  set->edges[set->count] = sub;
+  set->members[set->count++] = cliente;
+  slot->id = cliente->id;
+  slot->pos = (uint32_t)set->count;
   return 0;
 }
 
-int write_pair(HashTable *ht, const char *key, const char *value) {
-  int index = hash(key);
+//tira o cliente aos subscritores do par (o chamador tem a stripe)
+//0 se certo, 1 se nao estava
+static int subscriber_set_remove(KeyNode *par, int id) {
+  SubscriberSet *set = par->subscribers;
+  if (set == NULL) {
+    return 1;
+  }
+  size_t mask = 2 * set->capacity - 1;
+  size_t hole = subscriber_slot(set, id);
+  if (set->index[hole].pos == 0) {
+    return 1;
+  }
+  size_t pos = set->index[hole].pos - 1;
+  //puxa para tras as entradas seguintes que podem ocupar o buraco, para a
+  //sondagem nunca parar antes de uma entrada que existe
+  for (size_t i = (hole + 1) & mask; set->index[i].pos != 0; i = (i + 1) & mask) {
+    size_t home = subscriber_home(set->index[i].id, mask);
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      set->index[hole] = set->index[i];
+      hole = i;
+    }
+  }
+  set->index[hole].pos = 0;
 
-  // Search for the key node
-  KeyNode *keyNode = ht->table[index];
-  KeyNode *previousNode;
+  //o ultimo do array passa para o lugar do que saiu
+  set->count--;
+  if (pos != set->count) {
+    Cliente *last = set->members[set->count];
+    set->members[pos] = last;
+    set->edges[pos] = set->edges[set->count];
+    set->index[subscriber_slot(set, last->id)].pos = (uint32_t)pos + 1;
+  }
+  if (set->count == 0) {
+    kvs_free(set);
+    par->subscribers = NULL;
+  } else if (set->capacity > SUBSCRIBERS_INITIAL &&
+             set->count <= set->capacity / 4) {
+    //sem memoria para encolher fica como esta
+    SubscriberSet *smaller = subscriber_set_resize(set, set->capacity / 2);
+    if (smaller != NULL) {
+      par->subscribers = smaller;
+    }
+  }
+  return 0;
+}
 
-  while (keyNode != NULL) {
-    if (strcmp(keyNode->key, key) == 0) {
-      // overwrite value
-      free(keyNode->value);
-      keyNode->value = strdup(value);
-      return notificarSubs(keyNode, value);
-    }
-    previousNode = keyNode;
-    keyNode = previousNode->next; // Move to the next node
-  }
-  // Key not found, create a new key node
-  keyNode = malloc(sizeof(KeyNode));
-  keyNode->key = strdup(key);       // Allocate memory for the key
-  keyNode->value = strdup(value);   // Allocate memory for the value
-  keyNode->next = ht->table[index]; // Link to existing nodes
-  keyNode->head_subscribers = NULL; //para a linked list
-  ht->table[index] = keyNode; // Place new key node at the start of the list
+//subscricao do cliente ao par, NULL se nao esta subscrito (o chamador tem a
+//stripe)
+static Subscriptions *find_subscription(KeyNode *par, Cliente *cliente) {
+  SubscriberSet *set = par->subscribers;
+  if (set == NULL) {
+    return NULL;
+  }
+  SubscriberSlot *slot = &set->index[subscriber_slot(set, cliente->id)];
+  return slot->pos != 0 ? set->edges[slot->pos - 1] : NULL;
+}
+
+//mete a subscricao no inicio da lista do cliente (o chamador tem o lock do
+//cliente)
+static void link_subscription(Cliente *cliente, Subscriptions *sub) {
+  sub->prev = NULL;
+  sub->next = cliente->head_subscricoes;
+  if (sub->next != NULL) {
+    sub->next->prev = sub;
+  }
+  cliente->head_subscricoes = sub;
+  cliente->num_subscricoes++;
+}
+
+//tira a subscricao da lista do cliente (o chamador tem o lock do cliente)
+static void unlink_subscription(Cliente *cliente, Subscriptions *sub) {
+  if (sub->prev != NULL) {
+    sub->prev->next = sub->next;
+  } else {
+    cliente->head_subscricoes = sub->next;
+  }
+  if (sub->next != NULL) {
+    sub->next->prev = sub->prev;
+  }
+  cliente->num_subscricoes--;
+}
+
+//notifica todos os subs do par para informar que houve alteracao
+int notificarSubs(KeyNode *keyNode,const char *newValue){
+  SubscriberSet *set = keyNode->subscribers;
+  if (set == NULL) {
+    return 0;
+  }
+  //a mensagem e feita uma vez e partilhada pelas filas de todos os subs
+  NotifyFrame *frame = notify_frame(keyNode->key, newValue);
+  if (frame == NULL) {
+    return 1;
+  }
+  for (size_t i = 0; i < set->count; i++) {
+    //so poe na fila do cliente: quem escreve no pipe e a notificadora
+    notify_push(&set->members[i]->notif, frame);
+  }
+  notify_frame_release(frame);
   return 0;
 }
 
-char *read_pair(HashTable *ht, const char *key) {
-  int index = hash(key);
+//true se a versao tem um prazo que ja passou
+static bool version_expired(const ValueVersion *version) {
+  return version->expires_at != 0 && version->expires_at <= timer_now();
+}
 
-  KeyNode *keyNode = ht->table[index];
-  KeyNode *previousNode;
-  char *value;
+bool pair_expired(const KeyNode *keyNode) {
+  return version_expired(atomic_load(&keyNode->versions));
+}
 
-  while (keyNode != NULL) {
-    if (strcmp(keyNode->key, key) == 0) {
-      value = strdup(keyNode->value);
-      return value; // Return the value if found
-    }
-    previousNode = keyNode;
-    keyNode = previousNode->next; // Move to the next node
-  }
-
-  return NULL; // Key not found
-}
-
-//apaga a subscricao de um par a todos os clientes que o tenham subscrito
-void deleteSub(KeyNode *par){
-  if(par->head_subscribers!=NULL){
-    Subscribers *sub_atual = par->head_subscribers;
-    //vai a todos os subscritores desta key
-    while(sub_atual!=NULL){
-      Cliente *cliente_atual = sub_atual->subscriber; 
-      Subscriptions *subscriptionAtual = cliente_atual->head_subscricoes;
-      Subscriptions *subscription_prev = NULL;
-      //vai a todas as subscricoes deste subscritor ate encontrarmos a key que queremos
-      while(subscriptionAtual->par->key != par->key) {
-        //ainda nao encontramos
-        subscription_prev = subscriptionAtual;
-        subscriptionAtual = subscriptionAtual ->next;
-      }
-      //encontramos a key
-      if(subscription_prev==NULL){
-        //era a primeira sub
-        cliente_atual->head_subscricoes = subscriptionAtual ->next;
-      }else{
-        subscription_prev ->next = subscriptionAtual ->next;
+const ValueVersion *pair_version(const KeyNode *keyNode, uint64_t snapshot) {
+  const ValueVersion *version = atomic_load(&keyNode->versions);
+  while (version != NULL && version->commit > snapshot) {
+    version = atomic_load(&version->older);
+  }
+  if (version == NULL || version->deleted || version_expired(version)) {
+    return NULL;
+  }
+  return version;
+}
+
+//cria uma versao (value NULL para um tombstone)
+static ValueVersion *new_version(HashTable *ht, const char *value,
+                                 uint64_t expires_at, uint64_t commit) {
+  ValueVersion *version = pool_alloc(&versions_pool);
+  if (version == NULL) {
+    return NULL;
+  }
+  size_t len = value != NULL ? strnlen(value, MAX_STRING_SIZE) : 0;
+  version->commit = commit;
+  atomic_init(&version->older, NULL);
+  version->expires_at = expires_at;
+  version->deleted = value == NULL;
+  version->value_len = (uint8_t)len;
+  if (len > 0) {
+    memcpy(version->value, value, len);
+  }
+  version->value[len] = '\0';
+  atomic_fetch_add(&ht->mem_used, sizeof(ValueVersion));
+  return version;
+}
+
+//liberta uma cadeia de versoes a que ja nenhum leitor chega
+static void free_versions(void *arg) {
+  ValueVersion *version = arg;
+  while (version != NULL) {
+    ValueVersion *older = atomic_load(&version->older);
+    pool_free(&versions_pool, version);
+    version = older;
+  }
+}
+
+//num de versoes de uma cadeia
+static size_t count_versions(ValueVersion *version) {
+  size_t n = 0;
+  for (; version != NULL; version = atomic_load(&version->older)) {
+    n++;
+  }
+  return n;
+}
+
+//corta as versoes que ja nenhum snapshot pode ler: todos os snapshots
+//abertos sao >= horizonte, por isso param na primeira versao com commit <=
+//horizonte e as que vem depois dela nunca mais sao lidas
+static void trim_versions(HashTable *ht, ValueVersion *version) {
+  uint64_t horizon = atomic_load(&ht->clock->horizon);
+  while (version != NULL && version->commit > horizon) {
+    version = atomic_load(&version->older);
+  }
+  if (version == NULL) {
+    return;
+  }
+  ValueVersion *old = atomic_exchange(&version->older, NULL);
+  if (old != NULL) {
+    size_t n = count_versions(old);
+    atomic_fetch_sub(&ht->mem_used, n * sizeof(ValueVersion));
+    atomic_fetch_add(&ht->versions_freed, n);
+    epoch_retire(old, free_versions);
+  }
+}
+
+//poe uma versao nova a frente das do par (value NULL para um tombstone); o
+//chamador tem a stripe para escrita. os leitores veem a cadeia antiga ou a
+//nova, nunca um valor a meio
+static int push_version(HashTable *ht, KeyNode *keyNode, const char *value,
+                        uint64_t expires_at, uint64_t commit) {
+  ValueVersion *version = new_version(ht, value, expires_at, commit);
+  if (version == NULL) {
+    return 1;
+  }
+  ValueVersion *older = atomic_load(&keyNode->versions);
+  atomic_store(&version->older, older);
+  atomic_store(&keyNode->versions, version);
+  trim_versions(ht, older);
+  return 0;
+}
+
+static void unlink_pair(HashTable *ht, _Atomic(KeyNode *) *link, uint64_t h);
+
+int write_pair(HashTable *ht, const char *key, const char *value,
+               uint64_t expires_at, uint64_t commit) {
+  uint64_t h = hash(key);
+  rehash_step(ht, stripe_index(h));
+
+  // Search for the key node
+  _Atomic(KeyNode *) *link = find_link(ht, key, h);
+  if (link != NULL && pair_expired(atomic_load(link))) {
+    //o par antigo expirou e ainda nao tinha sido apagado: apaga-o (os
+    //subscritores recebem DELETED) e a escrita cria um par novo
+    unlink_pair(ht, link, h);
+    link = NULL;
+  }
+  if (link != NULL) {
+    // overwrite value (uma escrita sem TTL tira o TTL que o par tinha); os
+    // snapshots anteriores continuam a ler a versao antiga
+    KeyNode *keyNode = atomic_load(link);
+    bool deleted = atomic_load(&keyNode->versions)->deleted;
+    if (push_version(ht, keyNode, value, expires_at, commit) != 0) {
+      return 1;
+    }
+    atomic_store_explicit(&keyNode->referenced, 1, memory_order_relaxed);
+    if (deleted) {
+      //o par tinha um tombstone a espera de sair: volta a existir (e ja
+      //nao tem subscritores)
+      atomic_fetch_add(&ht->count, 1);
+      return 0;
+    }
+    return notificarSubs(keyNode, value);
+  }
+  // Key not found, create a new key node; chave, valor e hash ficam todos no
+  // mesmo bloco
+  BucketArray *table = atomic_load(&ht->table);
+  _Atomic(KeyNode *) *bucket = &table->buckets[h & (table->size - 1)];
+  KeyNode *keyNode = kvs_aligned_alloc(_Alignof(KeyNode), sizeof(KeyNode));
+  if (keyNode == NULL) {
+    return 1;
+  }
+  memset(keyNode, 0, sizeof(KeyNode)); //a chave fica com padding a zeros
+  keyNode->hash = h;
+  keyNode->key_len = (uint8_t)strnlen(key, KEY_SLOT_SIZE - 1);
+  memcpy(keyNode->key, key, keyNode->key_len);
+  atomic_init(&keyNode->referenced, 1);
+  atomic_init(&keyNode->refs, 1);
+  ValueVersion *version = new_version(ht, value, expires_at, commit);
+  if (version == NULL) {
+    kvs_free(keyNode);
+    return 1;
+  }
+  atomic_init(&keyNode->versions, version);
+  atomic_init(&keyNode->next, atomic_load(bucket)); // Link to existing nodes
+  keyNode->subscribers = NULL; //ainda sem subscritores
+  if (index_insert(ht, keyNode) != 0) {
+    atomic_fetch_sub(&ht->mem_used, sizeof(ValueVersion));
+    pool_free(&versions_pool, version);
+    kvs_free(keyNode);
+    return 1;
+  }
+  if (ht->bloom != NULL) {
+    //antes de o par ficar visivel, para o filtro nunca o dar como ausente
+    bloom_add(ht->bloom, h);
+  }
+  // Place new key node at the start of the list; so fica visivel aos
+  // leitores depois de estar todo preenchido
+  atomic_store(bucket, keyNode);
+  atomic_fetch_add(&ht->count, 1);
+  atomic_fetch_add(&ht->mem_used, pair_memory(ht));
+  return 0;
+}
+
+int read_pair(HashTable *ht, const char *key, char *buffer, size_t size,
+              uint64_t snapshot) {
+  uint64_t h = hash(key);
+  if (ht->bloom != NULL && !bloom_maybe_contains(ht->bloom, h)) {
+    return 1; //nao e preciso percorrer o bucket
+  }
+  int result = 1;
+  epoch_enter();
+  KeyNode *keyNode = find_node(ht, key, h);
+  if (keyNode != NULL) {
+    //um par expirado que a roda ainda nao apagou conta como inexistente; as
+    //versoes nunca mudam depois de publicadas, por isso a copia e direta
+    const ValueVersion *version = pair_version(keyNode, snapshot);
+    if (version != NULL) {
+      size_t len = version->value_len < size - 1 ? version->value_len : size - 1;
+      memcpy(buffer, version->value, len);
+      buffer[len] = '\0';
+      result = 0;
+      //so escreve no par se o bit estiver a 0, para os leitores de uma chave
+      //muito lida nao andarem a disputar a linha de cache
+      if (!atomic_load_explicit(&keyNode->referenced, memory_order_relaxed)) {
+        atomic_store_explicit(&keyNode->referenced, 1, memory_order_relaxed);
       }
-      sub_atual = sub_atual ->next;
     }
+  } else if (ht->bloom != NULL) {
+    bloom_false_positive(ht->bloom, h);
+  }
+  epoch_exit();
+  return result;
+}
+
+uint64_t pair_commit(HashTable *ht, const char *key, uint64_t snapshot) {
+  uint64_t commit = 0;
+  epoch_enter();
+  KeyNode *keyNode = find_node(ht, key, hash(key));
+  if (keyNode != NULL) {
+    //pares apagados ou expirados dao 0, como os que nao existem
+    const ValueVersion *version = pair_version(keyNode, snapshot);
+    if (version != NULL) {
+      commit = version->commit;
+    }
+  }
+  epoch_exit();
+  return commit;
+}
+
+//liberta um par (chave e valor incluidos) e os seus subscritores
+static void free_keynode(void *arg) {
+  KeyNode *keyNode = arg;
+  kvs_free(keyNode->subscribers);
+  free_versions(atomic_load(&keyNode->versions));
+  kvs_free(keyNode);
+}
+
+bool pair_has_subscribers(HashTable *ht, const char *key) {
+  KeyNode *keyNode = find_node(ht, key, hash(key));
+  return keyNode != NULL && keyNode->subscribers != NULL;
+}
+
+//larga uma referencia ao par; a ultima (a tabela ou o reclaimer, o que
+//acabar depois) liberta-o por epocas
+static void release_keynode(KeyNode *keyNode) {
+  if (atomic_fetch_sub(&keyNode->refs, 1) == 1) {
+    epoch_retire(keyNode, free_keynode);
   }
-  return;
 }
 
-int delete_pair(HashTable *ht, const char *key) {
-  int index = hash(key);
+//notifica os subscritores tirados a um par e tira o par as subscricoes de
+//cada um (sem nenhuma stripe bloqueada)
+static void notify_deleted(KeyNode *par, SubscriberSet *subs) {
+  //sem memoria para a mensagem as subscricoes sao tiradas na mesma
+  NotifyFrame *frame = notify_frame(par->key, NULL);
+  for (size_t i = 0; i < subs->count; i++) {
+    Cliente *cliente = subs->members[i];
+    pthread_mutex_lock(&cliente->lock);
+    if (frame != NULL) {
+      notify_push(&cliente->notif, frame);
+    }
+    //o conjunto guarda a propria subscricao, por isso mesmo que o cliente
+    //tenha voltado a subscrever o par (se foi reescrito) sai a certa
+    unlink_subscription(cliente, subs->edges[i]);
+    //depois de largar o lock o cliente ja nao tem a subscricao, por isso o
+    //disconnect (que espera por isso) pode liberta-lo
+    pthread_mutex_unlock(&cliente->lock);
+    pool_free(&subscriptions_pool, subs->edges[i]);
+  }
+  kvs_free(subs);
+  if (frame != NULL) {
+    notify_frame_release(frame);
+  }
+}
+
+static void run_deferred_delete(ReclaimJob *job) {
+  DeferredDelete *deferred = (DeferredDelete *)job;
+  notify_deleted(deferred->par, deferred->subs);
+  release_keynode(deferred->par);
+  pool_free(&deferred_pool, deferred);
+}
+
+//tira os subscritores ao par apagado (o chamador tem a stripe para escrita)
+//e deixa o resto para o reclaimer; o par fica sem subscritores ja, por isso
+//se for reescrito so quem o subscrever outra vez e notificado
+static void detach_subscribers(KeyNode *keyNode) {
+  SubscriberSet *subs = keyNode->subscribers;
+  if (subs == NULL) {
+    return;
+  }
+  keyNode->subscribers = NULL;
+  DeferredDelete *deferred = pool_alloc(&deferred_pool);
+  if (deferred != NULL) {
+    deferred->job.run = run_deferred_delete;
+    deferred->par = keyNode;
+    deferred->subs = subs;
+    atomic_fetch_add(&keyNode->refs, 1);
+    if (reclaim_push(&deferred->job) == 0) {
+      return;
+    }
+    atomic_fetch_sub(&keyNode->refs, 1);
+    pool_free(&deferred_pool, deferred);
+  }
+  //sem memoria ou sem reclaimer faz tudo ja, com a stripe bloqueada
+  notify_deleted(keyNode, subs);
+}
+
+//guarda um delete para o par sair da tabela em table_collect, no fim do anel
+static void add_tombstone(HashTable *ht, const char *key, uint64_t commit) {
+  pthread_mutex_lock(&ht->tombstones_lock);
+  if (ht->num_tombstones == ht->tombstones_capacity) {
+    size_t old_capacity = ht->tombstones_capacity;
+    size_t capacity = old_capacity == 0 ? 16 : old_capacity * 2;
+    Tombstone *tombstones =
+        kvs_realloc(ht->tombstones, capacity * sizeof(Tombstone));
+    if (tombstones == NULL) {
+      //o par fica na tabela ate ser reescrito ou expulso
+      pthread_mutex_unlock(&ht->tombstones_lock);
+      write_str(STDERR_FILENO, "Failed to record deleted pair\n");
+      return;
+    }
+    //o anel estava cheio: a parte que dava a volta passa para depois do fim
+    //antigo, para os tombstones continuarem seguidos a partir da cabeca
+    memcpy(&tombstones[old_capacity], tombstones,
+           ht->tombstones_head * sizeof(Tombstone));
+    ht->tombstones = tombstones;
+    ht->tombstones_capacity = capacity;
+  }
+  size_t tail = (ht->tombstones_head + ht->num_tombstones++) %
+                ht->tombstones_capacity;
+  Tombstone *tombstone = &ht->tombstones[tail];
+  strncpy(tombstone->key, key, MAX_STRING_SIZE - 1);
+  tombstone->key[MAX_STRING_SIZE - 1] = '\0';
+  tombstone->commit = commit;
+  pthread_mutex_unlock(&ht->tombstones_lock);
+}
+
+int delete_pair(HashTable *ht, const char *key, uint64_t commit) {
+  uint64_t h = hash(key);
+  rehash_step(ht, stripe_index(h));
+
+  //o filtro responde a maior parte das chaves que nao existem sem
+  //percorrer o bucket
+  if (ht->bloom != NULL && !bloom_maybe_contains(ht->bloom, h)) {
+    return 1;
+  }
+
   // Search for the key node
-  KeyNode *keyNode = ht->table[index];
-  KeyNode *prevNode = NULL;
+  _Atomic(KeyNode *) *link = find_link(ht, key, h);
+  if (link == NULL) {
+    if (ht->bloom != NULL) {
+      bloom_false_positive(ht->bloom, h);
+    }
+    return 1;
+  }
+  KeyNode *keyNode = atomic_load(link);
+  if (pair_expired(keyNode)) {
+    //um par expirado e apagado na mesma, mas para quem o apaga ja nao existia
+    unlink_pair(ht, link, h);
+    return 1;
+  }
+  if (atomic_load(&keyNode->versions)->deleted) {
+    return 1; //ja foi apagado, so ainda nao saiu da tabela
+  }
+  //o par fica com um tombstone enquanto houver snapshots que o possam ler;
+  //para os subscritores e para a contagem ja foi apagado
+  if (push_version(ht, keyNode, NULL, 0, commit) != 0) {
+    unlink_pair(ht, link, h); //sem memoria para o tombstone, sai ja
+    return 0;
+  }
+  detach_subscribers(keyNode); //o reclaimer notifica-os
+  atomic_fetch_sub(&ht->count, 1);
+  add_tombstone(ht, key, commit);
+  return 0;
+}
 
-  while (keyNode != NULL) {
-    if (strcmp(keyNode->key, key) == 0) {
-      notificarSubs(keyNode, "DELETED"); //notifica todos os subs
-      deleteSub(keyNode); //tira este par a todos os seus subscritores
-      // Key found; delete this node
-      if (prevNode == NULL) {
-        // Node to delete is the first node in the list
-        ht->table[index] =
-            keyNode->next; // Update the table to point to the next node
-      } else {
-        // Node to delete is not the first; bypass it
-        prevNode->next =
-            keyNode->next; // Link the previous node to the next node
-      }
-      // Free the memory allocated for the key and value
-      free(keyNode->key);
-      free(keyNode->value);
-      free(keyNode); // Free the key node itself
-      return 0;      // Exit the function
+void table_collect(HashTable *ht) {
+  uint64_t horizon = snapshot_oldest(&ht->clock->visible_commit);
+  Tombstone batch[TOMBSTONE_BATCH];
+  size_t n = 0;
+  pthread_mutex_lock(&ht->tombstones_lock);
+  //os deletes entram (quase) pela ordem dos commits, por isso basta tirar
+  //o prefixo que ja esta abaixo do horizonte; um que tenha entrado fora de
+  //ordem so atrasa os seguintes ate a proxima recolha
+  while (ht->num_tombstones > 0 && n < TOMBSTONE_BATCH) {
+    Tombstone *oldest = &ht->tombstones[ht->tombstones_head];
+    if (oldest->commit > horizon) {
+      break;
+    }
+    batch[n++] = *oldest;
+    ht->tombstones_head = (ht->tombstones_head + 1) % ht->tombstones_capacity;
+    ht->num_tombstones--;
+  }
+  pthread_mutex_unlock(&ht->tombstones_lock);
+  if (n == 0) {
+    return;
+  }
+  uint64_t stripes = 0;
+  for (size_t i = 0; i < n; i++) {
+    stripes |= stripe_bit(batch[i].key);
+  }
+  lock_stripes(ht, stripes, true);
+  for (size_t i = 0; i < n; i++) {
+    uint64_t h = hash(batch[i].key);
+    _Atomic(KeyNode *) *link = find_link(ht, batch[i].key, h);
+    if (link == NULL) {
+      continue; //expirou ou foi expulso entretanto
+    }
+    //o par pode ter sido reescrito (e ate apagado outra vez) depois
+    ValueVersion *head = atomic_load(&atomic_load(link)->versions);
+    if (head->deleted && head->commit <= horizon) {
+      unlink_pair(ht, link, h);
     }
-    prevNode = keyNode;      // Move prevNode to current node
-    keyNode = keyNode->next; // Move to the next node
   }
+  unlock_stripes(ht, stripes);
+}
 
-  return 1;
+int expire_pair(HashTable *ht, const char *key) {
+  uint64_t h = hash(key);
+  rehash_step(ht, stripe_index(h));
+  _Atomic(KeyNode *) *link = find_link(ht, key, h);
+  //a chave pode ter sido apagada ou reescrita com outro prazo entretanto
+  if (link == NULL || !pair_expired(atomic_load(link))) {
+    return 1;
+  }
+  unlink_pair(ht, link, h);
+  return 0;
 }
 
-void free_table(HashTable *ht) {
-  for (int i = 0; i < TABLE_SIZE; i++) {
-    KeyNode *keyNode = ht->table[i];
+//tira da tabela o par apontado por link; os subscritores sao notificados
+//pelo reclaimer
+static void unlink_pair(HashTable *ht, _Atomic(KeyNode *) *link, uint64_t h) {
+  KeyNode *keyNode = atomic_load(link);
+  ValueVersion *versions = atomic_load(&keyNode->versions);
+  if (!versions->deleted) {
+    //um par com tombstone ja foi notificado e descontado no delete
+    detach_subscribers(keyNode);
+    atomic_fetch_sub(&ht->count, 1);
+  }
+  // bypass the node in its bucket list; o next do par fica igual para os
+  // leitores sem locks que ainda estejam nele
+  atomic_store(link, atomic_load(&keyNode->next));
+  atomic_fetch_sub(&ht->mem_used,
+                   pair_memory(ht) +
+                       count_versions(versions) * sizeof(ValueVersion));
+  index_remove(ht, keyNode->key);
+  if (ht->bloom != NULL) {
+    bloom_remove(ht->bloom, h);
+  }
+  release_keynode(keyNode); //a referencia da tabela
+}
+
+//passagem do CLOCK por um bucket: os pares usados ficam com o bit a 0 e os
+//que ja o tinham a 0 sao expulsos (o chamador tem a stripe para escrita)
+//retorna o num de pares expulsos
+static size_t evict_bucket(HashTable *ht, _Atomic(KeyNode *) *link,
+                           size_t max_evictions) {
+  size_t evicted = 0;
+  KeyNode *keyNode;
+  while (evicted < max_evictions && (keyNode = atomic_load(link)) != NULL) {
+    if (atomic_load_explicit(&keyNode->referenced, memory_order_relaxed)) {
+      atomic_store_explicit(&keyNode->referenced, 0, memory_order_relaxed);
+      link = &keyNode->next;
+    } else {
+      unlink_pair(ht, link, keyNode->hash); //link passa a apontar o seguinte
+      evicted++;
+    }
+  }
+  return evicted;
+}
+
+void table_evict(HashTable *ht, size_t max_evictions) {
+  if (ht->mem_budget == 0) {
+    return;
+  }
+  size_t evicted = 0;
+  //cada chamada visita poucos buckets, o custo fica dividido pelas escritas
+  for (size_t visits = 0;
+       visits < max_evictions * EVICT_VISITS && evicted < max_evictions &&
+       atomic_load(&ht->mem_used) > ht->mem_budget;
+       visits++) {
+    //varias threads podem expulsar ao mesmo tempo, cada uma no seu bucket
+    size_t hand = atomic_fetch_add(&ht->clock_hand, 1);
+    //o bucket hand da tabela atual e o da antiga sao da mesma stripe
+    uint64_t stripe = 1ULL << (hand & (NUM_STRIPES - 1));
+    lock_stripes(ht, stripe, true);
+    BucketArray *table = atomic_load(&ht->table);
+    BucketArray *old = atomic_load(&ht->old_table);
+    size_t n = evict_bucket(ht, &table->buckets[hand & (table->size - 1)],
+                            max_evictions - evicted);
+    if (old != NULL && n < max_evictions - evicted) {
+      n += evict_bucket(ht, &old->buckets[hand & (old->size - 1)],
+                        max_evictions - evicted - n);
+    }
+    unlock_stripes(ht, stripe);
+    evicted += n;
+  }
+  atomic_fetch_add(&ht->evictions, evicted);
+}
+
+//liberta todos os pares de um array de buckets
+static void free_buckets(BucketArray *buckets) {
+  for (size_t i = 0; i < buckets->size; i++) {
+    KeyNode *keyNode = atomic_load(&buckets->buckets[i]);
     while (keyNode != NULL) {
       KeyNode *temp = keyNode;
-      keyNode = keyNode->next;
-      free(temp->key);
-      free(temp->value);
-      free(temp->head_subscribers);
-      free(temp);
+      keyNode = atomic_load(&keyNode->next);
+      free_keynode(temp);
     }
   }
+  kvs_free(buckets);
+}
+
+void free_table(HashTable *ht) {
+  if (ht->bloom != NULL) {
+    bloom_destroy(ht->bloom);
+  }
+  skiplist_destroy(&ht->index);
+  if (ht->radix != NULL) {
+    radix_destroy(ht->radix);
+  }
+  free_buckets(atomic_load(&ht->table));
+  BucketArray *old = atomic_load(&ht->old_table);
+  if (old != NULL) {
+    free_buckets(old);
+  }
+  epoch_drain();
+  for (int i = 0; i < NUM_STRIPES; i++) {
+    pthread_rwlock_destroy(&ht->stripes[i].lock);
+  }
   pthread_rwlock_destroy(&ht->tablelock);
-  free(ht);
+  if (--num_tables == 0) {
+    pool_destroy(&subscriptions_pool);
+    pool_destroy(&versions_pool);
+    pool_destroy(&deferred_pool);
+  }
+  pthread_mutex_destroy(&ht->tombstones_lock);
+  kvs_free(ht->tombstones);
+  kvs_free(ht);
 }
 
-//retorna o keyNode a partir da key
-KeyNode *getKeyNode(HashTable *ht,char *key){
-  int index = hash(key);
+//chama func para todos os pares de um array de buckets que existem no snapshot
+static void foreach_in_buckets(BucketArray *buckets, uint64_t snapshot,
+                               void (*func)(KeyNode *, const ValueVersion *, void *),
+                               void *arg) {
+  for (size_t i = 0; i < buckets->size; i++) {
+    for (KeyNode *keyNode = atomic_load(&buckets->buckets[i]); keyNode != NULL;
+         keyNode = atomic_load(&keyNode->next)) {
+      const ValueVersion *version = pair_version(keyNode, snapshot);
+      if (version != NULL) {
+        func(keyNode, version, arg);
+      }
+    }
+  }
+}
 
-  KeyNode *keyNode = ht->table[index];
-  KeyNode *previousNode;
+void scan_pairs(HashTable *ht, const char *from, uint64_t snapshot,
+                bool (*func)(const char *, const char *, void *), void *arg) {
+  epoch_enter();
+  if (ht->radix != NULL) {
+    //a arvore nao tem lista das folhas: o cursor guarda o caminho desde a
+    //raiz e cada par seguinte e procurado a partir do no do anterior
+    RadixCursor cursor;
+    for (KeyNode *par = radix_cursor_seek(&cursor, ht->radix, from);
+         par != NULL; par = radix_cursor_next(&cursor)) {
+      const ValueVersion *version = pair_version(par, snapshot);
+      if (version != NULL && !func(par->key, version->value, arg)) {
+        break;
+      }
+    }
+    epoch_exit();
+    return;
+  }
+  for (SkipNode *node = skiplist_lower_bound(&ht->index, from); node != NULL;
+       node = atomic_load(&node->next[0])) {
+    const ValueVersion *version = pair_version(node->par, snapshot);
+    if (version == NULL) {
+      continue;
+    }
+    if (!func(node->par->key, version->value, arg)) {
+      break;
+    }
+  }
+  epoch_exit();
+}
 
-  while (keyNode != NULL) {
-    if (strcmp(keyNode->key, key) == 0) {
-      return keyNode; // Return the keynode if found
+//chama func para todos os pares, tanto da tabela atual como da antiga
+void foreach_pair(HashTable *ht, uint64_t snapshot,
+                  void (*func)(KeyNode *, const ValueVersion *, void *),
+                  void *arg) {
+  //a tabela atual e lida antes da antiga, como em find_node; se a troca
+  //acontecer entre as duas leituras as duas sao a mesma
+  BucketArray *table = atomic_load(&ht->table);
+  BucketArray *old = atomic_load(&ht->old_table);
+  if (old != NULL && old != table) {
+    //os buckets ja migrados estao vazios
+    foreach_in_buckets(old, snapshot, func, arg);
+  }
+  foreach_in_buckets(table, snapshot, func, arg);
+}
+
+//inverte a ordem dos bits de v
+static uint64_t reverse_bits(uint64_t v) {
+  v = ((v >> 1) & 0x5555555555555555ULL) | ((v & 0x5555555555555555ULL) << 1);
+  v = ((v >> 2) & 0x3333333333333333ULL) | ((v & 0x3333333333333333ULL) << 2);
+  v = ((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((v & 0x0F0F0F0F0F0F0F0FULL) << 4);
+  v = ((v >> 8) & 0x00FF00FF00FF00FFULL) | ((v & 0x00FF00FF00FF00FFULL) << 8);
+  v = ((v >> 16) & 0x0000FFFF0000FFFFULL) | ((v & 0x0000FFFF0000FFFFULL) << 16);
+  return (v >> 32) | (v << 32);
+}
+
+//soma 1 aos bits do cursor cobertos pela mascara, a comecar pelo mais alto
+static uint64_t next_cursor(uint64_t cursor, uint64_t mask) {
+  cursor |= ~mask;
+  return reverse_bits(reverse_bits(cursor) + 1);
+}
+
+//chama func para todos os pares de um bucket; retorna quantos eram
+static size_t scan_bucket(_Atomic(KeyNode *) *bucket,
+                          void (*func)(KeyNode *, const ValueVersion *, void *),
+                          void *arg) {
+  size_t n = 0;
+  for (KeyNode *keyNode = atomic_load(bucket); keyNode != NULL;
+       keyNode = atomic_load(&keyNode->next)) {
+    const ValueVersion *version = pair_version(keyNode, SNAPSHOT_LATEST);
+    if (version != NULL) {
+      func(keyNode, version, arg);
+      n++;
     }
-    previousNode = keyNode;
-    keyNode = previousNode->next; // Move to the next node
   }
+  return n;
+}
 
-  return NULL; // Key not found
+uint64_t scan_table(HashTable *ht, uint64_t cursor, size_t count,
+                    void (*func)(KeyNode *, const ValueVersion *, void *),
+                    void *arg) {
+  size_t found = 0;
+  //numa tabela quase vazia a pagina tambem acaba ao fim de alguns buckets
+  size_t empty_visits = count * 10;
+  do {
+    //os tamanhos das tabelas sao multiplos de NUM_STRIPES, por isso todos os
+    //buckets visitados neste passo (os bits baixos do cursor nao mudam ate
+    //ao fim dele) pertencem a mesma stripe
+    uint64_t stripe = 1ULL << (cursor & (NUM_STRIPES - 1));
+    lock_stripes(ht, stripe, false);
+    BucketArray *small = atomic_load(&ht->old_table);
+    BucketArray *big = atomic_load(&ht->table);
+    if (small == NULL) {
+      small = big;
+      big = NULL;
+    }
+    uint64_t small_mask = small->size - 1;
+    size_t n = scan_bucket(&small->buckets[cursor & small_mask], func, arg);
+    if (big == NULL) {
+      cursor = next_cursor(cursor, small_mask);
+    } else {
+      //durante o rehash visita tambem todos os buckets da tabela nova para
+      //onde o bucket da antiga se espalha
+      uint64_t big_mask = big->size - 1;
+      do {
+        n += scan_bucket(&big->buckets[cursor & big_mask], func, arg);
+        cursor = next_cursor(cursor, big_mask);
+      } while (cursor & (small_mask ^ big_mask));
+    }
+    unlock_stripes(ht, stripe);
+    found += n;
+    if (n == 0 && --empty_visits == 0) {
+      break;
+    }
+  } while (cursor != 0 && found < count);
+  return cursor;
+}
+
+//retorna o keyNode a partir da key
+KeyNode *getKeyNode(HashTable *ht,char *key){
+  KeyNode *keyNode = find_node(ht, key, hash(key));
+  if (keyNode != NULL && pair_version(keyNode, SNAPSHOT_LATEST) == NULL) {
+    return NULL; //expirou ou tem um tombstone, so ainda nao saiu da tabela
+  }
+  return keyNode;
 }
 
 //verifica se algum cliente ja esta subscrito ao par, para nao haver repetidos na tabela
 bool alreadySubbed(KeyNode *par, Cliente *cliente){
-  Subscribers *subAtual = par->head_subscribers;
-  while (subAtual!=NULL){
-    Cliente *clienteAtual = subAtual->subscriber;
-    if(clienteAtual->id == cliente->id){
-      //ja estava inscrito
-      return true;
-    }
-    //nao encontramos o cliente ainda, passa para o proximo sub
-    subAtual = subAtual -> next;
-  }
-  return false;
+  SubscriberSet *set = par->subscribers;
+  return set != NULL && set->index[subscriber_slot(set, cliente->id)].pos != 0;
 }
 
 //adiciona subscricao à estrutura cliente
 //0 se certo, 1 se errado
 int addSubscription(HashTable *ht,Cliente *cliente, char *key){
-  if(cliente->num_subscricoes>=MAX_NUMBER_SUB){
-    return 1;
-  }
-  Subscriptions *subsCliente = cliente->head_subscricoes;
-  Subscriptions *newSub = malloc(sizeof(Subscriptions));
+  pthread_mutex_lock(&cliente->lock);
+  Subscriptions *newSub = pool_alloc(&subscriptions_pool);
   KeyNode *par = getKeyNode(ht,key);
   if(newSub!=NULL && par!=NULL){
-    if(addSubscriberTable(cliente, par)==0){
-      newSub->next = subsCliente; //mete a nova Sub no inicio da lista
-      newSub->par = par; //guarda o keynode na sub
-      cliente->head_subscricoes = newSub; //guarda a novaSub como cabeca da lista
-      cliente->num_subscricoes++;
+    if(alreadySubbed(par, cliente)){
+      //ja era inscrito, nao repete a subscricao no cliente
+      pthread_mutex_unlock(&cliente->lock);
+      pool_free(&subscriptions_pool, newSub);
+      return 0;
+    }
+    newSub->par = par; //guarda o keynode na sub
+    newSub->cliente = cliente;
+    //a fila do cliente fica ja com lugar para as notificacoes desta chave
+    if(notify_reserve(&cliente->notif, (size_t)cliente->num_subscricoes + 1)==0 &&
+       addSubscriberTable(newSub)==0){
+      link_subscription(cliente, newSub); //mete a nova Sub no inicio da lista
+      pthread_mutex_unlock(&cliente->lock);
       return 0;
     }
-    return 1;
   }
+  pthread_mutex_unlock(&cliente->lock);
+  pool_free(&subscriptions_pool, newSub);
   return 1;
 }
 
 //adiciona subscritor à estrutura keynode
 //0 se certo, 1 se errado
-int addSubscriberTable(Cliente *cliente, KeyNode *par){
-  Subscribers *subsPar = par->head_subscribers;
-  Subscribers *newSub = malloc(sizeof(Subscribers));
-  if(newSub!=NULL){
-    if(!alreadySubbed(par, cliente)){
-      newSub->subscriber = cliente; //guarda o novo sub
-      newSub->next = subsPar; //mete o novo sub no inicio da lista e faz o link
-      par->head_subscribers = newSub; //guarda o novo Sub como cabeca da lista
-      return 0;
-    }else{
-      //ja era inscrito
-      return 0;
-    }
-  }
-  return 1;
+int addSubscriberTable(Subscriptions *sub){
+  //se ja era inscrito nao faz nada
+  return subscriber_set_add(sub->par, sub);
 }
 
 
 //remove subscricao da estrutura cliente
 //0 se certo, 1 se errado
-int removeSubscription(Cliente *cliente, char *key){
-  Subscriptions *subscricao_atual = cliente->head_subscricoes;
-  Subscriptions *subscricao_prev = NULL;
-
-  //percorre a lista das subscricoes até encontrar a que queremos
-  while(subscricao_atual!=NULL){
-    //verifica se é a que queremos
-    KeyNode *par_atual = subscricao_atual->par;
-    if(strcmp(par_atual->key,key)==0){
-      //encontramos a que queremos
-      if (removeSubscriberTable(par_atual, cliente)==0){
-        //retira a ligacao
-        Subscriptions *subscricao_prox = subscricao_atual->next;
-
-        if(subscricao_prev!=NULL){
-          subscricao_prev->next = subscricao_prox;
-        }else{
-          cliente->head_subscricoes=subscricao_prox;
-        }
-        free(subscricao_atual);
-        cliente->num_subscricoes--;
-        return 0;
-      }
-      return 1;
-    }else{
-      //ainda nao encontrou
-      subscricao_prev=subscricao_atual;
-      subscricao_atual=subscricao_atual->next;
-    }
-    
+int removeSubscription(HashTable *ht, Cliente *cliente, char *key){
+  //o par pode ja ter expirado, mas enquanto esta na tabela tem os subscritores
+  KeyNode *par = find_node(ht, key, hash(key));
+  if (par == NULL) {
+    return 1;
   }
-  return 1;
+  pthread_mutex_lock(&cliente->lock);
+  //a subscricao esta no conjunto do par, por isso nao e preciso procura-la
+  //na lista do cliente
+  Subscriptions *subscricao = find_subscription(par, cliente);
+  if (subscricao == NULL || removeSubscriberTable(par, cliente) != 0) {
+    //nao estava subscrito (ou o par foi apagado e o reclaimer tira-a)
+    pthread_mutex_unlock(&cliente->lock);
+    return 1;
+  }
+  unlink_subscription(cliente, subscricao);
+  pthread_mutex_unlock(&cliente->lock);
+  pool_free(&subscriptions_pool, subscricao);
+  return 0;
+}
+
+//remove a primeira subscricao do cliente, se ainda for a esperada
+//0 se certo (ou se ja tinha saido), 1 se o par foi apagado e quem a tira e o
+//reclaimer
+int removeFirstSubscription(Cliente *cliente, Subscriptions *expected){
+  pthread_mutex_lock(&cliente->lock);
+  Subscriptions *subscricao = cliente->head_subscricoes;
+  if (subscricao != expected) {
+    //o reclaimer ja a tirou
+    pthread_mutex_unlock(&cliente->lock);
+    return 0;
+  }
+  //enquanto esta na lista do cliente o par ainda nao foi libertado
+  KeyNode *par = subscricao->par;
+  if (find_subscription(par, cliente) != subscricao) {
+    pthread_mutex_unlock(&cliente->lock);
+    return 1;
+  }
+  removeSubscriberTable(par, cliente);
+  unlink_subscription(cliente, subscricao);
+  pthread_mutex_unlock(&cliente->lock);
+  pool_free(&subscriptions_pool, subscricao);
+  return 0;
 }
 
 //remove cliente dos followers na estrutura da chave 
 //0 se certo, 1 se errado
 int removeSubscriberTable(KeyNode *par, Cliente *cliente_desejado){
-  Subscribers *subscriber_atual = par->head_subscribers;
-  Subscribers *subscriber_prev = NULL;
-
-  //percorre a lista de todos os followers do par
-  while(subscriber_atual!=NULL){
-    Cliente *cliente_atual = subscriber_atual->subscriber;
-    //verifica se é o que queremos
-    if(cliente_atual->id == cliente_desejado->id){
-      //é o cliente que queremos
-      Subscribers *subscriber_prox = subscriber_atual->next;
-
-      if(subscriber_prev!=NULL){
-        //nao é o primeiro da lista
-        subscriber_prev->next = subscriber_prox;
-      }else{
-        //é o primeiro da lista
-        par->head_subscribers = subscriber_prox;
-      }
-      free(subscriber_atual);
-      return 0;
-    }else{
-      //ainda nao encontrou
-      subscriber_prev = subscriber_atual;
-      subscriber_atual = subscriber_atual->next;
-    }
-  }
-  //nao encontrou 
-  return 1;
+  return subscriber_set_remove(par, cliente_desejado->id);
 }
@@ -1,15 +1,39 @@
 #ifndef KVS_H
 #define KVS_H
 
-#define TABLE_SIZE 26
+#define TABLE_INITIAL_SIZE 64 // num inicial de buckets (potencia de 2)
+#define TABLE_MAX_LOAD 1       // num medio de pares por bucket antes de crescer
+#define REHASH_STEP 4          // buckets migrados por cada escrita durante o rehash
+#define NUM_STRIPES 64 // num de locks dos buckets (TABLE_INITIAL_SIZE e multiplo)
+#define STRIPE_READ_SPINS 1000 // espera de um leitor sem locks por uma migracao
+#define KEY_SLOT_SIZE 48 // espaco da chave no par (MAX_STRING_SIZE + '\0' em blocos de 16)
+#define EVICT_PER_WRITE 2 // pares que cada escrita pode expulsar acima do limite
+#define EVICT_VISITS 8 // buckets visitados por cada par a expulsar
+#define COMMIT_SPINS 100 // espera ativa por um commit anterior antes de sched_yield
+#define TOMBSTONE_BATCH 64 // tombstones tirados da tabela de cada vez
+#define SNAPSHOT_LATEST UINT64_MAX // le a versao mais recente (com a stripe bloqueada)
+#define SUBSCRIBERS_INITIAL 4 // tamanho inicial do conjunto de subscritores de um par
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-//estrutura para definir uma lista ligada das subscricoes de um cliente
+#include "src/common/constants.h"
+#include "skiplist.h"
+#include "radix.h"
+#include "bloom.h"
+#include "notify.h"
+
+//estrutura para definir uma subscricao (cliente <-> par)
+//e um so no, que esta na lista duplamente ligada das subscricoes do cliente
+//e no conjunto dos subscritores do par, por isso quem a encontra por um dos
+//lados tira-a dos dois sem percorrer listas
 typedef struct Subscriptions{
   struct KeyNode *par; //par associado a subscricao
+  struct Cliente *cliente; //cliente que subscreveu
+  struct Subscriptions *prev; //subscricao anterior do cliente
   struct Subscriptions *next; //proxima subscricao
 }Subscriptions;
 
@@ -17,77 +41,370 @@ typedef struct Subscriptions{
 typedef struct Cliente {
   int id; 
   char resp_pipe_path[40];
-  char notif_pipe_path[40];
   char req_pipe_path[40];
-  struct Subscriptions *head_subscricoes; //lista ligada das subscricoes do cliente
+  struct Subscriptions *head_subscricoes; //lista duplamente ligada das subscricoes do cliente
+  pthread_mutex_t lock; //protege as subscricoes
   int num_subscricoes; //numero de subscricoes do cliente
   int resp_pipe; //descritor para o response pipe
   int req_pipe; //descritor para o request pipe
-  int notif_pipe; //descritor para o notification pipe
+  NotifyQueue notif; //notificacoes por mandar e o notification pipe
   int flag_sigusr1; //flag para saber se houve um sigusr1
   int usado; //flag para saber se uma thread ja o esta a usar
 }Cliente;
 
-//estrutura para definir uma lista ligada dos subscritores de um par
-typedef struct Subscribers {
-  Cliente *subscriber; //cliente associado a subscricao
-  struct Subscribers *next; //proxima subscritor
-} Subscribers;
+//entrada do indice dos subscritores de um par
+typedef struct SubscriberSlot {
+  int id; //id do cliente
+  uint32_t pos; //posicao (+1) do cliente no array, 0 se a entrada esta vazia
+} SubscriberSlot;
+
+//conjunto dos clientes subscritos a um par
+//os clientes ficam seguidos num array, que e o que a notificacao percorre,
+//e um indice aberto pelo id do cliente (com o dobro das entradas) da a
+//posicao de cada um, por isso ver se um cliente ja esta, junta-lo ou tira-lo
+//nao depende do num de subscritores. ao lado de cada cliente fica a sua
+//subscricao, para a tirar tambem da lista do cliente. ocupa um so bloco, que
+//cresce e encolhe para o dobro ou metade
+typedef struct SubscriberSet {
+  size_t count; //num de subscritores
+  size_t capacity; //tamanho do array (potencia de 2)
+  Cliente **members; //os subscritores, seguidos (no mesmo bloco)
+  Subscriptions **edges; //subscricao de cada subscritor (no mesmo bloco)
+  SubscriberSlot *index; //indice com 2 * capacity entradas (no mesmo bloco)
+} SubscriberSet;
+
+//estrutura para definir uma versao do valor de um par (MVCC)
+//cada escrita ou delete poe uma versao nova a frente das antigas, com o num
+//do commit que a fez; um leitor le a primeira versao com commit <= ao seu
+//snapshot. as versoes nunca mudam depois de publicadas e as que ja nenhum
+//snapshot pode ler sao libertadas por epocas
+typedef struct ValueVersion {
+  uint64_t commit; //commit que escreveu esta versao
+  _Atomic(struct ValueVersion *) older; //versao anterior, NULL se nao ha
+  uint64_t expires_at; //instante (timer_now) em que expira, 0 se nao tem TTL
+  bool deleted; //tombstone: o par foi apagado neste commit
+  uint8_t value_len; //tamanho do valor
+  char value[MAX_STRING_SIZE + 1]; //valor
+} ValueVersion;
 
 //estrutura para definir um par da tabela
+//um par ocupa um so bloco de duas linhas de cache: a primeira tem tudo o
+//que e preciso para procurar (hash, next e chave), a segunda as versoes.
+//os leitores percorrem as listas sem locks, por isso o next e as versoes
+//sao trocados atomicamente e o que sai da tabela e libertado por epocas.
+//as subscricoes dos clientes tambem apontam para o par, por isso ele so e
+//libertado quando o reclaimer acabar de as tirar (refs)
 typedef struct KeyNode {
-  char *key; //chave
-  char *value; //valor
-  Subscribers *head_subscribers; //lista ligada de clientes subscritos a esta chave
-  struct KeyNode *next; //proximo par
+  _Alignas(64) uint64_t hash; //hash da chave, comparado antes da chave
+  _Atomic(struct KeyNode *) next; //proximo par
+  char key[KEY_SLOT_SIZE]; //chave, com padding a zeros
+  SubscriberSet *subscribers; //clientes subscritos a esta chave, NULL se nao ha
+  _Atomic(ValueVersion *) versions; //versao mais recente, nunca NULL
+  uint8_t key_len; //tamanho da chave
+  _Atomic(uint8_t) referenced; //bit do CLOCK: usado desde a ultima passagem
+  atomic_uint refs; //1 enquanto esta na tabela, mais 1 por trabalho do reclaimer
 } KeyNode;
 
+_Static_assert(sizeof(KeyNode) == 128, "o par tem de ocupar duas linhas de cache");
+
+//delete a espera de sair da tabela: o par fica com o tombstone enquanto
+//houver snapshots anteriores ao commit do delete
+typedef struct Tombstone {
+  char key[MAX_STRING_SIZE];
+  uint64_t commit; //commit do delete
+} Tombstone;
+
+/// @brief verifica se o par ja expirou (mesmo que ainda nao tenha sido
+/// apagado pela roda dos temporizadores)
+/// @param keyNode o par
+/// @return true se expirou
+bool pair_expired(const KeyNode *keyNode);
+
+/// @brief retorna a versao do par que um snapshot le (sem locks tem de ser
+/// chamada dentro de uma epoca)
+/// @param keyNode o par
+/// @param snapshot o snapshot (SNAPSHOT_LATEST com a stripe bloqueada)
+/// @return a versao, ou NULL se o par nao existia no snapshot, estava
+/// apagado ou ja expirou
+const ValueVersion *pair_version(const KeyNode *keyNode, uint64_t snapshot);
+
+//array de buckets de uma tabela
+typedef struct BucketArray {
+  size_t size; //num de buckets (potencia de 2)
+  _Atomic(KeyNode *) buckets[];
+} BucketArray;
+
+//estrutura para definir uma stripe: o bucket i (de qualquer das tabelas)
+//pertence a stripe i % NUM_STRIPES
+typedef struct Stripe {
+  _Alignas(64) pthread_rwlock_t lock; //lock dos escritores desta stripe
+  atomic_uint seq; //impar enquanto ha pares da stripe a ser migrados (para os leitores)
+  size_t rehash_pos; //proximo bucket desta stripe na tabela antiga a migrar
+} Stripe;
+
+//relogio dos commits (MVCC); varias tabelas podem partilhar o mesmo, para
+//um snapshot ler todas no mesmo instante
+typedef struct CommitClock {
+  atomic_uint_fast64_t next_commit; //ultimo commit reservado por uma escrita
+  atomic_uint_fast64_t visible_commit; //os commits ate este ja se podem ler
+  atomic_uint_fast64_t horizon; //snapshot mais antigo quando houve o ultimo commit
+} CommitClock;
+
 //estrutura para definir a hashtable
+//a tabela cresce em potencias de 2; durante o rehash os pares vao sendo
+//migrados aos poucos da old_table para a table em cada escrita na stripe
 typedef struct HashTable {
-  KeyNode *table[TABLE_SIZE];
+  _Atomic(BucketArray *) table; //buckets da tabela atual
+  _Atomic(BucketArray *) old_table; //buckets da tabela antiga, NULL se nao ha rehash
+  atomic_size_t count; //num de pares na tabela
+  atomic_int stripes_rehashed; //num de stripes que ja acabaram o rehash
+  Stripe stripes[NUM_STRIPES];
+  //partilhado por todas as operacoes, exclusivo so para trocar de tabela
   pthread_rwlock_t tablelock;
+  SkipList index; //chaves por ordem, para o SCAN e o PREFIX
+  RadixTree *radix; //indice em arvore radix no lugar do index, NULL se nao e usado
+  Bloom *bloom; //filtro das chaves que existem, NULL se nao e usado
+  size_t mem_budget; //limite de memoria da tabela (bytes), 0 se nao ha
+  atomic_size_t mem_used; //memoria usada pelos pares e pelos buckets
+  atomic_size_t clock_hand; //proximo bucket a visitar na expulsao
+  atomic_size_t evictions; //pares expulsos por falta de memoria
+  CommitClock *clock; //relogio dos commits: own_clock ou o de outra tabela
+  CommitClock own_clock;
+  atomic_size_t versions_freed; //versoes antigas libertadas
+  pthread_mutex_t tombstones_lock; //protege os tombstones
+  //deletes cujos pares ainda estao na tabela, num anel pela ordem dos
+  //commits: os que ja podem sair sao sempre um prefixo
+  Tombstone *tombstones;
+  size_t tombstones_head; //indice do mais antigo
+  size_t num_tombstones;
+  size_t tombstones_capacity;
 } HashTable;
 
-int hash(const char *key);
+/// Hash function for the keys (64-bit FNV-1a with a final avalanche mix, so
+/// that the low bits used to pick the bucket are well distributed).
+/// @param key The key.
+/// @return 64-bit hash of the key.
+uint64_t hash(const char *key);
 
 /// Creates a new KVS hash table.
 /// @return Newly created hash table, NULL on failure
 struct HashTable *create_hash_table();
 
+/// @brief passa a usar um filtro de Bloom para as procuras de chaves que nao
+/// existem; tem de ser chamada com a tabela ainda vazia
+/// @param ht a hashtable
+/// @param counters num de contadores do filtro (mais contadores, menos
+/// falsos positivos)
+/// @param hashes num de contadores por chave
+/// @return 0 se deu certo, 1 se deu errado
+int enable_bloom_filter(HashTable *ht, size_t counters, unsigned hashes);
+
+/// @brief passa a usar uma arvore radix no lugar da skiplist como indice
+/// ordenado (os pares continuam na tabela, com as chaves inteiras); tem de
+/// ser chamada com a tabela ainda vazia
+/// @param ht a hashtable
+/// @return 0 se deu certo, 1 se deu errado
+int enable_radix_index(HashTable *ht);
+
+/// @brief limita a memoria da tabela; acima do limite as escritas expulsam
+/// os pares menos usados (CLOCK)
+/// @param ht a hashtable
+/// @param bytes o limite, 0 para nao haver limite
+void set_memory_budget(HashTable *ht, size_t bytes);
+
+/// @brief se a tabela passou do limite de memoria, expulsa ate max_evictions
+/// pares que nao foram usados desde a ultima passagem do ponteiro do CLOCK,
+/// notificando os subscritores como no delete_pair; tem de ser chamada sem
+/// nenhuma stripe bloqueada, depois das escritas
+/// @param ht a hashtable
+/// @param max_evictions num max de pares expulsos nesta chamada
+void table_evict(HashTable *ht, size_t max_evictions);
+
+/// @brief passa a usar o relogio dos commits de outra tabela, para os
+/// snapshots lerem as duas de forma consistente; tem de ser chamada com a
+/// tabela ainda vazia
+/// @param ht a hashtable
+/// @param from a tabela cujo relogio passa a ser usado
+void share_commit_clock(HashTable *ht, HashTable *from);
+
+/// @brief reserva o num do proximo commit; tem de ser chamada com as stripes
+/// do lote bloqueadas para escrita, antes de write_pair ou delete_pair
+/// @param ht a hashtable
+/// @return o num do commit
+uint64_t commit_begin(HashTable *ht);
+
+/// @brief torna o commit visivel aos snapshots, depois de todos os
+/// anteriores (espera por eles); tem de ser chamada depois de libertar as
+/// stripes
+/// @param ht a hashtable
+/// @param commit o num retornado por commit_begin
+void commit_end(HashTable *ht, uint64_t commit);
+
+/// @brief tira da tabela os pares apagados que ja nenhum snapshot pode ler;
+/// tem de ser chamada sem nenhuma stripe bloqueada, depois dos deletes
+/// @param ht a hashtable
+void table_collect(HashTable *ht);
+
+/// @brief retorna a mascara com o bit da stripe da chave
+/// @param key a chave
+/// @return mascara para usar em lock_stripes
+uint64_t stripe_bit(const char *key);
+
+/// @brief bloqueia as stripes da mascara, por ordem crescente para que lotes
+/// com varias chaves nunca entrem em deadlock
+/// @param ht a hashtable
+/// @param stripes mascara das stripes (UINT64_MAX para a tabela toda)
+/// @param write true para escrita, false para leitura
+void lock_stripes(HashTable *ht, uint64_t stripes, bool write);
+
+/// @brief desbloqueia as stripes bloqueadas com lock_stripes
+/// @param ht a hashtable
+/// @param stripes a mesma mascara passada a lock_stripes
+void unlock_stripes(HashTable *ht, uint64_t stripes);
+
+/// @brief comeca uma leitura sem locks das stripes da mascara: guarda a
+/// sequencia de cada uma, esperando um pouco se tiverem pares a ser migrados
+/// @param ht a hashtable
+/// @param stripes mascara das stripes que vao ser lidas
+/// @param seqs array com NUM_STRIPES posicoes onde ficam as sequencias
+/// @return false se alguma stripe continua a ser migrada (o chamador deve
+/// usar lock_stripes)
+bool read_stripes_begin(HashTable *ht, uint64_t stripes, unsigned *seqs);
+
+/// @brief verifica uma leitura sem locks comecada com read_stripes_begin
+/// @param ht a hashtable
+/// @param stripes a mesma mascara passada a read_stripes_begin
+/// @param seqs as sequencias guardadas por read_stripes_begin
+/// @return true se nenhum par das stripes mudou de lista entretanto, ou seja,
+/// nenhuma procura falhou por causa do rehash (os valores sao os do snapshot
+/// do leitor, mesmo com escritas ao mesmo tempo)
+bool read_stripes_validate(HashTable *ht, uint64_t stripes,
+                           const unsigned *seqs);
+
+/// @brief comeca ou acaba um rehash se for preciso; tem de ser chamada sem
+/// nenhuma stripe bloqueada, depois das escritas
+/// @param ht a hashtable
+void table_maintenance(HashTable *ht);
+
 /// @brief notifica todos os subs do par para informar que houve alteracao
+/// (so poe a notificacao na fila de cada um, ver notify.h)
 /// @param keyNode par em que houve a alteracao
 /// @param newValue novo valor do par
 /// @return 1 se deu erro, 0 se deu certo
 int notificarSubs(KeyNode *keyNode,const char *newValue);
 
-// Writes a key value pair in the hash table.
+// Writes a key value pair in the hash table, as a new version of the pair.
+// The caller must hold the key's stripe for writing.
 // @param ht The hash table.
 // @param key The key.
 // @param value The value.
+// @param expires_at When the pair expires (see timer_deadline), 0 for never.
+// @param commit The commit of the batch (see commit_begin).
 // @return 0 if successful.
-int write_pair(HashTable *ht, const char *key, const char *value);
+int write_pair(HashTable *ht, const char *key, const char *value,
+               uint64_t expires_at, uint64_t commit);
 
-// Reads the value of a given key.
+// Reads the value of a given key as of a snapshot, without taking locks or
+// allocating memory.
+// A miss is only certain if the key's stripe is locked or its sequence is
+// validated afterwards (see read_stripes_begin).
 // @param ht The hash table.
 // @param key The key.
-// return the value if found, NULL otherwise.
-char *read_pair(HashTable *ht, const char *key);
+// @param buffer Buffer where the value is copied to.
+// @param size Size of the buffer (the value is truncated to fit).
+// @param snapshot The snapshot (see snapshot_begin).
+// @return 0 if the key was found, 1 otherwise.
+int read_pair(HashTable *ht, const char *key, char *buffer, size_t size,
+              uint64_t snapshot);
+
+/// @brief retorna o commit da versao de uma chave que um snapshot le;
+/// serve para validar uma transacao (se o commit nao mudou, ninguem
+/// escreveu a chave entretanto)
+/// @param ht a hashtable
+/// @param key a chave
+/// @param snapshot o snapshot (SNAPSHOT_LATEST com a stripe bloqueada)
+/// @return o commit, 0 se a chave nao existe no snapshot (um par apagado ou
+/// expirado tambem da 0)
+uint64_t pair_commit(HashTable *ht, const char *key, uint64_t snapshot);
 
-/// @brief apaga a subscricao de um par a todos os clientes que o tenham subscrito
-/// @param par par cuja subscricao vai ser apagada de todos os seus subscritores
-void deleteSub(KeyNode *par);
+/// @brief verifica se o par tem subscritores (o chamador tem a stripe da
+/// chave para escrita)
+/// @param ht a hashtable
+/// @param key a chave
+/// @return true se o par existe e tem subscritores
+bool pair_has_subscribers(HashTable *ht, const char *key);
 
-/// Deletes a pair from the table.
+/// Deletes a pair from the table. The pair gets a tombstone and only leaves
+/// the table once no snapshot can read its older versions (see
+/// table_collect).
+/// Its subscribers are detached from the pair under the lock; notifying them
+/// and removing the pair from each client's subscriptions is left to the
+/// reclaimer thread (see reclaim.h).
+/// The caller must hold the key's stripe for writing.
 /// @param ht Hash table to read from.
 /// @param key Key of the pair to be deleted.
+/// @param commit The commit of the batch (see commit_begin).
 /// @return 0 if the node was deleted successfully, 1 otherwise.
-int delete_pair(HashTable *ht, const char *key);
+int delete_pair(HashTable *ht, const char *key, uint64_t commit);
+
+/// @brief apaga o par se ja tiver expirado, notificando os subscritores como
+/// no delete_pair (o chamador tem a stripe da chave para escrita)
+/// @param ht a hashtable
+/// @param key a chave
+/// @return 0 se o par foi apagado, 1 se nao existe ou ainda nao expirou
+int expire_pair(HashTable *ht, const char *key);
+
+/// @brief retorna o num de blocos alocados e libertados pela tabela desde o
+/// inicio (pares, valores, subscricoes e arrays de buckets)
+/// @param allocs onde fica o num de alocacoes
+/// @param frees onde fica o num de libertacoes
+void get_alloc_stats(size_t *allocs, size_t *frees);
+
+/// @brief percorre os pares por ordem de chave a partir da primeira chave
+/// >= from, sem locks, com os valores de um snapshot
+/// @param ht a hashtable
+/// @param from a chave inicial
+/// @param snapshot o snapshot (ver snapshot_begin)
+/// @param func chamada com a chave e o valor de cada par; retorna false
+/// para parar
+/// @param arg argumento passado a func
+void scan_pairs(HashTable *ht, const char *from, uint64_t snapshot,
+                bool (*func)(const char *, const char *, void *), void *arg);
+
+/// @brief chama func para todos os pares da tabela, incluindo os que ainda
+/// estao na tabela antiga durante o rehash; sem locks tem de ser chamada
+/// dentro de uma epoca e validada pelas sequencias das stripes
+/// @param ht a hashtable
+/// @param snapshot o snapshot (SNAPSHOT_LATEST com as stripes bloqueadas)
+/// @param func funcao chamada com cada par e a versao que o snapshot le
+/// @param arg argumento passado a func
+void foreach_pair(HashTable *ht, uint64_t snapshot,
+                  void (*func)(KeyNode *, const ValueVersion *, void *),
+                  void *arg);
+
+/// @brief percorre uma pagina da tabela a partir de um cursor, bloqueando
+/// so a stripe de cada bucket enquanto o visita. O cursor avanca pelos bits
+/// invertidos do indice, por isso continua valido se a tabela crescer entre
+/// paginas: todos os pares que existam durante a iteracao toda sao vistos
+/// (alguns podem ser vistos mais do que uma vez)
+/// @param ht a hashtable
+/// @param cursor 0 para comecar, depois o valor retornado pela pagina anterior
+/// @param count num de pares a partir do qual a pagina acaba (pode ter mais,
+/// pois os buckets sao visitados inteiros)
+/// @param func funcao chamada com cada par e a sua versao mais recente, com
+/// a stripe bloqueada
+/// @param arg argumento passado a func
+/// @return o cursor da proxima pagina, 0 se a iteracao acabou
+uint64_t scan_table(HashTable *ht, uint64_t cursor, size_t count,
+                    void (*func)(KeyNode *, const ValueVersion *, void *),
+                    void *arg);
 
 /// Frees the hashtable.
 /// @param ht Hash table to be deleted.
 void free_table(HashTable *ht);
 
-/// @brief retorna o keyNode a partir da key
+/// @brief retorna o keyNode a partir da key (o chamador tem a stripe da
+/// chave ou esta dentro de uma epoca)
 /// @param ht a hashtable
 /// @param key a chave do par
 /// @return o par correspondente à chave
@@ -107,16 +424,27 @@ bool alreadySubbed(KeyNode *par, Cliente *cliente);
 int addSubscription(HashTable *ht,Cliente* cliente, char *key);
 
 /// @brief adiciona subscritor à estrutura keynode
-/// @param cliente cliente que é o subscritor
-/// @param par keynode que vai ter o novo cliente como subscritor
+/// @param sub a subscricao, com o cliente que é o subscritor e o keynode
+/// que o vai ter como subscritor
 /// @return 0 se deu certo, 1 se deu errado
-int addSubscriberTable(Cliente *cliente, KeyNode *par);
+int addSubscriberTable(Subscriptions *sub);
 
-/// @brief remove subscricao da estrutura cliente
+/// @brief remove subscricao da estrutura cliente (o chamador tem a stripe
+/// da chave)
+/// @param ht a hashtable
 /// @param cliente o cliente ao qual vamos remover a subscricao
 /// @param key a chave q o cliente deu unsub
 /// @return 0 se deu certo, 1 se deu errado
-int removeSubscription(Cliente *cliente, char *key);
+int removeSubscription(HashTable *ht, Cliente *cliente, char *key);
+
+/// @brief remove a primeira subscricao do cliente, sem procurar o par pela
+/// chave (o chamador tem a stripe da chave dela)
+/// @param cliente o cliente
+/// @param expected a primeira subscricao quando o chamador a viu; se ja nao
+/// e a primeira, o reclaimer tirou-a entretanto e nao faz nada
+/// @return 0 se deu certo, 1 se o par foi apagado e a subscricao ainda esta
+/// a espera do reclaimer
+int removeFirstSubscription(Cliente *cliente, Subscriptions *expected);
 
 /// @brief remove cliente dos followers na estrutura da chave 
 /// @param par keynode do qual vai ser removido o subscritor
@@ -20,6 +20,8 @@
 #include "operations.h"
 #include "parser.h"
 #include "kvs.h"
+#include "pool.h"
+#include "shard.h"
 #include "src/common/constants.h"
 #include "src/common/io.h"
 
@@ -57,6 +59,9 @@ size_t max_backups;        // Maximum allowed simultaneous backups
 size_t max_threads;        // Maximum allowed simultaneous threads
 char *jobs_directory = NULL;
 char *nome_fifo = NULL;
+
+static Pool clientes_pool; //estruturas Cliente
+static Pool users_pool; //nos User do buffer das threads gestoras
 int server_fifo; //descritor do server pipe
 
 int filter_job_files(const struct dirent *entry) {
@@ -94,22 +99,43 @@ static int entry_files(const char *dir, struct dirent *entry, char *in_path,
 
 static int run_job(int in_fd, int out_fd, char *filename) {
   size_t file_backups = 0;
+  Transaction *txn = NULL; //entre um BEGIN e o COMMIT/ABORT
+  //com o otimizador, os WRITE seguidos ficam num lote aplicado so antes do
+  //proximo comando de outro tipo (que ja os ve todos)
+  WriteBatch *batch = kvs_batch_begin();
   while (1) {
     char keys[MAX_WRITE_SIZE][MAX_STRING_SIZE] = {0};
     char values[MAX_WRITE_SIZE][MAX_STRING_SIZE] = {0};
+    char expected[MAX_WRITE_SIZE][MAX_STRING_SIZE];
+    long long delta;
+    unsigned int ttls[MAX_WRITE_SIZE];
     unsigned int delay;
     size_t num_pairs;
+    uint64_t cursor;
+    size_t page_size;
+
+    enum Command cmd = get_next(in_fd);
+    if (batch != NULL && cmd != CMD_WRITE && cmd != CMD_EMPTY &&
+        kvs_batch_flush(batch)) {
+      write_str(STDERR_FILENO, "Failed to write pair\n");
+    }
 
-    switch (get_next(in_fd)) {
+    switch (cmd) {
     case CMD_WRITE:
       num_pairs =
-          parse_write(in_fd, keys, values, MAX_WRITE_SIZE, MAX_STRING_SIZE);
+          parse_write(in_fd, keys, values, ttls, MAX_WRITE_SIZE, MAX_STRING_SIZE);
       if (num_pairs == 0) {
         write_str(STDERR_FILENO, "Invalid command. See HELP for usage\n");
         continue;
       }
 
-      if (kvs_write(num_pairs, keys, values)) {
+      if (txn != NULL) {
+        kvs_txn_write(txn, num_pairs, keys, values, ttls);
+      } else if (batch != NULL) {
+        if (kvs_batch_write(batch, num_pairs, keys, values, ttls)) {
+          write_str(STDERR_FILENO, "Failed to write pair\n");
+        }
+      } else if (kvs_write(num_pairs, keys, values, ttls)) {
         write_str(STDERR_FILENO, "Failed to write pair\n");
       }
       break;
@@ -123,7 +149,9 @@ static int run_job(int in_fd, int out_fd, char *filename) {
         continue;
       }
 
-      if (kvs_read(num_pairs, keys, out_fd)) {
+      if (txn != NULL) {
+        kvs_txn_read(txn, num_pairs, keys);
+      } else if (kvs_read(num_pairs, keys, out_fd)) {
         write_str(STDERR_FILENO, "Failed to read pair\n");
       }
       break;
@@ -137,15 +165,129 @@ static int run_job(int in_fd, int out_fd, char *filename) {
         continue;
       }
 
-      if (kvs_delete(num_pairs, keys, out_fd)) {
+      if (txn != NULL) {
+        kvs_txn_delete(txn, num_pairs, keys);
+      } else if (kvs_delete(num_pairs, keys, out_fd)) {
         write_str(STDERR_FILENO, "Failed to delete pair\n");
       }
       break;
 
+    case CMD_INCR:
+      if (parse_incr(in_fd, keys[0], &delta) == -1) {
+        write_str(STDERR_FILENO, "Invalid command. See HELP for usage\n");
+        continue;
+      }
+
+      if (kvs_incr(keys[0], delta, out_fd)) {
+        write_str(STDERR_FILENO, "Failed to increment pair\n");
+      }
+      break;
+
+    case CMD_CAS:
+      num_pairs = parse_cas(in_fd, keys, expected, values, MAX_WRITE_SIZE);
+      if (num_pairs == 0) {
+        write_str(STDERR_FILENO, "Invalid command. See HELP for usage\n");
+        continue;
+      }
+
+      if (kvs_cas(num_pairs, keys, expected, values, out_fd)) {
+        write_str(STDERR_FILENO, "Failed to compare and swap pair\n");
+      }
+      break;
+
+    case CMD_APPEND:
+      //APPEND [(key,suffix)...]: como um WRITE, mas sem TTL
+      num_pairs =
+          parse_write(in_fd, keys, values, ttls, MAX_WRITE_SIZE, MAX_STRING_SIZE);
+      for (size_t i = 0; i < num_pairs; i++) {
+        if (ttls[i] != 0) {
+          num_pairs = 0;
+        }
+      }
+      if (num_pairs == 0) {
+        write_str(STDERR_FILENO, "Invalid command. See HELP for usage\n");
+        continue;
+      }
+
+      if (kvs_append(num_pairs, keys, values, out_fd)) {
+        write_str(STDERR_FILENO, "Failed to append to pair\n");
+      }
+      break;
+
+    case CMD_BEGIN:
+      //BEGIN ... COMMIT: os READ, WRITE e DELETE pelo meio sao aplicados
+      //juntos no COMMIT; os outros comandos correm logo, fora da transacao
+      if (txn != NULL) {
+        write_str(STDERR_FILENO, "Transaction already started\n");
+        continue;
+      }
+
+      txn = kvs_txn_begin();
+      break;
+
+    case CMD_COMMIT:
+      if (txn == NULL) {
+        write_str(STDERR_FILENO, "No transaction to commit\n");
+        continue;
+      }
+
+      kvs_txn_commit(txn, out_fd);
+      txn = NULL;
+      break;
+
+    case CMD_ABORT:
+      if (txn == NULL) {
+        write_str(STDERR_FILENO, "No transaction to abort\n");
+        continue;
+      }
+
+      kvs_txn_abort(txn);
+      txn = NULL;
+      break;
+
     case CMD_SHOW:
       kvs_show(out_fd);
       break;
 
+    case CMD_SHOW_PAGE:
+      if (parse_show_page(in_fd, &cursor, &page_size) == -1) {
+        write_str(STDERR_FILENO, "Invalid command. See HELP for usage\n");
+        continue;
+      }
+
+      kvs_show_page(cursor, page_size, out_fd);
+      break;
+
+    case CMD_STATS:
+      kvs_stats(out_fd);
+      break;
+
+    case CMD_SCAN:
+      //SCAN [from,to]: exatamente duas chaves
+      num_pairs = parse_read_delete(in_fd, keys, 3, MAX_STRING_SIZE);
+      if (num_pairs != 2) {
+        write_str(STDERR_FILENO, "Invalid command. See HELP for usage\n");
+        continue;
+      }
+
+      if (kvs_scan(keys[0], keys[1], out_fd)) {
+        write_str(STDERR_FILENO, "Failed to scan pairs\n");
+      }
+      break;
+
+    case CMD_PREFIX:
+      //PREFIX [prefixo]: exatamente uma chave
+      num_pairs = parse_read_delete(in_fd, keys, 2, MAX_STRING_SIZE);
+      if (num_pairs != 1) {
+        write_str(STDERR_FILENO, "Invalid command. See HELP for usage\n");
+        continue;
+      }
+
+      if (kvs_prefix(keys[0], out_fd)) {
+        write_str(STDERR_FILENO, "Failed to scan pairs\n");
+      }
+      break;
+
     case CMD_WAIT:
       if (parse_wait(in_fd, &delay, NULL) == -1) {
         write_str(STDERR_FILENO, "Invalid command. See HELP for usage\n");
@@ -171,6 +313,7 @@ static int run_job(int in_fd, int out_fd, char *filename) {
       if (aux < 0) {
         write_str(STDERR_FILENO, "Failed to do backup\n");
       } else if (aux == 1) {
+        free(batch); //o lote ja estava vazio
         return 1;
       }
       break;
@@ -182,10 +325,20 @@ static int run_job(int in_fd, int out_fd, char *filename) {
     case CMD_HELP:
       write_str(STDOUT_FILENO,
                 "Available commands:\n"
-                "  WRITE [(key,value)(key2,value2),...]\n"
+                "  WRITE [(key,value)(key2,value2,ttl_ms),...]\n"
                 "  READ [key,key2,...]\n"
                 "  DELETE [key,key2,...]\n"
+                "  INCR [key,delta]\n"
+                "  CAS [(key,expected,new)(key2,expected2,new2),...]\n"
+                "  APPEND [(key,suffix)(key2,suffix2),...]\n"
+                "  BEGIN\n"
+                "  COMMIT\n"
+                "  ABORT\n"
                 "  SHOW\n"
+                "  SHOW [cursor,count]\n"
+                "  STATS\n"
+                "  SCAN [from,to]\n"
+                "  PREFIX [prefix]\n"
                 "  WAIT <delay_ms>\n"
                 "  BACKUP\n" // Not implemented
                 "  HELP\n");
@@ -196,6 +349,12 @@ static int run_job(int in_fd, int out_fd, char *filename) {
       break;
 
     case EOC:
+      if (txn != NULL) { //uma transacao sem COMMIT nao e aplicada
+        kvs_txn_abort(txn);
+      }
+      if (batch != NULL) {
+        kvs_batch_end(batch); //ja foi aplicado antes do switch
+      }
       printf("EOF\n");
       return 0;
     }
@@ -281,7 +440,7 @@ int novoCliente(char *message){
   pipe_notif[40] = '\0';  
 
   if(code==1){
-    Cliente *new_cliente = malloc(sizeof(Cliente));
+    Cliente *new_cliente = pool_alloc(&clientes_pool);
     if (new_cliente == NULL) {
       write_str(STDERR_FILENO, "Erro ao alocar memória para novo cliente\n");
       return 1;
@@ -293,12 +452,21 @@ int novoCliente(char *message){
     new_cliente->num_subscricoes=0;
     new_cliente->head_subscricoes = NULL;
     new_cliente ->usado = 0;
+    new_cliente->flag_sigusr1 = 0;
+    pthread_mutex_init(&new_cliente->lock, NULL);
     strcpy(new_cliente->req_pipe_path, pipe_req);
     strcpy(new_cliente->resp_pipe_path, pipe_resp);
-    strcpy(new_cliente->notif_pipe_path, pipe_notif);
+    notify_queue_init(&new_cliente->notif, pipe_notif, (unsigned)new_cliente->id);
     
     //inicializa os campos da estrutura user
-    User *new_user = malloc(sizeof(User));
+    User *new_user = pool_alloc(&users_pool);
+    if (new_user == NULL) {
+      write_str(STDERR_FILENO, "Erro ao alocar memória para novo cliente\n");
+      notify_queue_destroy(&new_cliente->notif);
+      pthread_mutex_destroy(&new_cliente->lock);
+      pool_free(&clientes_pool, new_cliente);
+      return 1;
+    }
     new_user->cliente = new_cliente;
     new_user->usedFlag = false;
     new_user ->nextUser = NULL;
@@ -351,7 +519,7 @@ void removeClientFromBuffer(Cliente *cliente){
   if(user_atual->cliente->id == cliente->id){
     //este user era a cabeca da lista
     bufferThreads->headUser = user_atual->nextUser;
-    free(user_atual);
+    pool_free(&users_pool, user_atual);
     return;
   }else{
     //este user esta no meio da lista
@@ -363,7 +531,7 @@ void removeClientFromBuffer(Cliente *cliente){
     }
     //encontramos o que queriamos
     prev_user->nextUser = user_atual->nextUser; //muda a ligacao antigo->atual->futuro para antigo->futuro
-    free(user_atual);
+    pool_free(&users_pool, user_atual);
     return;
   }
 
@@ -386,13 +554,26 @@ int sendOperationResult(int code, int result, Cliente* cliente){
   return 1;
 }
 
-// Função para tratar SIGUSR1
-void sinalDetetado() {
-  //tem de eliminar todas as subscricoes de todos os clientes e encerrar os seus pipes
+//SIGUSR1 recebido e ainda nao tratado pela thread do pipe do server
+static volatile sig_atomic_t sigusr1Pendente = 0;
+
+// Função para tratar SIGUSR1: so marca o sinal, pois os locks das filas e
+// das stripes nao podem ser apanhados num handler (a thread interrompida
+// pode te-los); quem desliga os clientes e a thread do pipe do server, que
+// o read interrompido acorda
+static void sinalDetetado(int sinal) {
+  (void)sinal;
+  sigusr1Pendente = 1;
+}
+
+//elimina todas as subscricoes de todos os clientes e encerra os seus pipes
+//(thread do pipe do server, depois de um SIGUSR1)
+static void desligarClientes(void) {
   mudarSinalSeguranca(); //mete como true
   User *userAtual = bufferThreads->headUser;
   while (userAtual!=NULL){
     Cliente* cliente = userAtual->cliente;
+    User *proximo = userAtual->nextUser; //antes, pois o user pode ser libertado
     if(cliente->usado){
       disconnectClient(cliente); //remove as suas subscricoes
       pthread_mutex_lock(&bufferThreads->buffer_mutex); //bloquear o buffer pois vamos altera-lo
@@ -402,20 +583,25 @@ void sinalDetetado() {
       //fechar os pipes do cliente e mete no cliente a flag de que houve um sigusr1
       close(cliente->req_pipe);
       close(cliente->resp_pipe);
-      close(cliente->notif_pipe);
+      notify_close(&cliente->notif);
       cliente->flag_sigusr1 = 1;
     }
-    userAtual=userAtual->nextUser; //passa para o proximo user
+    userAtual=proximo; //passa para o proximo user
   }
-  return;
+  mudarSinalSeguranca(); //volta a meter como false
 }
 
 //thread que lê o pipe do server
 void *readServerPipe(){
   //desbloquear SIGUSR1 apenas nesta thread
   pthread_sigmask(SIG_UNBLOCK, &sinalSeguranca, NULL);
-  //registar o manipulador de sinal
-  signal(SIGUSR1, sinalDetetado);
+  //registar o manipulador de sinal, sem SA_RESTART para o read do pipe
+  //ser interrompido e a thread tratar o sinal
+  struct sigaction acao;
+  memset(&acao, 0, sizeof(acao));
+  acao.sa_handler = sinalDetetado;
+  sigemptyset(&acao.sa_mask);
+  sigaction(SIGUSR1, &acao, NULL);
 
   //ler FIFO
   int erro=0;
@@ -432,14 +618,20 @@ void *readServerPipe(){
 
   //verifica o 4º argumento do read_all -> quando fica = 1 é para terminar o programa
   while(erro==0){
+    if(sigusr1Pendente){
+      //o sinal chegou fora do read
+      sigusr1Pendente = 0;
+      desligarClientes();
+    }
     int success = read_all(server_fifo,&message, 121, &erro);
     message[121] = '\0';
     if(erro==1){
       //houve um erro
-      if(getSinalSeguranca()){
+      if(sigusr1Pendente){
         //foi sigusr1, entao nao se termina o programa
-        mudarSinalSeguranca(); //volta a meter como false
+        sigusr1Pendente = 0;
         erro=0;
+        desligarClientes();
       }else{
         //nao foi sigusr1, entao é para terminar o programa
         return NULL;
@@ -481,7 +673,8 @@ int iniciarSessaoCliente(Cliente *cliente){
   return sendOperationResult(1, 0,cliente);
 }
 
-//so acaba quando o client der disconnect ou houver o sinal SIGSUR1
+//so acaba quando o client der disconnect (e o cliente e libertado) ou houver o
+//sinal SIGSUR1; retorna 1 se deu erro e o cliente ainda tem de ser libertado
 int manageClient(Cliente *cliente){
   //vai buscar um cliente ao buffer
   if(iniciarSessaoCliente(cliente)==1){
@@ -509,11 +702,16 @@ int manageClient(Cliente *cliente){
           pthread_mutex_lock(&bufferThreads->buffer_mutex); //bloquear o buffer pois vamos altera-lo
           removeClientFromBuffer(cliente);
           pthread_mutex_unlock(&bufferThreads->buffer_mutex); //desbloquear o buffer
-          if(sendOperationResult(code,result,cliente)==1){
-            //erro a mandar mensagem para o cliente
-            return 1;
-          }   
-          break;
+          //se a resposta nao chegar o cliente ja foi embora na mesma
+          sendOperationResult(code,result,cliente);
+          //ja nao tem subscricoes, por isso ninguem lhe poe notificacoes na
+          //fila: liberta a fila e o cliente, como no caso de erro
+          close(cliente->req_pipe);
+          close(cliente->resp_pipe);
+          notify_queue_destroy(&cliente->notif);
+          pthread_mutex_destroy(&cliente->lock);
+          pool_free(&clientes_pool, cliente);
+          return 0;
         }
 
       }else if (code==3){
@@ -588,8 +786,12 @@ void *readClientPipe() {
     if(cliente!=NULL){
       cliente->usado = 1;
       if(manageClient(cliente)==1){
-        //deu erro a ler cliente
-        free(cliente);
+        //deu erro a ler cliente: sem subscricoes ja ninguem lhe poe
+        //notificacoes na fila
+        disconnectClient(cliente);
+        notify_queue_destroy(&cliente->notif);
+        pthread_mutex_destroy(&cliente->lock);
+        pool_free(&clientes_pool, cliente);
       }
     }
   }
@@ -680,6 +882,74 @@ static void dispatch_threads(DIR *dir) {
   free(threads);
 }
 
+//opcao de arranque extra, no formato nome=valor
+//bloom=<contadores>[:<hashes>] usa um filtro de Bloom para as chaves que nao existem
+//maxmemory=<bytes>[k|m|g] limita a memoria dos pares, expulsando os menos usados
+//shards=<n> divide a tabela em n shards, cada um com uma thread que aplica os WRITE
+//index=radix|skiplist escolhe o indice ordenado das chaves (SCAN e PREFIX)
+//coalesce=<pares> junta os WRITE seguidos de um job em lotes ate esse num de pares
+//notify=<threads> threads notificadoras
+//retorna 0 se deu certo, 1 se a opcao e invalida
+static int parse_option(const char *opt) {
+  char *endptr;
+  if (strncmp(opt, "bloom=", 6) == 0) {
+    unsigned long long counters = strtoull(opt + 6, &endptr, 10);
+    unsigned long hashes = BLOOM_DEFAULT_HASHES;
+    if (*endptr == ':') {
+      hashes = strtoul(endptr + 1, &endptr, 10);
+    }
+    if (*endptr != '\0' || counters == 0 || hashes == 0 ||
+        hashes > BLOOM_MAX_HASHES) {
+      return 1;
+    }
+    set_bloom_filter((size_t)counters, (unsigned)hashes);
+    return 0;
+  }
+  if (strncmp(opt, "maxmemory=", 10) == 0) {
+    unsigned long long bytes = strtoull(opt + 10, &endptr, 10);
+    switch (*endptr) {
+      case 'g': bytes <<= 10; /* fall through */
+      case 'm': bytes <<= 10; /* fall through */
+      case 'k': bytes <<= 10; endptr++; break;
+      default: break;
+    }
+    if (*endptr != '\0' || bytes == 0) {
+      return 1;
+    }
+    set_max_memory((size_t)bytes);
+    return 0;
+  }
+  if (strncmp(opt, "shards=", 7) == 0) {
+    unsigned long n = strtoul(opt + 7, &endptr, 10);
+    if (*endptr != '\0' || n == 0 || n > MAX_SHARDS) {
+      return 1;
+    }
+    set_shards((size_t)n);
+    return 0;
+  }
+  if (strcmp(opt, "index=radix") == 0 || strcmp(opt, "index=skiplist") == 0) {
+    set_radix_index(opt[6] == 'r');
+    return 0;
+  }
+  if (strncmp(opt, "coalesce=", 9) == 0) {
+    unsigned long n = strtoul(opt + 9, &endptr, 10);
+    if (*endptr != '\0' || n > MAX_WRITE_SIZE) {
+      return 1;
+    }
+    set_write_coalescing((size_t)n);
+    return 0;
+  }
+  if (strncmp(opt, "notify=", 7) == 0) {
+    unsigned long threads = strtoul(opt + 7, &endptr, 10);
+    if (*endptr != '\0' || threads > MAX_NOTIFIERS) {
+      return 1;
+    }
+    set_notifiers((size_t)threads);
+    return 0;
+  }
+  return 1;
+}
+
 int main(int argc, char **argv) {
   if (argc < 5) {
     write_str(STDERR_FILENO, "Usage: ");
@@ -688,9 +958,24 @@ int main(int argc, char **argv) {
     write_str(STDERR_FILENO, " <max_threads>");
     write_str(STDERR_FILENO, " <max_backups> \n");
     write_str(STDERR_FILENO, " <nome_FIFO_de_registo> \n");
+    write_str(STDERR_FILENO, " [bloom=<counters>[:<hashes>]]");
+    write_str(STDERR_FILENO, " [maxmemory=<bytes>[k|m|g]]");
+    write_str(STDERR_FILENO, " [shards=<n>]");
+    write_str(STDERR_FILENO, " [coalesce=<pairs>]");
+    write_str(STDERR_FILENO, " [index=radix|skiplist]");
+    write_str(STDERR_FILENO, " [notify=<threads>]\n");
     return 1;
   }
 
+  for (int i = 5; i < argc; i++) {
+    if (parse_option(argv[i]) != 0) {
+      write_str(STDERR_FILENO, "Invalid option: ");
+      write_str(STDERR_FILENO, argv[i]);
+      write_str(STDERR_FILENO, "\n");
+      return 1;
+    }
+  }
+
   jobs_directory = argv[1];
   nome_fifo = argv[4];
 
@@ -724,6 +1009,8 @@ int main(int argc, char **argv) {
     write_str(STDERR_FILENO, "Failed to initialize KVS\n");
     return 1;
   }
+  pool_init(&clientes_pool, "clientes", sizeof(Cliente));
+  pool_init(&users_pool, "users", sizeof(User));
 
   DIR *dir = opendir(argv[1]);
   if (dir == NULL) {
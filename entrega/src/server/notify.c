@@ -0,0 +1,585 @@
+#include "notify.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "src/common/io.h"
+
+//thread notificadora
+typedef struct Notifier {
+  pthread_mutex_t lock; //protege a lista de prontos e os pedidos de close
+  pthread_cond_t closed; //a thread largou as filas fechadas ate close_done
+  NotifyQueue *ready; //filas com notificacoes novas
+  uint64_t close_req; //num de notify_close pedidos
+  uint64_t close_done; //pedidos ate onde a thread ja largou as filas
+  bool running;
+  int wake[2]; //pipe para acordar a thread quando esta no poll
+  pthread_t thread;
+  //so usados pela thread: filas a espera de o pipe ter espaco
+  NotifyQueue **waiting;
+  size_t num_waiting;
+  size_t waiting_capacity;
+} Notifier;
+
+static Notifier notifiers[MAX_NOTIFIERS];
+static size_t num_notifiers = 1; //threads pedidas
+static size_t num_started = 0; //threads que ficaram a andar
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+
+static Pool frames_pool; //NotifyFrame
+static atomic_size_t notified = 0;
+static atomic_size_t coalesced = 0;
+static atomic_size_t dropped = 0;
+static atomic_size_t stalls = 0;
+
+void notify_configure(size_t threads) {
+  num_notifiers = threads < MAX_NOTIFIERS ? threads : MAX_NOTIFIERS;
+}
+
+static size_t key_hash(const char *key) {
+  //FNV-1a
+  size_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < MAX_STRING_SIZE && key[i] != '\0'; i++) {
+    h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+//entrada do indice com a chave, ou a entrada vazia onde ficaria
+static size_t *index_slot(NotifyQueue *queue, const char *key) {
+  for (size_t i = key_hash(key) & queue->index_mask;;
+       i = (i + 1) & queue->index_mask) {
+    size_t pos = queue->index[i];
+    if (pos == 0 ||
+        strncmp(queue->frames[pos - 1]->data, key, MAX_STRING_SIZE) == 0) {
+      return &queue->index[i];
+    }
+  }
+}
+
+//tira uma entrada do indice, puxando para tras as seguintes que estavam
+//depois dela por colisao (sondagem linear, sem marcas de apagado)
+static void index_remove(NotifyQueue *queue, size_t *slot) {
+  size_t mask = queue->index_mask;
+  size_t hole = (size_t)(slot - queue->index);
+  for (size_t i = (hole + 1) & mask; queue->index[i] != 0; i = (i + 1) & mask) {
+    size_t home = key_hash(queue->frames[queue->index[i] - 1]->data) & mask;
+    //a entrada pode ir para o buraco se a posicao certa dela nao estiver
+    //entre o buraco (exclusive) e ela
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      queue->index[hole] = queue->index[i];
+      hole = i;
+    }
+  }
+  queue->index[hole] = 0;
+}
+
+//poe no indice a posicao da notificacao mais recente de cada chave
+static void rebuild_index(NotifyQueue *queue) {
+  memset(queue->index, 0, (queue->index_mask + 1) * sizeof(size_t));
+  for (size_t i = 0; i < queue->count; i++) {
+    size_t pos = (queue->head + i) % queue->capacity;
+    *index_slot(queue, queue->frames[pos]->data) = pos + 1;
+  }
+}
+
+//aumenta o anel para caberem pelo menos needed notificacoes e refaz o
+//indice; retorna 1 se nao ha memoria
+static int grow_queue(NotifyQueue *queue, size_t needed) {
+  size_t capacity = queue->capacity == 0 ? NOTIFY_QUEUE_FRAMES : queue->capacity;
+  while (capacity < needed) {
+    capacity *= 2;
+  }
+  if (capacity == queue->capacity) {
+    return 0;
+  }
+  size_t index_size = 1;
+  while (index_size < 2 * capacity) {
+    index_size <<= 1;
+  }
+  NotifyFrame **frames = malloc(capacity * sizeof(NotifyFrame *));
+  size_t *index = malloc(index_size * sizeof(size_t));
+  if (frames == NULL || index == NULL) {
+    free(frames);
+    free(index);
+    return 1;
+  }
+  //as notificacoes ficam por ordem no inicio do anel novo
+  for (size_t i = 0; i < queue->count; i++) {
+    frames[i] = queue->frames[(queue->head + i) % queue->capacity];
+  }
+  free(queue->frames);
+  free(queue->index);
+  queue->frames = frames;
+  queue->index = index;
+  queue->index_mask = index_size - 1;
+  queue->capacity = capacity;
+  queue->head = 0;
+  rebuild_index(queue);
+  return 0;
+}
+
+//tira da fila a notificacao por mandar mais antiga que nao e um DELETED
+//(nem esta a meio de ser escrita), para dar lugar a um DELETED quando nao
+//ha memoria para a fila crescer; retorna 1 se nao havia nenhuma
+static int evict_pending(NotifyQueue *queue) {
+  for (size_t i = queue->sent > 0 ? 1 : 0; i < queue->count; i++) {
+    size_t pos = (queue->head + i) % queue->capacity;
+    if (queue->frames[pos]->deleted) {
+      continue;
+    }
+    notify_frame_release(queue->frames[pos]);
+    //as seguintes andam uma posicao para tras, pela mesma ordem
+    for (size_t j = i + 1; j < queue->count; j++) {
+      size_t next = (queue->head + j) % queue->capacity;
+      queue->frames[pos] = queue->frames[next];
+      pos = next;
+    }
+    queue->count--;
+    rebuild_index(queue);
+    atomic_fetch_add(&dropped, 1);
+    return 0;
+  }
+  return 1;
+}
+
+int notify_reserve(NotifyQueue *queue, size_t keys) {
+  pthread_mutex_lock(&queue->lock);
+  int result = 0;
+  if (queue->state != NOTIFY_CLOSED && queue->notifier != NULL) {
+    //as que ja estao na fila ficam ate sair (mesmo as de chaves que deixaram
+    //de ser subscritas), cada chave subscrita pode juntar uma e a que esta a
+    //meio de ser escrita pode ter outra da mesma chave atras
+    result = grow_queue(queue, queue->count + keys + 1);
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return result;
+}
+
+//deita fora as notificacoes por mandar e a memoria da fila
+static void clear_queue(NotifyQueue *queue) {
+  atomic_fetch_add(&dropped, queue->count);
+  for (size_t i = 0; i < queue->count; i++) {
+    notify_frame_release(queue->frames[(queue->head + i) % queue->capacity]);
+  }
+  free(queue->frames);
+  free(queue->index);
+  queue->frames = NULL;
+  queue->index = NULL;
+  queue->index_mask = 0;
+  queue->capacity = queue->head = queue->count = queue->sent = 0;
+}
+
+//escreve no pipe o que puder da fila; retorna true se o pipe esta cheio
+//(ou ainda nao tem leitor) e a fila tem de esperar no poll
+static bool flush_queue(NotifyQueue *queue) {
+  pthread_mutex_lock(&queue->lock);
+  if (queue->state == NOTIFY_CLOSED) {
+    pthread_mutex_unlock(&queue->lock);
+    return false;
+  }
+  if (queue->fd < 0) {
+    queue->fd = open(queue->path, O_WRONLY | O_NONBLOCK);
+    if (queue->fd < 0 && errno == ENXIO) {
+      //o cliente ainda nao abriu o pipe para ler
+      queue->state = NOTIFY_WAITING;
+      pthread_mutex_unlock(&queue->lock);
+      return true;
+    }
+  }
+  while (queue->fd >= 0 && queue->count > 0) {
+    //as notificacoes saem dos frames partilhados, sem copias, num so
+    //writev; ate PIPE_BUF bytes o write num pipe e atomico: ou vai tudo ou
+    //da EAGAIN, e a notificacao a meio (sent) so aparece se o fd nao for
+    //um pipe
+    struct iovec iov[NOTIFY_BATCH];
+    size_t n = queue->count < NOTIFY_BATCH ? queue->count : NOTIFY_BATCH;
+    for (size_t i = 0; i < n; i++) {
+      iov[i].iov_base = queue->frames[(queue->head + i) % queue->capacity]->data;
+      iov[i].iov_len = NOTIFY_FRAME_SIZE;
+    }
+    iov[0].iov_base = (char *)iov[0].iov_base + queue->sent;
+    iov[0].iov_len -= queue->sent;
+    ssize_t written = writev(queue->fd, iov, (int)n);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN) {
+        atomic_fetch_add(&stalls, 1);
+        queue->state = NOTIFY_WAITING;
+        pthread_mutex_unlock(&queue->lock);
+        return true;
+      }
+      //o cliente fechou o pipe
+      close(queue->fd);
+      queue->fd = -1;
+      break;
+    }
+    queue->sent += (size_t)written;
+    size_t done = queue->sent / NOTIFY_FRAME_SIZE;
+    queue->sent %= NOTIFY_FRAME_SIZE;
+    for (size_t i = 0; i < done; i++) {
+      //a chave so sai do indice se esta era a notificacao mais recente dela
+      NotifyFrame *frame = queue->frames[queue->head];
+      size_t *slot = index_slot(queue, frame->data);
+      if (*slot == queue->head + 1) {
+        index_remove(queue, slot);
+      }
+      notify_frame_release(frame);
+      queue->head = (queue->head + 1) % queue->capacity;
+      queue->count--;
+    }
+    atomic_fetch_add(&notified, done);
+  }
+  if (queue->fd < 0) {
+    //nao ha pipe: o que faltava perde-se e as proximas tambem
+    clear_queue(queue);
+    queue->state = NOTIFY_CLOSED;
+  } else {
+    queue->state = NOTIFY_IDLE;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return false;
+}
+
+static void add_waiting(Notifier *notifier, NotifyQueue *queue) {
+  if (notifier->num_waiting == notifier->waiting_capacity) {
+    size_t capacity =
+        notifier->waiting_capacity == 0 ? 16 : notifier->waiting_capacity * 2;
+    NotifyQueue **waiting =
+        realloc(notifier->waiting, capacity * sizeof(NotifyQueue *));
+    if (waiting == NULL) {
+      //sem memoria volta para a lista de prontos e tenta outra vez depois
+      pthread_mutex_lock(&queue->lock);
+      if (queue->state == NOTIFY_WAITING) {
+        queue->state = NOTIFY_READY;
+        pthread_mutex_lock(&notifier->lock);
+        queue->next_ready = notifier->ready;
+        notifier->ready = queue;
+        pthread_mutex_unlock(&notifier->lock);
+      }
+      pthread_mutex_unlock(&queue->lock);
+      return;
+    }
+    notifier->waiting = waiting;
+    notifier->waiting_capacity = capacity;
+  }
+  notifier->waiting[notifier->num_waiting++] = queue;
+}
+
+static void *notifier_loop(void *arg) {
+  Notifier *notifier = arg;
+  //os sinais sao tratados pelas outras threads (e um cliente que fecha o
+  //pipe da EPIPE em vez de SIGPIPE)
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+  struct pollfd *fds = NULL;
+  size_t fds_capacity = 0;
+  while (1) {
+    pthread_mutex_lock(&notifier->lock);
+    if (!notifier->running && notifier->ready == NULL) {
+      pthread_mutex_unlock(&notifier->lock);
+      break;
+    }
+    NotifyQueue *queue = notifier->ready;
+    notifier->ready = NULL;
+    uint64_t close_req = notifier->close_req;
+    pthread_mutex_unlock(&notifier->lock);
+
+    while (queue != NULL) {
+      NotifyQueue *next = queue->next_ready; //o flush pode por a fila noutra lista
+      if (flush_queue(queue)) {
+        add_waiting(notifier, queue);
+      }
+      queue = next;
+    }
+    //larga as filas que foram fechadas enquanto esperavam
+    size_t kept = 0;
+    for (size_t i = 0; i < notifier->num_waiting; i++) {
+      NotifyQueue *waiting = notifier->waiting[i];
+      pthread_mutex_lock(&waiting->lock);
+      bool closed = waiting->state == NOTIFY_CLOSED;
+      pthread_mutex_unlock(&waiting->lock);
+      if (!closed) {
+        notifier->waiting[kept++] = waiting;
+      }
+    }
+    notifier->num_waiting = kept;
+    pthread_mutex_lock(&notifier->lock);
+    notifier->close_done = close_req;
+    pthread_cond_broadcast(&notifier->closed);
+    bool running = notifier->running;
+    pthread_mutex_unlock(&notifier->lock);
+    if (!running) {
+      continue; //so falta escrever a lista de prontos
+    }
+
+    //espera por notificacoes novas ou por espaco nos pipes cheios; os
+    //pipes que ainda nao tem leitor sao tentados de NOTIFY_RETRY_MS em
+    //NOTIFY_RETRY_MS
+    if (fds_capacity < notifier->num_waiting + 1) {
+      struct pollfd *bigger =
+          realloc(fds, (notifier->num_waiting + 1) * sizeof(struct pollfd));
+      if (bigger != NULL) {
+        fds = bigger;
+        fds_capacity = notifier->num_waiting + 1;
+      }
+    }
+    int timeout = -1;
+    size_t num_fds = 0;
+    if (fds != NULL) {
+      fds[num_fds++] = (struct pollfd){notifier->wake[0], POLLIN, 0};
+      for (size_t i = 0; i < notifier->num_waiting && num_fds < fds_capacity;
+           i++) {
+        NotifyQueue *waiting = notifier->waiting[i];
+        //o fd so muda nesta thread ou depois de a fila ser fechada
+        pthread_mutex_lock(&waiting->lock);
+        int fd = waiting->fd;
+        pthread_mutex_unlock(&waiting->lock);
+        if (fd < 0) {
+          timeout = NOTIFY_RETRY_MS;
+        } else {
+          fds[num_fds++] = (struct pollfd){fd, POLLOUT, 0};
+        }
+      }
+    }
+    if (num_fds < notifier->num_waiting + 1) {
+      timeout = NOTIFY_RETRY_MS; //sem memoria para o poll de todos
+    }
+    if (num_fds > 0) {
+      poll(fds, num_fds, timeout);
+    } else {
+      poll(NULL, 0, timeout);
+    }
+    char drain[64];
+    while (read(notifier->wake[0], drain, sizeof(drain)) > 0) {
+    }
+    //tenta outra vez todas as que esperavam (um write num pipe ainda cheio
+    //so da EAGAIN)
+    kept = 0;
+    for (size_t i = 0; i < notifier->num_waiting; i++) {
+      if (flush_queue(notifier->waiting[i])) {
+        notifier->waiting[kept++] = notifier->waiting[i];
+      }
+    }
+    notifier->num_waiting = kept;
+  }
+  free(fds);
+  return NULL;
+}
+
+static void start_notifiers(void) {
+  pool_init(&frames_pool, "frames", sizeof(NotifyFrame));
+  for (size_t i = 0; i < num_notifiers; i++) {
+    Notifier *notifier = &notifiers[i];
+    pthread_mutex_init(&notifier->lock, NULL);
+    pthread_cond_init(&notifier->closed, NULL);
+    notifier->ready = NULL;
+    notifier->close_req = notifier->close_done = 0;
+    notifier->waiting = NULL;
+    notifier->num_waiting = notifier->waiting_capacity = 0;
+    notifier->running = true;
+    if (pipe(notifier->wake) != 0) {
+      break;
+    }
+    fcntl(notifier->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(notifier->wake[1], F_SETFL, O_NONBLOCK);
+    if (pthread_create(&notifier->thread, NULL, notifier_loop, notifier) != 0) {
+      close(notifier->wake[0]);
+      close(notifier->wake[1]);
+      break;
+    }
+    num_started++;
+  }
+  if (num_started < num_notifiers) {
+    //os clientes ficam com as que arrancaram; sem nenhuma as notificacoes
+    //sao escritas logo na escrita
+    write_str(STDERR_FILENO, "Failed to create notifier thread\n");
+  }
+}
+
+void notify_queue_init(NotifyQueue *queue, const char *path, unsigned id) {
+  pthread_once(&start_once, start_notifiers);
+  pthread_mutex_init(&queue->lock, NULL);
+  strncpy(queue->path, path, MAX_PIPE_PATH_LENGTH);
+  queue->path[MAX_PIPE_PATH_LENGTH] = '\0';
+  queue->fd = -1;
+  queue->frames = NULL;
+  queue->index = NULL;
+  queue->index_mask = 0;
+  queue->capacity = queue->head = queue->count = queue->sent = 0;
+  queue->state = NOTIFY_IDLE;
+  queue->notifier = num_started > 0 ? &notifiers[id % num_started] : NULL;
+  queue->next_ready = NULL;
+}
+
+NotifyFrame *notify_frame(const char *key, const char *value) {
+  NotifyFrame *frame = pool_alloc(&frames_pool);
+  if (frame == NULL) {
+    return NULL;
+  }
+  atomic_init(&frame->refs, 1);
+  frame->deleted = value == NULL;
+  pad_string(&frame->data[0], key, 41);
+  pad_string(&frame->data[41], frame->deleted ? "DELETED" : value, 41);
+  return frame;
+}
+
+void notify_frame_release(NotifyFrame *frame) {
+  if (atomic_fetch_sub(&frame->refs, 1) == 1) {
+    pool_free(&frames_pool, frame);
+  }
+}
+
+void notify_push(NotifyQueue *queue, NotifyFrame *frame) {
+  pthread_mutex_lock(&queue->lock);
+  if (queue->state == NOTIFY_CLOSED) {
+    pthread_mutex_unlock(&queue->lock);
+    atomic_fetch_add(&dropped, 1);
+    return;
+  }
+  if (queue->notifier == NULL) {
+    //sem notificadoras escreve ja, bloqueando ate o cliente ler
+    if (queue->fd < 0) {
+      queue->fd = open(queue->path, O_WRONLY);
+    }
+    if (queue->fd >= 0 &&
+        write_all(queue->fd, frame->data, NOTIFY_FRAME_SIZE) == 1) {
+      atomic_fetch_add(&notified, 1);
+    } else {
+      atomic_fetch_add(&dropped, 1);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return;
+  }
+  if (queue->count > 0) {
+    size_t *slot = index_slot(queue, frame->data);
+    if (*slot != 0) {
+      //a chave ja tem uma notificacao por mandar: fica so o valor novo, no
+      //lugar da antiga (menos se ja estiver a meio de ser escrita ou for um
+      //DELETED, que o cliente tem de ver porque perdeu a subscricao)
+      NotifyFrame **pending = &queue->frames[*slot - 1];
+      bool sending = *slot - 1 == queue->head && queue->sent > 0;
+      if (!sending && !(*pending)->deleted) {
+        NotifyFrame *old = *pending;
+        atomic_fetch_add(&frame->refs, 1);
+        *pending = frame;
+        pthread_mutex_unlock(&queue->lock);
+        notify_frame_release(old);
+        atomic_fetch_add(&coalesced, 1);
+        return;
+      }
+    }
+  }
+  if (queue->count == queue->capacity &&
+      grow_queue(queue, queue->capacity + 1) != 0 &&
+      (!frame->deleted || evict_pending(queue) != 0)) {
+    //o notify_reserve guardou lugar para todas as chaves subscritas, por
+    //isso so chega aqui sem memoria: perde-se a notificacao, nao a escrita,
+    //e um DELETED ainda toma o lugar de um valor
+    pthread_mutex_unlock(&queue->lock);
+    atomic_fetch_add(&dropped, 1);
+    return;
+  }
+  size_t pos = (queue->head + queue->count) % queue->capacity;
+  atomic_fetch_add(&frame->refs, 1);
+  queue->frames[pos] = frame;
+  queue->count++;
+  *index_slot(queue, frame->data) = pos + 1; //no lugar de um DELETED da mesma chave
+  if (queue->state == NOTIFY_IDLE) {
+    Notifier *notifier = queue->notifier;
+    queue->state = NOTIFY_READY;
+    pthread_mutex_lock(&notifier->lock);
+    //depois do notify_stop ja ninguem escreve a fila
+    bool was_empty = notifier->running && notifier->ready == NULL;
+    if (notifier->running) {
+      queue->next_ready = notifier->ready;
+      notifier->ready = queue;
+    }
+    pthread_mutex_unlock(&notifier->lock);
+    if (was_empty) {
+      //o pipe de acordar e nao bloqueante: se estiver cheio ja vai acordar
+      ssize_t ignored = write(notifier->wake[1], "", 1);
+      (void)ignored;
+    }
+  }
+  pthread_mutex_unlock(&queue->lock);
+}
+
+void notify_close(NotifyQueue *queue) {
+  pthread_mutex_lock(&queue->lock);
+  queue->state = NOTIFY_CLOSED;
+  pthread_mutex_unlock(&queue->lock);
+
+  //a notificadora pode ter a fila na lista de prontos, na de espera ou a
+  //meio de um flush: espera que passe pelo fim de uma volta
+  Notifier *notifier = queue->notifier;
+  if (notifier != NULL) {
+    pthread_mutex_lock(&notifier->lock);
+    uint64_t req = ++notifier->close_req;
+    if (notifier->running) {
+      ssize_t ignored = write(notifier->wake[1], "", 1);
+      (void)ignored;
+      while (notifier->close_done < req) {
+        pthread_cond_wait(&notifier->closed, &notifier->lock);
+      }
+    }
+    pthread_mutex_unlock(&notifier->lock);
+  }
+
+  pthread_mutex_lock(&queue->lock);
+  if (queue->fd >= 0) {
+    close(queue->fd);
+    queue->fd = -1;
+  }
+  clear_queue(queue);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+void notify_queue_destroy(NotifyQueue *queue) {
+  notify_close(queue);
+  pthread_mutex_destroy(&queue->lock);
+}
+
+void notify_stop(void) {
+  for (size_t i = 0; i < num_started; i++) {
+    Notifier *notifier = &notifiers[i];
+    pthread_mutex_lock(&notifier->lock);
+    bool was_running = notifier->running;
+    notifier->running = false;
+    pthread_mutex_unlock(&notifier->lock);
+    if (!was_running) {
+      continue;
+    }
+    ssize_t ignored = write(notifier->wake[1], "", 1);
+    (void)ignored;
+    pthread_join(notifier->thread, NULL);
+    close(notifier->wake[0]);
+    close(notifier->wake[1]);
+    free(notifier->waiting);
+    notifier->waiting = NULL;
+    notifier->num_waiting = notifier->waiting_capacity = 0;
+  }
+}
+
+void notify_get_stats(size_t *sent, size_t *replaced, size_t *lost,
+                      size_t *full) {
+  *sent = atomic_load(&notified);
+  *replaced = atomic_load(&coalesced);
+  *lost = atomic_load(&dropped);
+  *full = atomic_load(&stalls);
+}
@@ -0,0 +1,131 @@
+#ifndef KVS_NOTIFY_H
+#define KVS_NOTIFY_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "src/common/constants.h"
+
+#define NOTIFY_FRAME_SIZE 82 // chave e valor, cada um com 41 bytes de padding
+#define MAX_NOTIFIERS 16 // threads notificadoras
+#define NOTIFY_QUEUE_FRAMES 16 // tamanho inicial do anel de cada cliente
+#define NOTIFY_BATCH (PIPE_BUF / NOTIFY_FRAME_SIZE) // notificacoes de um write
+#define NOTIFY_RETRY_MS 10 // espera para voltar a abrir um pipe sem leitor
+
+// Notificacoes assincronas para os subscritores.
+// Quem escreve ou apaga um par so copia a notificacao para a fila do
+// cliente, sem esperar pelo pipe. As threads notificadoras escrevem as
+// filas nos pipes em modo nao bloqueante e esperam com poll pelos pipes
+// cheios, por isso um cliente que nao le as notificacoes nao atrasa as
+// escritas nem os outros clientes. Cada cliente fica sempre com a mesma
+// notificadora.
+// A fila guarda no maximo uma notificacao por chave: se a chave muda outra
+// vez antes de a notificacao sair, fica so o valor mais recente, no lugar
+// da antiga. Um cliente lento perde os valores intermedios mas recebe
+// sempre o ultimo, e a fila cresce com o num de chaves que ele subscreve e
+// nao com o ritmo das escritas: o lugar e reservado no SUBSCRIBE, por isso
+// por uma notificacao na fila nunca a perde. As chaves saem pela ordem da
+// primeira alteracao que ficou por mandar.
+
+//notificacao ja no formato do pipe; e feita uma vez por alteracao e
+//partilhada (sem copias) pelas filas de todos os subscritores, por isso
+//nunca muda depois de criada
+typedef struct NotifyFrame {
+  atomic_uint refs; //uma por fila onde esta, mais a de quem a criou
+  bool deleted; //o par foi apagado (o valor e DELETED)
+  char data[NOTIFY_FRAME_SIZE];
+} NotifyFrame;
+
+typedef enum {
+  NOTIFY_IDLE,    //fila vazia
+  NOTIFY_READY,   //na lista da notificadora, a espera de ser escrita
+  NOTIFY_WAITING, //pipe cheio ou ainda sem leitor, a espera no poll
+  NOTIFY_CLOSED,  //cliente foi embora, as notificacoes sao ignoradas
+} NotifyState;
+
+//fila das notificacoes por mandar a um cliente
+typedef struct NotifyQueue {
+  pthread_mutex_t lock; //protege a fila e o pipe
+  char path[MAX_PIPE_PATH_LENGTH + 1]; //caminho do pipe de notificacoes
+  int fd; //descritor do pipe, -1 enquanto nao foi aberto
+  NotifyFrame **frames; //anel das notificacoes, NULL ate a primeira
+  size_t capacity; //tamanho do anel, cresce com as subscricoes
+  size_t *index; //posicao no anel (+1) da notificacao de cada chave, 0 se vazia
+  size_t index_mask; //tamanho do indice - 1 (potencia de 2, o dobro do anel)
+  size_t head; //posicao da primeira notificacao por mandar
+  size_t count; //num de notificacoes por mandar
+  size_t sent; //bytes da primeira ja escritos no pipe (nunca muda se > 0)
+  NotifyState state;
+  struct Notifier *notifier; //thread que escreve no pipe, NULL se nao ha
+  struct NotifyQueue *next_ready; //seguinte na lista da notificadora
+} NotifyQueue;
+
+/// @brief muda o num de threads notificadoras; tem de ser chamada antes do
+/// primeiro cliente
+/// @param threads num de threads (ate MAX_NOTIFIERS), 0 para escrever as
+/// notificacoes no pipe logo na escrita, como antes
+void notify_configure(size_t threads);
+
+/// @brief inicializa a fila de um cliente novo, pondo as notificadoras a
+/// andar se for a primeira vez
+/// @param queue a fila
+/// @param path caminho do pipe de notificacoes do cliente
+/// @param id id do cliente, escolhe a notificadora
+void notify_queue_init(NotifyQueue *queue, const char *path, unsigned id);
+
+/// @brief cria a notificacao de que a chave mudou, para ser posta nas filas
+/// de todos os subscritores
+/// @param key a chave
+/// @param value o valor novo, NULL se o par foi apagado (a mensagem leva
+/// DELETED)
+/// @return a notificacao, com uma referencia para quem a criou, NULL se nao
+/// havia memoria
+NotifyFrame *notify_frame(const char *key, const char *value);
+
+/// @brief larga uma referencia a notificacao, libertando-a na ultima
+/// @param frame a notificacao
+void notify_frame_release(NotifyFrame *frame);
+
+/// @brief aumenta a fila do cliente para as notificacoes de todas as chaves
+/// que ele subscreve, mais as que ja estao por mandar; e chamada antes de
+/// cada subscricao nova
+/// @param queue a fila do cliente
+/// @param keys num de chaves subscritas, ja com a nova
+/// @return 0 se deu certo, 1 se nao havia memoria
+int notify_reserve(NotifyQueue *queue, size_t keys);
+
+/// @brief poe a notificacao na fila do cliente (ou troca a que ja la estava
+/// para a mesma chave), sem esperar que seja escrita; a fila fica com a sua
+/// propria referencia
+/// @param queue a fila do cliente
+/// @param frame a notificacao
+void notify_push(NotifyQueue *queue, NotifyFrame *frame);
+
+/// @brief deixa de mandar notificacoes ao cliente: espera que a
+/// notificadora o largue, fecha o pipe e deita fora o que faltava mandar;
+/// pode ser chamada mais do que uma vez
+/// @param queue a fila do cliente
+void notify_close(NotifyQueue *queue);
+
+/// @brief fecha a fila e liberta os recursos dela, para o cliente poder
+/// ser libertado
+/// @param queue a fila do cliente
+void notify_queue_destroy(NotifyQueue *queue);
+
+/// @brief escreve o que esta nas listas das notificadoras e para as threads
+void notify_stop(void);
+
+/// @brief retorna as estatisticas das notificacoes
+/// @param sent onde fica o num de notificacoes escritas nos pipes
+/// @param coalesced onde fica o num de valores que foram trocados por um
+/// mais recente antes de sairem
+/// @param dropped onde fica o num de notificacoes perdidas (sem memoria ou
+/// cliente que ja foi embora)
+/// @param stalls onde fica o num de vezes que um pipe estava cheio
+void notify_get_stats(size_t *sent, size_t *coalesced, size_t *dropped,
+                      size_t *stalls);
+
+#endif // KVS_NOTIFY_H
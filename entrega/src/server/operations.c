@@ -1,6 +1,8 @@
 #include "operations.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,10 +14,167 @@
 #include "io.h"
 #include "src/common/io.h"
 #include "kvs.h"
+#include "epoch.h"
+#include "notify.h"
+#include "pool.h"
+#include "reclaim.h"
+#include "shard.h"
+#include "snapshot.h"
+#include "timer.h"
 
-static struct HashTable *kvs_table = NULL;
+#define READ_RETRIES 4 // leituras sem locks de um lote antes de bloquear
+#define TXN_MAX_KEYS MAX_WRITE_SIZE // chaves de uma transacao, somando tudo
+#define TXN_MAX_RETRIES 8 // validacoes falhadas de um COMMIT antes de abortar
+#define TXN_INDEX_SIZE (2 * TXN_MAX_KEYS) // entradas do indice das escritas (potencia de 2)
+#define OVERWRITE_MAX (SHARD_DRAIN_MAX + SHARD_QUEUE_SIZE) // escritas de um lote aplicado de uma vez
+#define OVERWRITE_INDEX_SIZE 4096 // indice das chaves de um lote (potencia de 2)
+#define SHARD_CURSOR_SHIFT 56 // bits do cursor do SHOW abaixo do shard
+
+static struct HashTable *kvs_table = NULL; //a tabela, ou o shard 0
+static HashTable *kvs_shards[MAX_SHARDS]; //tabelas dos shards
+static size_t num_shards = 1; //mais do que 1 no modo particionado
+static size_t bloom_counters = 0; //0 se nao ha filtro de Bloom
+static unsigned bloom_hashes = 0;
+static size_t max_memory = 0; //limite de memoria da tabela, 0 se nao ha
+static bool radix_index = false; //indice ordenado em arvore radix, e nao skiplist
+static size_t notifier_threads = 1; //0 para escrever as notificacoes na escrita
+static atomic_size_t txn_commits = 0; //transacoes aplicadas
+static atomic_size_t txn_retries = 0; //validacoes falhadas por conflito
+static atomic_size_t txn_aborts = 0; //transacoes que nunca validaram
+static size_t coalesce_max = 0; //pares de um lote do otimizador, 0 se desligado
+static atomic_size_t coalesced = 0; //WRITE juntos a um lote de WRITE anteriores
+static atomic_size_t locks_saved = 0; //stripes que os WRITE juntos nao bloquearam
+static atomic_size_t dead_writes = 0; //escritas reescritas no mesmo lote, saltadas
 int sinalSegurancaLancado=0; //flag para saber se houve um sinal SIGUSR1 lancado ou nao (0-false 1-true)
 
+//stripes de um lote em cada shard
+typedef struct KeyLocks {
+  uint64_t stripes[MAX_SHARDS];
+} KeyLocks;
+
+//shard de uma chave; usa os bits altos do hash, pois os baixos escolhem o
+//bucket e a stripe
+static size_t shard_of(const char *key) {
+  return num_shards == 1 ? 0 : (size_t)((hash(key) >> 32) % num_shards);
+}
+
+//tabela de uma chave
+static HashTable *table_of(const char *key) {
+  return kvs_shards[shard_of(key)];
+}
+
+static void keylocks_clear(KeyLocks *locks) {
+  memset(locks->stripes, 0, num_shards * sizeof(uint64_t));
+}
+
+static void keylocks_add(KeyLocks *locks, const char *key) {
+  locks->stripes[shard_of(key)] |= stripe_bit(key);
+}
+
+//bloqueia os shards por ordem crescente (e as stripes de cada um tambem),
+//por isso lotes com chaves em varios shards nunca entram em deadlock
+static void keylocks_lock(KeyLocks *locks, bool write) {
+  for (size_t i = 0; i < num_shards; i++) {
+    if (locks->stripes[i] != 0) {
+      lock_stripes(kvs_shards[i], locks->stripes[i], write);
+    }
+  }
+}
+
+static void keylocks_unlock(KeyLocks *locks) {
+  for (size_t i = 0; i < num_shards; i++) {
+    if (locks->stripes[i] != 0) {
+      unlock_stripes(kvs_shards[i], locks->stripes[i]);
+    }
+  }
+}
+
+//num de stripes (de todos os shards) que um lote bloqueia
+static size_t count_locks(size_t num_keys, char keys[][MAX_STRING_SIZE]) {
+  KeyLocks locks;
+  keylocks_clear(&locks);
+  for (size_t i = 0; i < num_keys; i++) {
+    keylocks_add(&locks, keys[i]);
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < num_shards; i++) {
+    n += (size_t)__builtin_popcountll(locks.stripes[i]);
+  }
+  return n;
+}
+
+//bloqueia as stripes de todas as chaves de um lote
+static void lock_keys(KeyLocks *locks, size_t num_keys,
+                      char keys[][MAX_STRING_SIZE], bool write) {
+  keylocks_clear(locks);
+  for (size_t i = 0; i < num_keys; i++) {
+    keylocks_add(locks, keys[i]);
+  }
+  keylocks_lock(locks, write);
+}
+
+//depois de escritas (sem stripes bloqueadas): expulsoes acima do limite de
+//memoria, pares apagados que ja se podem tirar e rehash, nos shards escritos
+static void after_writes(KeyLocks *locks, size_t num_writes, bool deletes) {
+  for (size_t i = 0; i < num_shards; i++) {
+    if (locks->stripes[i] == 0) {
+      continue;
+    }
+    if (deletes) {
+      table_collect(kvs_shards[i]);
+    }
+    table_evict(kvs_shards[i], num_writes * EVICT_PER_WRITE);
+    table_maintenance(kvs_shards[i]);
+  }
+}
+
+//agenda as expiracoes de um lote, fora das stripes; se a roda apagar antes
+//de uma reescrita, volta a ver o prazo do par e nao apaga
+static void schedule_expiries(size_t num_pairs, char keys[][MAX_STRING_SIZE],
+                              const uint64_t deadlines[]) {
+  for (size_t i = 0; i < num_pairs; i++) {
+    if (deadlines[i] != 0 && timer_add(keys[i], deadlines[i]) != 0) {
+      write_str(STDERR_FILENO, "Failed to schedule expiry of key ");
+      write_str(STDERR_FILENO, keys[i]);
+      write_str(STDERR_FILENO, "\n");
+    }
+  }
+}
+
+_Static_assert(OVERWRITE_INDEX_SIZE >= 2 * OVERWRITE_MAX,
+               "o indice das chaves de um lote tem de ter entradas vazias");
+
+//marca as escritas de um lote cuja chave volta a ser escrita mais a frente;
+//percorre o lote de tras para a frente com um indice aberto das chaves ja
+//vistas, por isso custa um hash por escrita
+static void find_overwritten(size_t num_pairs, const char *keys[],
+                             bool overwritten[]) {
+  uint64_t hashes[OVERWRITE_MAX];
+  uint16_t seen[OVERWRITE_INDEX_SIZE]; //indice (+1) da chave, 0 se vazia
+  memset(seen, 0, sizeof(seen));
+  for (size_t i = num_pairs; i-- > 0;) {
+    hashes[i] = hash(keys[i]);
+    overwritten[i] = false;
+    size_t pos = hashes[i] & (OVERWRITE_INDEX_SIZE - 1);
+    while (seen[pos] != 0 && !overwritten[i]) {
+      size_t j = seen[pos] - 1u;
+      overwritten[i] = hashes[j] == hashes[i] && strcmp(keys[j], keys[i]) == 0;
+      pos = (pos + 1) & (OVERWRITE_INDEX_SIZE - 1);
+    }
+    if (!overwritten[i]) {
+      seen[pos] = (uint16_t)(i + 1);
+    }
+  }
+}
+
+static void write_failed(const char *key, const char *value) {
+  write_str(STDERR_FILENO, "Failed to write key pair (");
+  write_str(STDERR_FILENO, key);
+  write_str(STDERR_FILENO, ",");
+  write_str(STDERR_FILENO, value);
+  write_str(STDERR_FILENO, ")\n");
+}
+
 /// Calculates a timespec from a delay in milliseconds.
 /// @param delay_ms Delay in milliseconds.
 /// @return Timespec with the given delay.
@@ -23,14 +182,148 @@ static struct timespec delay_to_timespec(unsigned int delay_ms) {
   return (struct timespec){delay_ms / 1000, (delay_ms % 1000) * 1000000};
 }
 
+//apaga um lote de chaves cujo prazo passou (chamada pela thread da roda);
+//bloqueia as stripes do lote so durante as remocoes, como um DELETE
+static void expire_keys(char keys[][MAX_STRING_SIZE], size_t num_keys) {
+  KeyLocks locks;
+  lock_keys(&locks, num_keys, keys, true);
+  for (size_t i = 0; i < num_keys; i++) {
+    expire_pair(table_of(keys[i]), keys[i]);
+  }
+  keylocks_unlock(&locks);
+  for (size_t i = 0; i < num_shards; i++) {
+    if (locks.stripes[i] != 0) {
+      table_maintenance(kvs_shards[i]);
+    }
+  }
+}
+
+//aplica as escritas tiradas das filas de um shard (thread dona do shard):
+//um so lock das stripes e um so commit para as escritas de todas as filas.
+//como num lote do otimizador, uma escrita cuja chave volta a ser escrita
+//mais a frente (pela mesma thread ou por outra) e saltada
+static void apply_shard_writes(size_t shard, ShardWrite *const writes[],
+                               size_t num_writes) {
+  HashTable *ht = kvs_shards[shard];
+  const char *keys[OVERWRITE_MAX];
+  bool overwritten[OVERWRITE_MAX];
+  uint64_t stripes = 0;
+  for (size_t i = 0; i < num_writes; i++) {
+    keys[i] = writes[i]->key;
+    stripes |= stripe_bit(writes[i]->key);
+  }
+  find_overwritten(num_writes, keys, overwritten);
+  lock_stripes(ht, stripes, true);
+  uint64_t commit = commit_begin(ht);
+  size_t dead = 0;
+  for (size_t i = 0; i < num_writes; i++) {
+    if (overwritten[i] && !pair_has_subscribers(ht, writes[i]->key)) {
+      dead++;
+      continue;
+    }
+    overwritten[i] = false; //so as saltadas ficam marcadas
+    if (write_pair(ht, writes[i]->key, writes[i]->value, writes[i]->expires_at,
+                   commit) != 0) {
+      write_failed(writes[i]->key, writes[i]->value);
+    }
+  }
+  unlock_stripes(ht, stripes);
+  commit_end(ht, commit);
+  for (size_t i = 0; i < num_writes; i++) {
+    if (!overwritten[i] && writes[i]->expires_at != 0 &&
+        timer_add(writes[i]->key, writes[i]->expires_at) != 0) {
+      write_str(STDERR_FILENO, "Failed to schedule expiry of key ");
+      write_str(STDERR_FILENO, writes[i]->key);
+      write_str(STDERR_FILENO, "\n");
+    }
+  }
+  if (dead > 0) {
+    atomic_fetch_add(&dead_writes, dead);
+  }
+  table_evict(ht, num_writes * EVICT_PER_WRITE);
+  table_maintenance(ht);
+}
+
+//cria as tabelas; no modo particionado todas usam o relogio dos commits do
+//shard 0, para um snapshot ler os shards todos no mesmo instante
+static int create_tables(void) {
+  for (size_t i = 0; i < num_shards; i++) {
+    kvs_shards[i] = create_hash_table();
+    if (kvs_shards[i] == NULL) {
+      return 1;
+    }
+    if (i > 0) {
+      share_commit_clock(kvs_shards[i], kvs_shards[0]);
+    }
+    //o limite de memoria e o filtro sao divididos pelos shards
+    set_memory_budget(kvs_shards[i], max_memory / num_shards);
+    if (radix_index && enable_radix_index(kvs_shards[i]) != 0) {
+      write_str(STDERR_FILENO, "Failed to create radix index\n");
+      return 1;
+    }
+    if (bloom_counters > 0 &&
+        enable_bloom_filter(kvs_shards[i], bloom_counters / num_shards,
+                            bloom_hashes) != 0) {
+      write_str(STDERR_FILENO, "Failed to create Bloom filter\n");
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void free_tables(void) {
+  for (size_t i = 0; i < num_shards; i++) {
+    if (kvs_shards[i] != NULL) {
+      free_table(kvs_shards[i]);
+      kvs_shards[i] = NULL;
+    }
+  }
+  kvs_table = NULL;
+}
+
 int kvs_init() {
   if (kvs_table != NULL) {
     write_str(STDERR_FILENO, "KVS state has already been initialized\n");
     return 1;
   }
 
-  kvs_table = create_hash_table();
-  return kvs_table == NULL;
+  if (create_tables() != 0) {
+    free_tables();
+    return 1;
+  }
+  kvs_table = kvs_shards[0];
+  timer_set_handler(expire_keys);
+  notify_configure(notifier_threads);
+  if (num_shards > 1 && shards_start(num_shards, apply_shard_writes) != 0) {
+    free_tables();
+    return 1;
+  }
+  return 0;
+}
+
+void set_bloom_filter(size_t counters, unsigned hashes) {
+  bloom_counters = counters;
+  bloom_hashes = hashes;
+}
+
+void set_radix_index(bool enable) {
+  radix_index = enable;
+}
+
+void set_max_memory(size_t bytes) {
+  max_memory = bytes;
+}
+
+void set_shards(size_t n) {
+  num_shards = n;
+}
+
+void set_write_coalescing(size_t max_pairs) {
+  coalesce_max = max_pairs;
+}
+
+void set_notifiers(size_t threads) {
+  notifier_threads = threads;
 }
 
 int kvs_terminate() {
@@ -39,57 +332,370 @@ int kvs_terminate() {
     return 1;
   }
 
-  free_table(kvs_table);
-  kvs_table = NULL;
+  shards_stop(); //aplica as escritas que ainda estao nas filas
+  timer_stop(); //a thread da roda usa a tabela
+  reclaim_stop(); //os trabalhos que faltam ainda usam os pares
+  notify_stop(); //depois do reclaimer, que ainda poe notificacoes DELETED
+  free_tables();
   return 0;
 }
 
-int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE],
-              char values[][MAX_STRING_SIZE]) {
+//aplica um WRITE; com skip_dead (lotes juntos pelo otimizador) salta as
+//escritas cuja chave volta a ser escrita mais a frente no lote
+static int write_pairs(size_t num_pairs, char keys[][MAX_STRING_SIZE],
+                       char values[][MAX_STRING_SIZE], unsigned int ttls[],
+                       bool skip_dead) {
   if (kvs_table == NULL) {
     write_str(STDERR_FILENO, "KVS state must be initialized\n");
     return 1;
   }
 
-  pthread_rwlock_wrlock(&kvs_table->tablelock);
+  uint64_t deadlines[MAX_WRITE_SIZE];
+  for (size_t i = 0; i < num_pairs; i++) {
+    deadlines[i] = ttls[i] > 0 ? timer_deadline(ttls[i]) : 0;
+  }
+  //no modo particionado um lote de um so shard vai para a fila da thread
+  //dona e o WRITE acaba logo; os comandos seguintes desta thread esperam
+  //por ele (shard_sync)
+  if (num_shards > 1) {
+    size_t shard = shard_of(keys[0]);
+    bool um_shard = true;
+    for (size_t i = 1; i < num_pairs && um_shard; i++) {
+      um_shard = shard_of(keys[i]) == shard;
+    }
+    if (um_shard &&
+        shard_push(shard, num_pairs, keys, values, deadlines) == 0) {
+      return 0;
+    }
+    shard_sync();
+  }
+
+  bool overwritten[MAX_WRITE_SIZE];
+  if (skip_dead) {
+    const char *key_ptrs[MAX_WRITE_SIZE];
+    for (size_t i = 0; i < num_pairs; i++) {
+      key_ptrs[i] = keys[i];
+    }
+    find_overwritten(num_pairs, key_ptrs, overwritten);
+  } else {
+    memset(overwritten, 0, num_pairs * sizeof(bool));
+  }
+
+  //o lote fica todo visivel de uma vez, pois as stripes so sao libertadas
+  //depois de escritos todos os pares (com varios shards, as de todos)
+  KeyLocks locks;
+  lock_keys(&locks, num_pairs, keys, true);
+  uint64_t commit = commit_begin(kvs_table);
 
+  size_t dead = 0;
   for (size_t i = 0; i < num_pairs; i++) {
-    if (write_pair(kvs_table, keys[i], values[i]) != 0) {
-      write_str(STDERR_FILENO, "Failed to write key pair (");
-      write_str(STDERR_FILENO, keys[i]);
-      write_str(STDERR_FILENO, ",");
-      write_str(STDERR_FILENO, values[i]);
-      write_str(STDERR_FILENO, ")\n");
+    HashTable *ht = table_of(keys[i]);
+    if (overwritten[i] && !pair_has_subscribers(ht, keys[i])) {
+      //a versao ficava no mesmo commit que a seguinte, por isso nenhum
+      //snapshot a le; so os subscritores a podiam ver
+      deadlines[i] = 0;
+      dead++;
+      continue;
+    }
+    if (write_pair(ht, keys[i], values[i], deadlines[i], commit) != 0) {
+      write_failed(keys[i], values[i]);
     }
   }
 
-  pthread_rwlock_unlock(&kvs_table->tablelock);
+  keylocks_unlock(&locks);
+  commit_end(kvs_table, commit);
+  schedule_expiries(num_pairs, keys, deadlines);
+  //acima do limite de memoria cada escrita paga algumas expulsoes, sem
+  //nenhuma stripe do lote bloqueada
+  after_writes(&locks, num_pairs, false);
+  if (dead > 0) {
+    atomic_fetch_add(&dead_writes, dead);
+  }
   return 0;
 }
 
-int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fd) {
+int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE],
+              char values[][MAX_STRING_SIZE], unsigned int ttls[]) {
+  return write_pairs(num_pairs, keys, values, ttls, false);
+}
+
+//WRITE seguidos de um job, ainda por aplicar
+struct WriteBatch {
+  size_t num_pairs;
+  size_t num_commands; //WRITE no lote
+  size_t num_locks; //stripes que os WRITE do lote bloqueavam um a um
+  char keys[MAX_WRITE_SIZE][MAX_STRING_SIZE];
+  char values[MAX_WRITE_SIZE][MAX_STRING_SIZE];
+  unsigned int ttls[MAX_WRITE_SIZE];
+};
+
+WriteBatch *kvs_batch_begin() {
+  if (coalesce_max == 0) {
+    return NULL;
+  }
+  WriteBatch *batch = malloc(sizeof(WriteBatch));
+  if (batch == NULL) {
+    //os WRITE do job correm um a um
+    write_str(STDERR_FILENO, "Failed to allocate write batch\n");
+    return NULL;
+  }
+  batch->num_pairs = 0;
+  batch->num_commands = 0;
+  batch->num_locks = 0;
+  return batch;
+}
+
+int kvs_batch_write(WriteBatch *batch, size_t num_pairs,
+                    char keys[][MAX_STRING_SIZE],
+                    char values[][MAX_STRING_SIZE], unsigned int ttls[]) {
+  int result = 0;
+  if (batch->num_pairs + num_pairs > coalesce_max) {
+    result = kvs_batch_flush(batch);
+  }
+  memcpy(batch->keys[batch->num_pairs], keys, num_pairs * MAX_STRING_SIZE);
+  memcpy(batch->values[batch->num_pairs], values, num_pairs * MAX_STRING_SIZE);
+  memcpy(&batch->ttls[batch->num_pairs], ttls, num_pairs * sizeof(unsigned int));
+  batch->num_pairs += num_pairs;
+  batch->num_commands++;
+  batch->num_locks += count_locks(num_pairs, keys);
+  return result;
+}
+
+int kvs_batch_flush(WriteBatch *batch) {
+  if (batch->num_commands == 0) {
+    return 0;
+  }
+  if (batch->num_commands > 1) {
+    atomic_fetch_add(&coalesced, batch->num_commands - 1);
+    atomic_fetch_add(&locks_saved,
+                     batch->num_locks -
+                         count_locks(batch->num_pairs, batch->keys));
+  }
+  int result = write_pairs(batch->num_pairs, batch->keys, batch->values,
+                           batch->ttls, true);
+  batch->num_pairs = 0;
+  batch->num_commands = 0;
+  batch->num_locks = 0;
+  return result;
+}
+
+int kvs_batch_end(WriteBatch *batch) {
+  int result = kvs_batch_flush(batch);
+  free(batch);
+  return result;
+}
+
+//versao atual de uma chave, com a stripe bloqueada (NULL se nao existe)
+static const ValueVersion *current_version(char *key) {
+  KeyNode *keyNode = getKeyNode(table_of(key), key);
+  return keyNode != NULL ? pair_version(keyNode, SNAPSHOT_LATEST) : NULL;
+}
+
+//escreve o valor calculado por um INCR/CAS/APPEND, mantendo o prazo do par;
+//se o valor nao mudou nao escreve, para os subscritores nao serem notificados
+static void update_pair(char *key, const char *value,
+                        const ValueVersion *version, uint64_t commit) {
+  if (version != NULL && strcmp(version->value, value) == 0) {
+    return;
+  }
+  uint64_t expires_at = version != NULL ? version->expires_at : 0;
+  if (write_pair(table_of(key), key, value, expires_at, commit) != 0) {
+    write_failed(key, value);
+  }
+}
+
+//acrescenta (key,text) ao buffer de saida de um comando
+static void out_pair(OutBuf *out, const char *key, const char *text) {
+  if (out->len == 0) {
+    outbuf_write(out, "[", 1);
+  }
+  outbuf_write(out, "(", 1);
+  outbuf_str(out, key);
+  outbuf_write(out, ",", 1);
+  outbuf_str(out, text);
+  outbuf_write(out, ")", 1);
+}
+
+//fim de um INCR/CAS/APPEND: as escritas ficam visiveis e a saida e escrita
+//so depois de libertar as stripes
+static void finish_update(size_t num_pairs, KeyLocks *locks, uint64_t commit,
+                          OutBuf *out) {
+  keylocks_unlock(locks);
+  commit_end(kvs_table, commit);
+  if (out->len > 0) {
+    outbuf_write(out, "]\n", 2);
+    outbuf_flush(out);
+  }
+  after_writes(locks, num_pairs, false);
+}
+
+int kvs_incr(char *key, long long delta, int fd) {
   if (kvs_table == NULL) {
     write_str(STDERR_FILENO, "KVS state must be initialized\n");
     return 1;
   }
 
-  pthread_rwlock_rdlock(&kvs_table->tablelock);
+  //a leitura e a escrita sao feitas com a stripe bloqueada, por isso dois
+  //INCR da mesma chave em threads diferentes nunca perdem um incremento
+  shard_sync();
+  KeyLocks locks;
+  keylocks_clear(&locks);
+  keylocks_add(&locks, key);
+  keylocks_lock(&locks, true);
+  uint64_t commit = commit_begin(kvs_table);
+  OutBuf *out = outbuf_begin(fd);
+  const ValueVersion *version = current_version(key);
+  long long number = 0;
+  bool valid = true;
+  if (version != NULL) {
+    char *endptr;
+    errno = 0;
+    number = strtoll(version->value, &endptr, 10);
+    valid = errno == 0 && endptr != version->value && *endptr == '\0';
+  }
+  if (valid && !__builtin_add_overflow(number, delta, &number)) {
+    char value[MAX_STRING_SIZE];
+    snprintf(value, sizeof(value), "%lld", number);
+    update_pair(key, value, version, commit);
+    out_pair(out, key, value);
+  } else {
+    out_pair(out, key, "KVSERROR");
+  }
+  finish_update(1, &locks, commit, out);
+  return 0;
+}
+
+int kvs_cas(size_t num_pairs, char keys[][MAX_STRING_SIZE],
+            char expected[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE],
+            int fd) {
+  if (kvs_table == NULL) {
+    write_str(STDERR_FILENO, "KVS state must be initialized\n");
+    return 1;
+  }
 
-  write_str(fd, "[");
+  shard_sync();
+  KeyLocks locks;
+  lock_keys(&locks, num_pairs, keys, true);
+  uint64_t commit = commit_begin(kvs_table);
+  OutBuf *out = outbuf_begin(fd);
   for (size_t i = 0; i < num_pairs; i++) {
-    char *result = read_pair(kvs_table, keys[i]);
-    char aux[MAX_STRING_SIZE];
-    if (result == NULL) {
-      snprintf(aux, MAX_STRING_SIZE, "(%s,KVSERROR)", keys[i]);
+    const ValueVersion *version = current_version(keys[i]);
+    if (version == NULL) {
+      out_pair(out, keys[i], "KVSMISSING");
+    } else if (strcmp(version->value, expected[i]) != 0) {
+      out_pair(out, keys[i], "KVSMISMATCH");
     } else {
-      snprintf(aux, MAX_STRING_SIZE, "(%s,%s)", keys[i], result);
+      update_pair(keys[i], values[i], version, commit);
     }
-    write_str(fd, aux);
-    free(result);
   }
-  write_str(fd, "]\n");
+  finish_update(num_pairs, &locks, commit, out);
+  return 0;
+}
+
+int kvs_append(size_t num_pairs, char keys[][MAX_STRING_SIZE],
+               char suffixes[][MAX_STRING_SIZE], int fd) {
+  if (kvs_table == NULL) {
+    write_str(STDERR_FILENO, "KVS state must be initialized\n");
+    return 1;
+  }
 
-  pthread_rwlock_unlock(&kvs_table->tablelock);
+  shard_sync();
+  KeyLocks locks;
+  lock_keys(&locks, num_pairs, keys, true);
+  uint64_t commit = commit_begin(kvs_table);
+  OutBuf *out = outbuf_begin(fd);
+  for (size_t i = 0; i < num_pairs; i++) {
+    const ValueVersion *version = current_version(keys[i]);
+    const char *current = version != NULL ? version->value : "";
+    size_t len = strlen(current);
+    size_t suffix_len = strlen(suffixes[i]);
+    if (len + suffix_len >= MAX_STRING_SIZE) {
+      out_pair(out, keys[i], "KVSERROR");
+      continue;
+    }
+    char value[MAX_STRING_SIZE];
+    memcpy(value, current, len);
+    memcpy(value + len, suffixes[i], suffix_len + 1);
+    update_pair(keys[i], value, version, commit);
+  }
+  finish_update(num_pairs, &locks, commit, out);
+  return 0;
+}
+
+//le sem locks as chaves de um lote que estao num shard, com as versoes de
+//um snapshot; as sequencias das stripes so confirmam que nenhuma procura
+//apanhou um rehash a meio (se apanhar varias vezes seguidas bloqueia as
+//stripes)
+static void read_shard(size_t shard, uint64_t stripes, size_t num_pairs,
+                       char keys[][MAX_STRING_SIZE],
+                       char values[][MAX_STRING_SIZE], int missing[],
+                       uint64_t snapshot) {
+  HashTable *ht = kvs_shards[shard];
+  unsigned seqs[NUM_STRIPES];
+  bool consistente = false;
+  for (int tentativa = 0; tentativa < READ_RETRIES && !consistente;
+       tentativa++) {
+    if (!read_stripes_begin(ht, stripes, seqs)) {
+      break;
+    }
+    for (size_t i = 0; i < num_pairs; i++) {
+      if (shard_of(keys[i]) == shard) {
+        missing[i] =
+            read_pair(ht, keys[i], values[i], MAX_STRING_SIZE, snapshot);
+      }
+    }
+    consistente = read_stripes_validate(ht, stripes, seqs);
+  }
+  if (!consistente) {
+    lock_stripes(ht, stripes, false);
+    for (size_t i = 0; i < num_pairs; i++) {
+      if (shard_of(keys[i]) == shard) {
+        missing[i] =
+            read_pair(ht, keys[i], values[i], MAX_STRING_SIZE, snapshot);
+      }
+    }
+    unlock_stripes(ht, stripes);
+  }
+}
+
+int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fd) {
+  if (kvs_table == NULL) {
+    write_str(STDERR_FILENO, "KVS state must be initialized\n");
+    return 1;
+  }
+
+  //le as versoes de um snapshot, por isso o lote e consistente mesmo com
+  //escritas ao mesmo tempo (e com varios shards, pois partilham o relogio
+  //dos commits). os valores sao copiados para a pilha, sem alocar memoria
+  shard_sync();
+  uint64_t snapshot = snapshot_begin(&kvs_table->clock->visible_commit);
+  KeyLocks locks;
+  keylocks_clear(&locks);
+  for (size_t i = 0; i < num_pairs; i++) {
+    keylocks_add(&locks, keys[i]);
+  }
+  char values[MAX_WRITE_SIZE][MAX_STRING_SIZE];
+  int missing[MAX_WRITE_SIZE];
+  for (size_t shard = 0; shard < num_shards; shard++) {
+    if (locks.stripes[shard] != 0) {
+      read_shard(shard, locks.stripes[shard], num_pairs, keys, values, missing,
+                 snapshot);
+    }
+  }
+  snapshot_end();
+
+  //a linha toda sai com um so write
+  OutBuf *out = outbuf_begin(fd);
+  outbuf_write(out, "[", 1);
+  for (size_t i = 0; i < num_pairs; i++) {
+    outbuf_write(out, "(", 1);
+    outbuf_str(out, keys[i]);
+    outbuf_write(out, ",", 1);
+    outbuf_str(out, missing[i] ? "KVSERROR" : values[i]);
+    outbuf_write(out, ")", 1);
+  }
+  outbuf_write(out, "]\n", 2);
+  outbuf_flush(out);
   return 0;
 }
 
@@ -99,48 +705,649 @@ int kvs_delete(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fd) {
     return 1;
   }
 
-  pthread_rwlock_wrlock(&kvs_table->tablelock);
+  shard_sync();
+  KeyLocks locks;
+  lock_keys(&locks, num_pairs, keys, true);
+  uint64_t commit = commit_begin(kvs_table);
 
-  int aux = 0;
+  //as chaves em falta sao escritas no fd so depois de libertar as stripes
+  OutBuf *out = outbuf_begin(fd);
   for (size_t i = 0; i < num_pairs; i++) {
-    if (delete_pair(kvs_table, keys[i]) != 0) {
-      if (!aux) {
-        write_str(fd, "[");
-        aux = 1;
+    if (delete_pair(table_of(keys[i]), keys[i], commit) != 0) {
+      if (out->len == 0) {
+        outbuf_write(out, "[", 1);
+      }
+      outbuf_write(out, "(", 1);
+      outbuf_str(out, keys[i]);
+      outbuf_str(out, ",KVSMISSING)");
+    }
+  }
+
+  keylocks_unlock(&locks);
+  commit_end(kvs_table, commit);
+  if (out->len > 0) {
+    outbuf_write(out, "]\n", 2);
+    outbuf_flush(out);
+  }
+  //os pares apagados so saem da tabela quando ja nenhum snapshot os le
+  after_writes(&locks, 0, true);
+  return 0;
+}
+
+//um comando de uma transacao; as chaves sao keys[first..first+num-1]
+typedef struct TxnOp {
+  enum { TXN_READ, TXN_WRITE, TXN_DELETE } type;
+  size_t first;
+  size_t num;
+} TxnOp;
+
+struct Transaction {
+  TxnOp ops[TXN_MAX_KEYS];
+  size_t num_ops;
+  char keys[TXN_MAX_KEYS][MAX_STRING_SIZE];
+  char values[TXN_MAX_KEYS][MAX_STRING_SIZE]; //valor a escrever, ou lido
+  unsigned int ttls[TXN_MAX_KEYS];
+  uint64_t commits[TXN_MAX_KEYS]; //commit lido num READ, para validar
+  bool local[TXN_MAX_KEYS]; //o READ leu uma escrita da propria transacao
+  int missing[TXN_MAX_KEYS];
+  size_t num_keys;
+  bool failed; //um comando nao coube na transacao
+  //indice aberto das chaves escritas ou apagadas, pelo hash: cada entrada
+  //tem o indice (+1) da ultima escrita da chave, 0 se esta vazia
+  uint16_t write_index[TXN_INDEX_SIZE];
+  uint64_t hashes[TXN_MAX_KEYS]; //hash de cada chave escrita ou apagada
+};
+
+_Static_assert(TXN_MAX_KEYS < UINT16_MAX, "o indice das escritas usa uint16_t");
+
+Transaction *kvs_txn_begin() {
+  Transaction *txn = malloc(sizeof(Transaction));
+  if (txn == NULL) {
+    write_str(STDERR_FILENO, "Failed to allocate transaction\n");
+    return NULL;
+  }
+  txn->num_ops = 0;
+  txn->num_keys = 0;
+  txn->failed = false;
+  memset(txn->write_index, 0, sizeof(txn->write_index));
+  return txn;
+}
+
+//acrescenta um comando a transacao; se nao couber, a transacao so pode
+//abortar
+static TxnOp *txn_add(Transaction *txn, int type, size_t num_pairs,
+                      char keys[][MAX_STRING_SIZE]) {
+  if (txn->failed || txn->num_ops == TXN_MAX_KEYS ||
+      txn->num_keys + num_pairs > TXN_MAX_KEYS) {
+    if (!txn->failed) {
+      write_str(STDERR_FILENO, "Transaction has too many keys\n");
+    }
+    txn->failed = true;
+    return NULL;
+  }
+  TxnOp *op = &txn->ops[txn->num_ops++];
+  op->type = type;
+  op->first = txn->num_keys;
+  op->num = num_pairs;
+  memcpy(txn->keys[op->first], keys, num_pairs * MAX_STRING_SIZE);
+  txn->num_keys += num_pairs;
+  return op;
+}
+
+//poe a escrita ou remocao da chave k no indice, no lugar de uma anterior
+//da mesma chave
+static void txn_index_write(Transaction *txn, size_t k) {
+  uint64_t h = hash(txn->keys[k]);
+  txn->hashes[k] = h;
+  //o indice tem o dobro das entradas das chaves, por isso ha sempre uma vazia
+  for (size_t pos = h & (TXN_INDEX_SIZE - 1);;
+       pos = (pos + 1) & (TXN_INDEX_SIZE - 1)) {
+    size_t slot = txn->write_index[pos];
+    if (slot == 0 || (txn->hashes[slot - 1] == h &&
+                      strcmp(txn->keys[slot - 1], txn->keys[k]) == 0)) {
+      txn->write_index[pos] = (uint16_t)(k + 1);
+      return;
+    }
+  }
+}
+
+//procura a ultima escrita ou remocao de key feita pela transacao ate agora;
+//retorna o indice da chave, ou -1
+static long txn_find_write(Transaction *txn, const char *key) {
+  uint64_t h = hash(key);
+  for (size_t pos = h & (TXN_INDEX_SIZE - 1);;
+       pos = (pos + 1) & (TXN_INDEX_SIZE - 1)) {
+    size_t slot = txn->write_index[pos];
+    if (slot == 0) {
+      return -1;
+    }
+    if (txn->hashes[slot - 1] == h && strcmp(txn->keys[slot - 1], key) == 0) {
+      return (long)slot - 1;
+    }
+  }
+}
+
+//le da tabela as chaves do READ op_index que a transacao nao escreveu antes,
+//guardando o commit lido para o COMMIT validar
+static void txn_read_table(Transaction *txn, size_t op_index) {
+  TxnOp *op = &txn->ops[op_index];
+  KeyLocks locks;
+  keylocks_clear(&locks);
+  bool table_reads = false;
+  for (size_t k = op->first; k < op->first + op->num; k++) {
+    if (!txn->local[k]) {
+      keylocks_add(&locks, txn->keys[k]);
+      table_reads = true;
+    }
+  }
+  if (!table_reads) {
+    return;
+  }
+  //o valor e o commit leem-se juntos, com as stripes bloqueadas
+  keylocks_lock(&locks, false);
+  for (size_t k = op->first; k < op->first + op->num; k++) {
+    if (!txn->local[k]) {
+      HashTable *ht = table_of(txn->keys[k]);
+      txn->missing[k] = read_pair(ht, txn->keys[k], txn->values[k],
+                                  MAX_STRING_SIZE, SNAPSHOT_LATEST);
+      txn->commits[k] = pair_commit(ht, txn->keys[k], SNAPSHOT_LATEST);
+    }
+  }
+  keylocks_unlock(&locks);
+}
+
+//le as chaves do ultimo comando (um READ): as escritas pela propria
+//transacao leem-se do log, as outras da tabela
+static void txn_resolve_read(Transaction *txn) {
+  size_t op_index = txn->num_ops - 1;
+  TxnOp *op = &txn->ops[op_index];
+  for (size_t k = op->first; k < op->first + op->num; k++) {
+    long w = txn_find_write(txn, txn->keys[k]);
+    txn->local[k] = w >= 0;
+    if (w >= 0) {
+      txn->missing[k] = txn->missing[w]; //as remocoes tem missing a 1
+      strcpy(txn->values[k], txn->values[w]);
+    }
+  }
+  txn_read_table(txn, op_index);
+}
+
+int kvs_txn_read(Transaction *txn, size_t num_pairs,
+                 char keys[][MAX_STRING_SIZE]) {
+  if (kvs_table == NULL) {
+    write_str(STDERR_FILENO, "KVS state must be initialized\n");
+    return 1;
+  }
+
+  if (txn_add(txn, TXN_READ, num_pairs, keys) == NULL) {
+    return 1;
+  }
+  shard_sync();
+  txn_resolve_read(txn);
+  return 0;
+}
+
+int kvs_txn_write(Transaction *txn, size_t num_pairs,
+                  char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE],
+                  unsigned int ttls[]) {
+  TxnOp *op = txn_add(txn, TXN_WRITE, num_pairs, keys);
+  if (op == NULL) {
+    return 1;
+  }
+  memcpy(txn->values[op->first], values, num_pairs * MAX_STRING_SIZE);
+  memcpy(&txn->ttls[op->first], ttls, num_pairs * sizeof(unsigned int));
+  memset(&txn->missing[op->first], 0, num_pairs * sizeof(int));
+  for (size_t k = op->first; k < op->first + num_pairs; k++) {
+    txn_index_write(txn, k);
+  }
+  return 0;
+}
+
+int kvs_txn_delete(Transaction *txn, size_t num_pairs,
+                   char keys[][MAX_STRING_SIZE]) {
+  TxnOp *op = txn_add(txn, TXN_DELETE, num_pairs, keys);
+  if (op == NULL) {
+    return 1;
+  }
+  for (size_t k = op->first; k < op->first + num_pairs; k++) {
+    txn->values[k][0] = '\0';
+    txn->missing[k] = 1;
+    txn_index_write(txn, k);
+  }
+  return 0;
+}
+
+void kvs_txn_abort(Transaction *txn) {
+  free(txn);
+}
+
+//confirma, com as stripes bloqueadas, que nenhuma chave lida da tabela
+//mudou desde a leitura
+static bool txn_validate(Transaction *txn) {
+  for (size_t i = 0; i < txn->num_ops; i++) {
+    TxnOp *op = &txn->ops[i];
+    if (op->type != TXN_READ) {
+      continue;
+    }
+    for (size_t k = op->first; k < op->first + op->num; k++) {
+      if (!txn->local[k] &&
+          pair_commit(table_of(txn->keys[k]), txn->keys[k], SNAPSHOT_LATEST) !=
+              txn->commits[k]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+//aplica os comandos da transacao por ordem, com as stripes bloqueadas; a
+//saida dos READ e dos DELETE fica no buffer, uma linha por comando
+static void txn_apply(Transaction *txn, const uint64_t deadlines[],
+                      uint64_t commit, OutBuf *out) {
+  for (size_t i = 0; i < txn->num_ops; i++) {
+    TxnOp *op = &txn->ops[i];
+    size_t start = out->len;
+    for (size_t k = op->first; k < op->first + op->num; k++) {
+      const char *text = NULL;
+      if (op->type == TXN_READ) {
+        text = txn->missing[k] ? "KVSERROR" : txn->values[k];
+      } else if (op->type == TXN_DELETE) {
+        if (delete_pair(table_of(txn->keys[k]), txn->keys[k], commit) != 0) {
+          text = "KVSMISSING";
+        }
+      } else if (write_pair(table_of(txn->keys[k]), txn->keys[k],
+                            txn->values[k], deadlines[k], commit) != 0) {
+        write_failed(txn->keys[k], txn->values[k]);
+      }
+      if (text != NULL) {
+        outbuf_write(out, out->len == start ? "[(" : "(",
+                     out->len == start ? 2 : 1);
+        outbuf_str(out, txn->keys[k]);
+        outbuf_write(out, ",", 1);
+        outbuf_str(out, text);
+        outbuf_write(out, ")", 1);
+      }
+    }
+    if (out->len > start) {
+      outbuf_write(out, "]\n", 2);
+    }
+  }
+}
+
+int kvs_txn_commit(Transaction *txn, int fd) {
+  if (kvs_table == NULL) {
+    write_str(STDERR_FILENO, "KVS state must be initialized\n");
+    kvs_txn_abort(txn);
+    return 1;
+  }
+
+  //bloqueia as stripes de todas as chaves, lidas e escritas, so durante a
+  //validacao e a aplicacao; se alguem escreveu uma chave lida, volta a ler
+  //tudo sem locks de escrita e tenta de novo
+  shard_sync();
+  uint64_t deadlines[TXN_MAX_KEYS];
+  size_t num_writes = 0;
+  bool deletes = false;
+  for (size_t k = 0; k < txn->num_keys; k++) {
+    deadlines[k] = 0;
+  }
+  for (size_t i = 0; i < txn->num_ops; i++) {
+    TxnOp *op = &txn->ops[i];
+    deletes |= op->type == TXN_DELETE;
+    if (op->type != TXN_WRITE) {
+      continue;
+    }
+    num_writes += op->num;
+    for (size_t k = op->first; k < op->first + op->num; k++) {
+      deadlines[k] = txn->ttls[k] > 0 ? timer_deadline(txn->ttls[k]) : 0;
+    }
+  }
+
+  KeyLocks locks;
+  bool valid = !txn->failed;
+  for (int tentativa = 0; valid; tentativa++) {
+    lock_keys(&locks, txn->num_keys, txn->keys, true);
+    if (txn_validate(txn)) {
+      break;
+    }
+    keylocks_unlock(&locks);
+    if (tentativa == TXN_MAX_RETRIES) {
+      valid = false;
+      break;
+    }
+    atomic_fetch_add(&txn_retries, 1);
+    //as chaves que cada READ leu do log nao mudam; so as da tabela
+    for (size_t i = 0; i < txn->num_ops; i++) {
+      if (txn->ops[i].type == TXN_READ) {
+        txn_read_table(txn, i);
       }
-      char str[MAX_STRING_SIZE];
-      snprintf(str, MAX_STRING_SIZE, "(%s,KVSMISSING)", keys[i]);
-      write_str(fd, str);
     }
   }
-  if (aux) {
-    write_str(fd, "]\n");
+  if (!valid) {
+    atomic_fetch_add(&txn_aborts, 1);
+    write_str(fd, "[(COMMIT,KVSABORTED)]\n");
+    kvs_txn_abort(txn);
+    return 1;
   }
 
-  pthread_rwlock_unlock(&kvs_table->tablelock);
+  uint64_t commit = commit_begin(kvs_table);
+  OutBuf *out = outbuf_begin(fd);
+  txn_apply(txn, deadlines, commit, out);
+  keylocks_unlock(&locks);
+  commit_end(kvs_table, commit);
+  atomic_fetch_add(&txn_commits, 1);
+  if (out->len > 0) {
+    outbuf_flush(out);
+  }
+  schedule_expiries(txn->num_keys, txn->keys, deadlines);
+  kvs_txn_abort(txn);
+  after_writes(&locks, num_writes, deletes);
   return 0;
 }
 
+//acrescenta um par no formato do SHOW ao buffer passado em arg
+static void show_pair(KeyNode *keyNode, const ValueVersion *version, void *arg) {
+  OutBuf *out = arg;
+  outbuf_write(out, "(", 1);
+  outbuf_write(out, keyNode->key, keyNode->key_len);
+  outbuf_write(out, ", ", 2);
+  outbuf_write(out, version->value, version->value_len);
+  outbuf_write(out, ")\n", 2);
+}
+
+//acrescenta os pares de um shard ao buffer; percorre a tabela sem locks com
+//as versoes do snapshot, por isso um SHOW longo nao para as escritas, e so
+//recomeca se um rehash mudar pares de lista a meio
+static void show_shard(HashTable *ht, uint64_t snapshot, OutBuf *out) {
+  size_t start = out->len;
+  unsigned seqs[NUM_STRIPES];
+  bool consistente = false;
+  for (int tentativa = 0; tentativa < READ_RETRIES && !consistente;
+       tentativa++) {
+    if (!read_stripes_begin(ht, UINT64_MAX, seqs)) {
+      break;
+    }
+    out->len = start;
+    epoch_enter();
+    foreach_pair(ht, snapshot, show_pair, out);
+    epoch_exit();
+    consistente = read_stripes_validate(ht, UINT64_MAX, seqs);
+  }
+  if (!consistente) {
+    out->len = start;
+    lock_stripes(ht, UINT64_MAX, false);
+    foreach_pair(ht, snapshot, show_pair, out);
+    unlock_stripes(ht, UINT64_MAX);
+  }
+}
+
 void kvs_show(int fd) {
   if (kvs_table == NULL) {
     write_str(STDERR_FILENO, "KVS state must be initialized\n");
     return;
   }
 
-  pthread_rwlock_rdlock(&kvs_table->tablelock);
+  //todos os shards sao lidos com o mesmo snapshot; o write (que pode ser
+  //lento) e feito no fim
+  shard_sync();
+  OutBuf *out = outbuf_begin(fd);
+  uint64_t snapshot = snapshot_begin(&kvs_table->clock->visible_commit);
+  for (size_t shard = 0; shard < num_shards; shard++) {
+    show_shard(kvs_shards[shard], snapshot, out);
+  }
+  snapshot_end();
+  outbuf_flush(out);
+}
+
+void kvs_show_page(uint64_t cursor, size_t count, int fd) {
+  if (kvs_table == NULL) {
+    write_str(STDERR_FILENO, "KVS state must be initialized\n");
+    return;
+  }
+
+  //no modo particionado os bits altos do cursor dizem o shard; quando um
+  //shard acaba, o cursor passa para o inicio do seguinte
+  shard_sync();
+  OutBuf *out = outbuf_begin(fd);
+  size_t shard = (size_t)(cursor >> SHARD_CURSOR_SHIFT);
+  if (shard < num_shards) {
+    cursor = scan_table(kvs_shards[shard],
+                        cursor & ((1ULL << SHARD_CURSOR_SHIFT) - 1), count,
+                        show_pair, out);
+    if (cursor != 0) {
+      cursor |= (uint64_t)shard << SHARD_CURSOR_SHIFT;
+    } else if (shard + 1 < num_shards) {
+      cursor = (uint64_t)(shard + 1) << SHARD_CURSOR_SHIFT;
+    }
+  } else {
+    cursor = 0;
+  }
+  char aux[40];
+  snprintf(aux, sizeof(aux), "[(cursor,%llu)]\n", (unsigned long long)cursor);
+  outbuf_str(out, aux);
+  outbuf_flush(out);
+}
+
+//par de um SCAN ou PREFIX com varios shards
+typedef struct ScanItem {
+  char key[MAX_STRING_SIZE];
+  char value[MAX_STRING_SIZE];
+} ScanItem;
+
+//estado de um SCAN ou PREFIX
+typedef struct ScanArgs {
+  OutBuf *out; //onde escreve os pares
+  const char *to; //ultima chave do SCAN, NULL no PREFIX
+  const char *prefix; //prefixo do PREFIX, NULL no SCAN
+  size_t prefix_len;
+  ScanItem *items; //pares guardados no modo particionado, para ordenar
+  size_t num_items;
+  size_t items_capacity;
+} ScanArgs;
+
+static void scan_out(OutBuf *out, const char *key, const char *value) {
+  outbuf_write(out, "(", 1);
+  outbuf_str(out, key);
+  outbuf_write(out, ",", 1);
+  outbuf_str(out, value);
+  outbuf_write(out, ")", 1);
+}
+
+//escreve (ou guarda, no modo particionado) um par do SCAN/PREFIX; retorna
+//false quando passa do fim do intervalo (as chaves vem por ordem)
+static bool scan_pair(const char *key, const char *value, void *arg) {
+  ScanArgs *scan = arg;
+  if (scan->to != NULL && strcmp(key, scan->to) > 0) {
+    return false;
+  }
+  if (scan->prefix != NULL && strncmp(key, scan->prefix, scan->prefix_len) != 0) {
+    return false;
+  }
+  if (num_shards == 1) {
+    scan_out(scan->out, key, value);
+    return true;
+  }
+  if (scan->num_items == scan->items_capacity) {
+    size_t capacity = scan->items_capacity > 0 ? scan->items_capacity * 2 : 64;
+    ScanItem *items = realloc(scan->items, capacity * sizeof(ScanItem));
+    if (items == NULL) {
+      write_str(STDERR_FILENO, "Failed to allocate scan buffer\n");
+      return false;
+    }
+    scan->items = items;
+    scan->items_capacity = capacity;
+  }
+  ScanItem *item = &scan->items[scan->num_items++];
+  strncpy(item->key, key, MAX_STRING_SIZE - 1);
+  item->key[MAX_STRING_SIZE - 1] = '\0';
+  strncpy(item->value, value, MAX_STRING_SIZE - 1);
+  item->value[MAX_STRING_SIZE - 1] = '\0';
+  return true;
+}
+
+static int compare_items(const void *a, const void *b) {
+  return strcmp(((const ScanItem *)a)->key, ((const ScanItem *)b)->key);
+}
+
+//percorre os pares a partir de from com um snapshot; com varios shards
+//cada um tem o seu indice ordenado, por isso os pares de todos sao juntos e
+//ordenados antes de serem escritos
+static void scan_shards(ScanArgs *scan, const char *from) {
+  shard_sync();
+  outbuf_write(scan->out, "[", 1);
+  uint64_t snapshot = snapshot_begin(&kvs_table->clock->visible_commit);
+  for (size_t shard = 0; shard < num_shards; shard++) {
+    scan_pairs(kvs_shards[shard], from, snapshot, scan_pair, scan);
+  }
+  snapshot_end();
+  if (scan->num_items > 0) {
+    qsort(scan->items, scan->num_items, sizeof(ScanItem), compare_items);
+    for (size_t i = 0; i < scan->num_items; i++) {
+      scan_out(scan->out, scan->items[i].key, scan->items[i].value);
+    }
+  }
+  free(scan->items);
+  outbuf_write(scan->out, "]\n", 2);
+  outbuf_flush(scan->out);
+}
+
+int kvs_scan(const char *from, const char *to, int fd) {
+  if (kvs_table == NULL) {
+    write_str(STDERR_FILENO, "KVS state must be initialized\n");
+    return 1;
+  }
+
+  ScanArgs scan = {outbuf_begin(fd), to, NULL, 0, NULL, 0, 0};
+  scan_shards(&scan, from);
+  return 0;
+}
+
+int kvs_prefix(const char *prefix, int fd) {
+  if (kvs_table == NULL) {
+    write_str(STDERR_FILENO, "KVS state must be initialized\n");
+    return 1;
+  }
+
+  //as chaves com o prefixo sao todas seguidas, a comecar no proprio prefixo
+  ScanArgs scan = {outbuf_begin(fd), NULL, prefix, strlen(prefix), NULL, 0, 0};
+  scan_shards(&scan, prefix);
+  return 0;
+}
+
+//escreve um par no ficheiro de backup passado em arg
+static void backup_pair(KeyNode *keyNode, const ValueVersion *version,
+                        void *arg) {
+  // functions used here have to be async signal safe, since this
+  // runs in the forked child (see kvs_backup)
+  int fd = *(int *)arg;
   char aux[MAX_STRING_SIZE];
+  aux[0] = '(';
+  size_t num_bytes_copied = 1; // the "("
+  // the - 1 are all to leave space for the '/0'
+  num_bytes_copied += strn_memcpy(aux + num_bytes_copied, keyNode->key,
+                                  MAX_STRING_SIZE - num_bytes_copied - 1);
+  num_bytes_copied += strn_memcpy(aux + num_bytes_copied, ", ",
+                                  MAX_STRING_SIZE - num_bytes_copied - 1);
+  num_bytes_copied += strn_memcpy(aux + num_bytes_copied, version->value,
+                                  MAX_STRING_SIZE - num_bytes_copied - 1);
+  num_bytes_copied += strn_memcpy(aux + num_bytes_copied, ")\n",
+                                  MAX_STRING_SIZE - num_bytes_copied - 1);
+  aux[num_bytes_copied] = '\0';
+  write_str(fd, aux);
+}
 
-  for (int i = 0; i < TABLE_SIZE; i++) {
-    KeyNode *keyNode = kvs_table->table[i]; // Get the next list head
-    while (keyNode != NULL) {
-      snprintf(aux, MAX_STRING_SIZE, "(%s, %s)\n", keyNode->key,
-               keyNode->value);
-      write_str(fd, aux);
-      keyNode = keyNode->next; // Move to the next node of the list
+void kvs_stats(int fd) {
+  if (kvs_table == NULL) {
+    write_str(STDERR_FILENO, "KVS state must be initialized\n");
+    return;
+  }
+
+  //no modo particionado os contadores sao a soma dos shards
+  shard_sync();
+  size_t pairs = 0, mem_used = 0, mem_budget = 0, evictions = 0;
+  size_t versions_freed = 0, tombstones = 0;
+  size_t bloom_size = 0, checks = 0, negatives = 0, false_positives = 0;
+  for (size_t i = 0; i < num_shards; i++) {
+    HashTable *ht = kvs_shards[i];
+    pairs += atomic_load(&ht->count);
+    mem_used += atomic_load(&ht->mem_used);
+    mem_budget += ht->mem_budget;
+    evictions += atomic_load(&ht->evictions);
+    versions_freed += atomic_load(&ht->versions_freed);
+    pthread_mutex_lock(&ht->tombstones_lock);
+    tombstones += ht->num_tombstones;
+    pthread_mutex_unlock(&ht->tombstones_lock);
+    if (ht->bloom != NULL) {
+      size_t c, n, fp;
+      bloom_get_stats(ht->bloom, &c, &n, &fp);
+      bloom_size += ht->bloom->num_blocks * BLOOM_BLOCK_SIZE;
+      checks += c;
+      negatives += n;
+      false_positives += fp;
     }
   }
 
-  pthread_rwlock_unlock(&kvs_table->tablelock);
+  size_t allocs, frees;
+  get_alloc_stats(&allocs, &frees);
+  char aux[128];
+  snprintf(aux, sizeof(aux), "[(pairs,%zu)(allocs,%zu)(frees,%zu)]\n",
+           pairs, allocs, frees);
+  write_str(fd, aux);
+  if (kvs_table->bloom != NULL) {
+    //hit_rate: percentagem das procuras respondidas so pelo filtro
+    snprintf(aux, sizeof(aux),
+             "[(bloom,%zu)(checks,%zu)(negatives,%zu)(false_positives,%zu)"
+             "(hit_rate,%zu%%)]\n",
+             bloom_size, checks, negatives, false_positives,
+             checks > 0 ? negatives * 100 / checks : 0);
+    write_str(fd, aux);
+  }
+  if (mem_budget > 0) {
+    snprintf(aux, sizeof(aux), "[(memory,%zu)(budget,%zu)(evictions,%zu)]\n",
+             mem_used, mem_budget, evictions);
+    write_str(fd, aux);
+  }
+  snprintf(aux, sizeof(aux),
+           "[(commit,%llu)(versions_freed,%zu)(tombstones,%zu)]\n",
+           (unsigned long long)atomic_load(&kvs_table->clock->visible_commit),
+           versions_freed, tombstones);
+  write_str(fd, aux);
+  snprintf(aux, sizeof(aux),
+           "[(txn_commits,%zu)(txn_retries,%zu)(txn_aborts,%zu)]\n",
+           atomic_load(&txn_commits), atomic_load(&txn_retries),
+           atomic_load(&txn_aborts));
+  write_str(fd, aux);
+  //coalesced: WRITE juntos pelo otimizador dos jobs a WRITE anteriores
+  snprintf(aux, sizeof(aux),
+           "[(coalesced,%zu)(locks_saved,%zu)(dead_writes,%zu)]\n",
+           atomic_load(&coalesced), atomic_load(&locks_saved),
+           atomic_load(&dead_writes));
+  write_str(fd, aux);
+  //notify_coalesced: valores trocados por um mais recente antes de sairem;
+  //notify_stalls: vezes que o pipe de um cliente estava cheio
+  size_t notified, notify_coalesced, notify_dropped, notify_stalls;
+  notify_get_stats(&notified, &notify_coalesced, &notify_dropped,
+                   &notify_stalls);
+  snprintf(aux, sizeof(aux),
+           "[(notified,%zu)(notify_coalesced,%zu)(notify_dropped,%zu)"
+           "(notify_stalls,%zu)]\n",
+           notified, notify_coalesced, notify_dropped, notify_stalls);
+  write_str(fd, aux);
+  //deferred: deletes cujos subscritores foram notificados pelo reclaimer
+  size_t deferred, deferred_pending;
+  reclaim_get_stats(&deferred, &deferred_pending);
+  snprintf(aux, sizeof(aux), "[(deferred,%zu)(deferred_pending,%zu)]\n",
+           deferred, deferred_pending);
+  write_str(fd, aux);
+  if (num_shards > 1) {
+    //queued/batches: escritas aplicadas de cada vez pelas threads donas
+    size_t batches, queued;
+    shard_get_stats(&batches, &queued);
+    snprintf(aux, sizeof(aux), "[(shards,%zu)(batches,%zu)(queued,%zu)]\n",
+             num_shards, batches, queued);
+    write_str(fd, aux);
+  }
+  pool_write_stats(fd);
 }
 
 int kvs_backup(size_t num_backup, char *job_filename, char *directory) {
@@ -149,32 +1356,22 @@ int kvs_backup(size_t num_backup, char *job_filename, char *directory) {
   snprintf(bck_name, sizeof(bck_name), "%s/%s-%ld.bck", directory,
            strtok(job_filename, "."), num_backup);
 
-  pthread_rwlock_rdlock(&kvs_table->tablelock);
+  //com todos os shards bloqueados (por ordem) o filho ve um estado em que
+  //nenhum lote esta a meio
+  shard_sync();
+  KeyLocks locks;
+  for (size_t i = 0; i < num_shards; i++) {
+    locks.stripes[i] = UINT64_MAX;
+  }
+  keylocks_lock(&locks, false);
   pid = fork();
-  pthread_rwlock_unlock(&kvs_table->tablelock);
+  keylocks_unlock(&locks);
   if (pid == 0) {
     // functions used here have to be async signal safe, since this
     // fork happens in a multi thread context (see man fork)
     int fd = open(bck_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-    for (int i = 0; i < TABLE_SIZE; i++) {
-      KeyNode *keyNode = kvs_table->table[i]; // Get the next list head
-      while (keyNode != NULL) {
-        char aux[MAX_STRING_SIZE];
-        aux[0] = '(';
-        size_t num_bytes_copied = 1; // the "("
-        // the - 1 are all to leave space for the '/0'
-        num_bytes_copied += strn_memcpy(aux + num_bytes_copied, keyNode->key,
-                                        MAX_STRING_SIZE - num_bytes_copied - 1);
-        num_bytes_copied += strn_memcpy(aux + num_bytes_copied, ", ",
-                                        MAX_STRING_SIZE - num_bytes_copied - 1);
-        num_bytes_copied += strn_memcpy(aux + num_bytes_copied, keyNode->value,
-                                        MAX_STRING_SIZE - num_bytes_copied - 1);
-        num_bytes_copied += strn_memcpy(aux + num_bytes_copied, ")\n",
-                                        MAX_STRING_SIZE - num_bytes_copied - 1);
-        aux[num_bytes_copied] = '\0';
-        write_str(fd, aux);
-        keyNode = keyNode->next; // Move to the next node of the list
-      }
+    for (size_t i = 0; i < num_shards; i++) {
+      foreach_pair(kvs_shards[i], SNAPSHOT_LATEST, backup_pair, &fd);
     }
     exit(1);
   } else if (pid < 0) {
@@ -211,13 +1408,15 @@ int addSubscriber(Cliente *cliente, char *key){
       write_str(STDERR_FILENO, "KVS state must be initialized\n");
       return 1;
     }
-    pthread_rwlock_rdlock(&kvs_table->tablelock); //da lock a hashtable
-    if(addSubscription(kvs_table,cliente, key)!=0){ //adiciona a subscricao
+    HashTable *ht = table_of(key);
+    uint64_t stripe = stripe_bit(key);
+    lock_stripes(ht, stripe, true); //da lock a stripe da chave
+    if(addSubscription(ht,cliente, key)!=0){ //adiciona a subscricao
       //deu erro
-      pthread_rwlock_unlock(&kvs_table->tablelock); //da unlock a hashtable
+      unlock_stripes(ht, stripe); //da unlock a stripe
       return 1;
     }
-    pthread_rwlock_unlock(&kvs_table->tablelock); //da unlock a hashtable
+    unlock_stripes(ht, stripe); //da unlock a stripe
     return 0;
   }
   return 1;
@@ -231,32 +1430,49 @@ int removeSubscriber(Cliente *cliente, char *key){
       write_str(STDERR_FILENO, "KVS state must be initialized\n");
       return 1;
     }
-    pthread_rwlock_rdlock(&kvs_table->tablelock); //da lock a hashtable
-    if(removeSubscription(cliente, key)!=0){ //remove a subscricao
-      //deu erro
-      pthread_rwlock_unlock(&kvs_table->tablelock); //da unlock a hashtable
-      return 1;
-    }
-    pthread_rwlock_unlock(&kvs_table->tablelock); //da unlock a hashtable
-    return 0;
+    HashTable *ht = table_of(key);
+    uint64_t stripe = stripe_bit(key);
+    lock_stripes(ht, stripe, true); //da lock a stripe da chave
+    int result = removeSubscription(ht, cliente, key); //remove a subscricao
+    unlock_stripes(ht, stripe); //da unlock a stripe
+    return result;
   }
   return 1;
 }
 
 //disconecta um cliente, apagando todas as suas subscricoes
 int disconnectClient(Cliente *cliente){
-  Subscriptions *subscricao_atual = cliente->head_subscricoes;
-  //remover todas as suas subscricoes 
-  while (subscricao_atual!=NULL){
-    //tem pelo menos uma subscricao
-    KeyNode *par = subscricao_atual->par;
-    char *key = par->key;
-    subscricao_atual = subscricao_atual->next; //tem de ser antes pq vai haver free no removeSubscription
-    if(removeSubscription(cliente, key)==1){ //remove a subscricao
-      //deu erro a remover
-      return 1;
+  //remover todas as suas subscricoes, sempre a primeira
+  while (1){
+    //a stripe da chave tem de ser bloqueada antes do cliente, por isso copia
+    //a chave e larga o lock do cliente antes de remover
+    char key[MAX_STRING_SIZE + 1];
+    pthread_mutex_lock(&cliente->lock);
+    Subscriptions *subscricao_atual = cliente->head_subscricoes;
+    if (subscricao_atual == NULL) {
+      pthread_mutex_unlock(&cliente->lock);
+      return 0;
+    }
+    strncpy(key, subscricao_atual->par->key, MAX_STRING_SIZE);
+    key[MAX_STRING_SIZE] = '\0';
+    pthread_mutex_unlock(&cliente->lock);
+
+    HashTable *ht = table_of(key);
+    uint64_t stripe = stripe_bit(key);
+    lock_stripes(ht, stripe, true);
+    int result = removeFirstSubscription(cliente, subscricao_atual);
+    unlock_stripes(ht, stripe);
+    if (result == 1) {
+      //se o par foi apagado entretanto a subscricao e tirada pelo reclaimer,
+      //que ainda usa o cliente: espera por ele antes de ver se saiu
+      reclaim_sync();
+      pthread_mutex_lock(&cliente->lock);
+      bool removida = cliente->head_subscricoes != subscricao_atual;
+      pthread_mutex_unlock(&cliente->lock);
+      if (!removida) {
+        //deu erro a remover
+        return 1;
+      }
     }
-    //apagou uma das subscricoes
   }
-  return 0;
-}
\ No newline at end of file
+}
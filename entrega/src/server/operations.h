@@ -18,9 +18,127 @@ int kvs_terminate();
 /// @param num_pairs Number of pairs being written.
 /// @param keys Array of keys' strings.
 /// @param values Array of values' strings.
+/// @param ttls Array of TTLs in milliseconds; a pair with TTL 0 never expires.
 /// @return 0 if the pairs were written successfully, 1 otherwise.
 int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE],
-              char values[][MAX_STRING_SIZE]);
+              char values[][MAX_STRING_SIZE], unsigned int ttls[]);
+
+/// Adds delta to the integer value of a key, creating it with delta if it
+/// does not exist, and writes the new value ([(key,value)], or KVSERROR if
+/// the value is not an integer or overflows).
+/// @param key The key.
+/// @param delta Amount to add (may be negative).
+/// @param fd File descriptor to write the output.
+/// @return 0 if the command was executed, 1 otherwise.
+int kvs_incr(char *key, long long delta, int fd);
+
+/// Replaces the value of each key by the new one only if it currently holds
+/// the expected value. Writes the keys that were not replaced, with
+/// KVSMISSING or KVSMISMATCH.
+/// @param num_pairs Number of triples.
+/// @param keys Array of keys' strings.
+/// @param expected Array of expected values.
+/// @param values Array of new values.
+/// @param fd File descriptor to write the output.
+/// @return 0 if the command was executed, 1 otherwise.
+int kvs_cas(size_t num_pairs, char keys[][MAX_STRING_SIZE],
+            char expected[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE],
+            int fd);
+
+/// Appends a suffix to the value of each key, creating the keys that do not
+/// exist. Writes the keys whose value would become too long, with KVSERROR.
+/// @param num_pairs Number of pairs.
+/// @param keys Array of keys' strings.
+/// @param suffixes Array of suffixes.
+/// @param fd File descriptor to write the output.
+/// @return 0 if the command was executed, 1 otherwise.
+int kvs_append(size_t num_pairs, char keys[][MAX_STRING_SIZE],
+               char suffixes[][MAX_STRING_SIZE], int fd);
+
+/// Consecutive WRITE commands of a job file, merged into a single batch
+/// (one lock of the stripes and one commit) when the job optimizer is on.
+typedef struct WriteBatch WriteBatch;
+
+/// Starts buffering the WRITE commands of a job.
+/// @return The batch, or NULL if the optimizer is off or the batch could not
+/// be allocated (the writes are then applied one command at a time).
+WriteBatch *kvs_batch_begin();
+
+/// Adds a WRITE command to the batch, applying what was buffered first if
+/// the command does not fit.
+/// @param batch The batch.
+/// @param num_pairs Number of pairs being written.
+/// @param keys Array of keys' strings.
+/// @param values Array of values' strings.
+/// @param ttls Array of TTLs in milliseconds.
+/// @return 0 if successful, 1 if applying the buffered writes failed.
+int kvs_batch_write(WriteBatch *batch, size_t num_pairs,
+                    char keys[][MAX_STRING_SIZE],
+                    char values[][MAX_STRING_SIZE], unsigned int ttls[]);
+
+/// Applies the buffered writes as a single WRITE. Must be called before any
+/// other command of the job, so that it sees them. A pair written again later
+/// in the batch is skipped if its key has no subscribers, since nobody else
+/// could see it (the shard owner threads do the same with what they drain
+/// from their queues).
+/// @param batch The batch.
+/// @return 0 if successful, 1 otherwise.
+int kvs_batch_flush(WriteBatch *batch);
+
+/// Applies the buffered writes and frees the batch.
+/// @param batch The batch.
+/// @return 0 if successful, 1 otherwise.
+int kvs_batch_end(WriteBatch *batch);
+
+/// A transaction of a job file: the writes and deletes are buffered and
+/// applied together at commit, if no key the transaction read was written
+/// by someone else in the meantime.
+typedef struct Transaction Transaction;
+
+/// Starts a transaction.
+/// @return The transaction, or NULL if it could not be allocated.
+Transaction *kvs_txn_begin();
+
+/// Reads values inside a transaction. The values (seeing the transaction's
+/// own writes) are written only when it commits.
+/// @param txn The transaction.
+/// @param num_pairs Number of pairs to read.
+/// @param keys Array of keys' strings.
+/// @return 0 if the read was buffered, 1 if the transaction is too large.
+int kvs_txn_read(Transaction *txn, size_t num_pairs,
+                 char keys[][MAX_STRING_SIZE]);
+
+/// Buffers writes inside a transaction.
+/// @param txn The transaction.
+/// @param num_pairs Number of pairs being written.
+/// @param keys Array of keys' strings.
+/// @param values Array of values' strings.
+/// @param ttls Array of TTLs in milliseconds.
+/// @return 0 if the writes were buffered, 1 if the transaction is too large.
+int kvs_txn_write(Transaction *txn, size_t num_pairs,
+                  char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE],
+                  unsigned int ttls[]);
+
+/// Buffers deletes inside a transaction.
+/// @param txn The transaction.
+/// @param num_pairs Number of pairs to delete.
+/// @param keys Array of keys' strings.
+/// @return 0 if the deletes were buffered, 1 if the transaction is too large.
+int kvs_txn_delete(Transaction *txn, size_t num_pairs,
+                   char keys[][MAX_STRING_SIZE]);
+
+/// Validates the reads of a transaction and applies its writes and deletes
+/// atomically, retrying the reads on a conflict. Writes the output of its
+/// commands, or [(COMMIT,KVSABORTED)] if it still conflicts after the
+/// retries. Frees the transaction.
+/// @param txn The transaction.
+/// @param fd File descriptor to write the output.
+/// @return 0 if the transaction committed, 1 otherwise.
+int kvs_txn_commit(Transaction *txn, int fd);
+
+/// Discards a transaction without applying anything. Frees the transaction.
+/// @param txn The transaction.
+void kvs_txn_abort(Transaction *txn);
 
 /// Reads values from the KVS.
 /// @param num_pairs Number of pairs to read.
@@ -39,6 +157,33 @@ int kvs_delete(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fd);
 /// @param fd File descriptor to write the output.
 void kvs_show(int fd);
 
+/// Writes one page of the state of the KVS, followed by the cursor of the
+/// next page ([(cursor,0)] when the iteration is over). Only one stripe is
+/// locked at a time, and a cursor stays valid if the table grows.
+/// @param cursor 0 for the first page, otherwise the cursor of the last page.
+/// @param count Number of pairs after which the page ends.
+/// @param fd File descriptor to write the output.
+void kvs_show_page(uint64_t cursor, size_t count, int fd);
+
+/// Writes, in key order, the pairs whose keys are between from and to
+/// (both included).
+/// @param from First key of the range.
+/// @param to Last key of the range.
+/// @param fd File descriptor to write the output.
+/// @return 0 if the scan was done, 1 otherwise.
+int kvs_scan(const char *from, const char *to, int fd);
+
+/// Writes, in key order, the pairs whose keys start with prefix.
+/// @param prefix The prefix.
+/// @param fd File descriptor to write the output.
+/// @return 0 if the scan was done, 1 otherwise.
+int kvs_prefix(const char *prefix, int fd);
+
+/// Writes the KVS statistics (number of pairs, memory blocks allocated
+/// and freed by the table so far, and the usage of each object pool).
+/// @param fd File descriptor to write the output.
+void kvs_stats(int fd);
+
 /// Creates a backup of the KVS state and stores it in the correspondent
 /// backup file
 /// @return 0 if the backup was successful, 1 otherwise.
@@ -51,6 +196,43 @@ void kvs_wait_backup();
 /// @param delay_us Delay in milliseconds.
 void kvs_wait(unsigned int delay_ms);
 
+// Setter for the Bloom filter used for missing keys (before kvs_init)
+// @param counters Number of counters, 0 to not use a filter
+// @param hashes Number of counters set by each key
+void set_bloom_filter(size_t counters, unsigned hashes);
+
+// Setter for the ordered index of the keys (before kvs_init): a radix tree
+// with path compression instead of the skiplist; it only replaces the index
+// used by SCAN and PREFIX, the pairs (and their full keys) stay in the hash
+// table
+// @param enable true for the radix tree, false for the skiplist
+void set_radix_index(bool enable);
+
+// Setter for the memory budget of the table (before kvs_init); above it the
+// writes evict the least recently used pairs
+// @param bytes Budget in bytes, 0 for no limit
+void set_max_memory(size_t bytes);
+
+// Setter for the number of shards (before kvs_init); with more than one, the
+// store is split by key hash into independent tables, each with an owner
+// thread that applies the single-shard writes (write offload only: every
+// other command still runs in the calling thread under the stripe locks)
+// @param n Number of shards, 1 for a single table
+void set_shards(size_t n);
+
+// Setter for the job optimizer (before kvs_init): consecutive WRITE commands
+// of a job are merged into batches of up to max_pairs pairs
+// @param max_pairs Maximum pairs of a merged batch (up to MAX_WRITE_SIZE), 0
+// to run every command on its own
+void set_write_coalescing(size_t max_pairs);
+
+// Setter for the notification dispatch (before kvs_init): writes only queue
+// the notifications of each client and the notifier threads write them to
+// the pipes, so a client that does not read them never blocks a write
+// @param threads Number of notifier threads (up to MAX_NOTIFIERS), 0 to write
+// to the pipe inside the write, blocking on slow clients
+void set_notifiers(size_t threads);
+
 // Setter for max_backups
 // @param _max_backups
 void set_max_backups(int _max_backups);
@@ -1,5 +1,6 @@
 #include "parser.h"
 
+#include <errno.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
@@ -127,21 +128,137 @@ enum Command get_next(int fd) {
 
     return CMD_DELETE;
 
+  case 'I':
+    if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "INCR ", 5) != 0) {
+      cleanup(fd);
+      return CMD_INVALID;
+    }
+
+    return CMD_INCR;
+
+  case 'C':
+    if (read(fd, buf + 1, 1) != 1) {
+      return CMD_INVALID;
+    }
+
+    if (buf[1] == 'O') {
+      if (read(fd, buf + 2, 4) != 4 || strncmp(buf, "COMMIT", 6) != 0) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      if (read(fd, buf + 6, 1) != 0 && buf[6] != '\n') {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      return CMD_COMMIT;
+    }
+
+    if (read(fd, buf + 2, 2) != 2 || strncmp(buf, "CAS ", 4) != 0) {
+      cleanup(fd);
+      return CMD_INVALID;
+    }
+
+    return CMD_CAS;
+
+  case 'A':
+    if (read(fd, buf + 1, 1) != 1) {
+      return CMD_INVALID;
+    }
+
+    if (buf[1] == 'B') {
+      if (read(fd, buf + 2, 3) != 3 || strncmp(buf, "ABORT", 5) != 0) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      if (read(fd, buf + 5, 1) != 0 && buf[5] != '\n') {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      return CMD_ABORT;
+    }
+
+    if (read(fd, buf + 2, 5) != 5 || strncmp(buf, "APPEND ", 7) != 0) {
+      cleanup(fd);
+      return CMD_INVALID;
+    }
+
+    return CMD_APPEND;
+
   case 'S':
-    if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "SHOW", 4) != 0) {
+    if (read(fd, buf + 1, 1) != 1) {
+      return CMD_INVALID;
+    }
+
+    if (buf[1] == 'T') {
+      if (read(fd, buf + 2, 3) != 3 || strncmp(buf, "STATS", 5) != 0) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      if (read(fd, buf + 5, 1) != 0 && buf[5] != '\n') {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      return CMD_STATS;
+    }
+
+    if (buf[1] == 'C') {
+      if (read(fd, buf + 2, 3) != 3 || strncmp(buf, "SCAN ", 5) != 0) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      return CMD_SCAN;
+    }
+
+    if (read(fd, buf + 2, 2) != 2 || strncmp(buf, "SHOW", 4) != 0) {
       cleanup(fd);
       return CMD_INVALID;
     }
 
     if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
+      if (buf[4] == ' ') {
+        return CMD_SHOW_PAGE;
+      }
       cleanup(fd);
       return CMD_INVALID;
     }
 
     return CMD_SHOW;
 
+  case 'P':
+    if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "PREFIX ", 7) != 0) {
+      cleanup(fd);
+      return CMD_INVALID;
+    }
+
+    return CMD_PREFIX;
+
   case 'B':
-    if (read(fd, buf + 1, 5) != 5 || strncmp(buf, "BACKUP", 6) != 0) {
+    if (read(fd, buf + 1, 1) != 1) {
+      return CMD_INVALID;
+    }
+
+    if (buf[1] == 'E') {
+      if (read(fd, buf + 2, 3) != 3 || strncmp(buf, "BEGIN", 5) != 0) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      if (read(fd, buf + 5, 1) != 0 && buf[5] != '\n') {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      return CMD_BEGIN;
+    }
+
+    if (read(fd, buf + 2, 4) != 4 || strncmp(buf, "BACKUP", 6) != 0) {
       cleanup(fd);
       return CMD_INVALID;
     }
@@ -179,18 +296,27 @@ enum Command get_next(int fd) {
   }
 }
 
-// Parses a key value pair.
+// Parses a key value pair, with an optional TTL: (key,value) or
+// (key,value,ttl).
 // @param fd File decriptor to read from.
 // @param key Pointer where the key will be stored
 // @param value Pointer where the value will be stored
+// @param ttl Pointer where the TTL will be stored (0 if there is none)
 // @return 1 if successful, 0 otherwise.
-int parse_pair(int fd, char *key, char *value) {
+int parse_pair(int fd, char *key, char *value, unsigned int *ttl) {
   if (read_string(fd, key, MAX_STRING_SIZE) != 0) {
     cleanup(fd);
     return 0;
   }
 
-  if (read_string(fd, value, MAX_STRING_SIZE) != 1) {
+  int output = read_string(fd, value, MAX_STRING_SIZE);
+  if (output == 1) {
+    *ttl = 0;
+    return 1;
+  }
+
+  char ch;
+  if (output != 0 || read_uint(fd, ttl, &ch) != 0 || ch != ')') {
     cleanup(fd);
     return 0;
   }
@@ -199,8 +325,8 @@ int parse_pair(int fd, char *key, char *value) {
 }
 
 size_t parse_write(int fd, char keys[][MAX_STRING_SIZE],
-                   char values[][MAX_STRING_SIZE], size_t max_pairs,
-                   size_t max_string_size) {
+                   char values[][MAX_STRING_SIZE], unsigned int ttls[],
+                   size_t max_pairs, size_t max_string_size) {
   char ch;
 
   if (read(fd, &ch, 1) != 1 || ch != '[') {
@@ -217,7 +343,7 @@ size_t parse_write(int fd, char keys[][MAX_STRING_SIZE],
   char key[max_string_size];
   char value[max_string_size];
   while (num_pairs < max_pairs) {
-    if (parse_pair(fd, key, value) == 0) {
+    if (parse_pair(fd, key, value, &ttls[num_pairs]) == 0) {
       cleanup(fd);
       return 0;
     }
@@ -286,6 +412,142 @@ size_t parse_read_delete(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys,
   return num_keys;
 }
 
+// Reads a decimal number terminated by the given character.
+// @param fd File to read from.
+// @param value To store the number in.
+// @param end Character expected right after the number.
+// @return 0 if successful, -1 otherwise.
+static int read_number(int fd, unsigned long long *value, int end) {
+  char buf[24];
+  int output = read_string(fd, buf, sizeof(buf) - 1);
+  if (output != end || buf[0] < '0' || buf[0] > '9') {
+    return -1;
+  }
+
+  char *endptr;
+  *value = strtoull(buf, &endptr, 10);
+  return *endptr == '\0' ? 0 : -1;
+}
+
+int parse_incr(int fd, char *key, long long *delta) {
+  char ch;
+  char buf[24];
+
+  if (read(fd, &ch, 1) != 1 || ch != '[') {
+    cleanup(fd);
+    return -1;
+  }
+
+  if (read_string(fd, key, MAX_STRING_SIZE) != 0 ||
+      read_string(fd, buf, sizeof(buf) - 1) != 2) {
+    cleanup(fd);
+    return -1;
+  }
+
+  char *endptr;
+  errno = 0;
+  *delta = strtoll(buf, &endptr, 10);
+  if (errno != 0 || endptr == buf || *endptr != '\0') {
+    cleanup(fd);
+    return -1;
+  }
+
+  if (read(fd, &ch, 1) == 1 && ch != '\n') {
+    cleanup(fd);
+    return -1;
+  }
+
+  return 0;
+}
+
+// Parses a CAS triple: (key,expected,new).
+// @param fd File decriptor to read from.
+// @param key Pointer where the key will be stored
+// @param expected Pointer where the expected value will be stored
+// @param value Pointer where the new value will be stored
+// @return 1 if successful, 0 otherwise.
+static int parse_triple(int fd, char *key, char *expected, char *value) {
+  if (read_string(fd, key, MAX_STRING_SIZE) != 0 ||
+      read_string(fd, expected, MAX_STRING_SIZE) != 0 ||
+      read_string(fd, value, MAX_STRING_SIZE) != 1) {
+    return 0;
+  }
+
+  return 1;
+}
+
+size_t parse_cas(int fd, char keys[][MAX_STRING_SIZE],
+                 char expected[][MAX_STRING_SIZE],
+                 char values[][MAX_STRING_SIZE], size_t max_pairs) {
+  char ch;
+
+  if (read(fd, &ch, 1) != 1 || ch != '[') {
+    cleanup(fd);
+    return 0;
+  }
+
+  if (read(fd, &ch, 1) != 1 || ch != '(') {
+    cleanup(fd);
+    return 0;
+  }
+
+  size_t num_pairs = 0;
+  while (num_pairs < max_pairs) {
+    if (parse_triple(fd, keys[num_pairs], expected[num_pairs],
+                     values[num_pairs]) == 0) {
+      cleanup(fd);
+      return 0;
+    }
+    num_pairs++;
+
+    if (read(fd, &ch, 1) != 1 || (ch != '(' && ch != ']')) {
+      cleanup(fd);
+      return 0;
+    }
+
+    if (ch == ']') {
+      break;
+    }
+  }
+
+  if (num_pairs == max_pairs) {
+    cleanup(fd);
+    return 0;
+  }
+
+  if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
+    cleanup(fd);
+    return 0;
+  }
+
+  return num_pairs;
+}
+
+int parse_show_page(int fd, uint64_t *cursor, size_t *count) {
+  char ch;
+  unsigned long long aux_cursor, aux_count;
+
+  if (read(fd, &ch, 1) != 1 || ch != '[') {
+    cleanup(fd);
+    return -1;
+  }
+
+  if (read_number(fd, &aux_cursor, 0) != 0 ||
+      read_number(fd, &aux_count, 2) != 0 || aux_count == 0) {
+    cleanup(fd);
+    return -1;
+  }
+
+  if (read(fd, &ch, 1) == 1 && ch != '\n') {
+    cleanup(fd);
+    return -1;
+  }
+
+  *cursor = aux_cursor;
+  *count = aux_count;
+  return 0;
+}
+
 int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
   char ch;
 
@@ -2,6 +2,7 @@
 #define KVS_PARSER_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "constants.h"
 
@@ -9,7 +10,17 @@ enum Command {
   CMD_WRITE,
   CMD_READ,
   CMD_DELETE,
+  CMD_INCR,
+  CMD_CAS,
+  CMD_APPEND,
+  CMD_BEGIN,
+  CMD_COMMIT,
+  CMD_ABORT,
   CMD_SHOW,
+  CMD_SHOW_PAGE,
+  CMD_STATS,
+  CMD_SCAN,
+  CMD_PREFIX,
   CMD_WAIT,
   CMD_BACKUP,
   CMD_HELP,
@@ -24,17 +35,18 @@ enum Command {
 // @return enum Command Command code.
 enum Command get_next(int fd);
 
-/// Parses a WRITE command.
+/// Parses a WRITE command. Each pair may have a TTL: (key,value,ttl_ms).
 /// @param fd File descriptor to read from.
 /// @param keys Array to store the keys
 /// @param values Array to store the values
+/// @param ttls Array to store the TTLs in milliseconds (0 for no TTL)
 /// @param max_pairs Maximum number of pairs it will write.
 /// @param max_string_size Maximum string size allowed.
 /// @return 0 if the command was not parsed successfully, otherwise return the
 //          of pairs parsed.
 size_t parse_write(int fd, char keys[][MAX_STRING_SIZE],
-                   char values[][MAX_STRING_SIZE], size_t max_pairs,
-                   size_t max_string_size);
+                   char values[][MAX_STRING_SIZE], unsigned int ttls[],
+                   size_t max_pairs, size_t max_string_size);
 
 // Parses a READ or a DELETE command.
 // @param fd File descriptor to read from.
@@ -46,6 +58,32 @@ size_t parse_write(int fd, char keys[][MAX_STRING_SIZE],
 size_t parse_read_delete(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys,
                          size_t max_string_size);
 
+/// Parses an INCR command: [key,delta].
+/// @param fd File descriptor to read from.
+/// @param key Pointer where the key will be stored.
+/// @param delta Pointer to the variable to store the delta in.
+/// @return 0 if successful, -1 on error.
+int parse_incr(int fd, char *key, long long *delta);
+
+/// Parses a CAS command: [(key,expected,new)(key2,expected2,new2)...].
+/// @param fd File descriptor to read from.
+/// @param keys Array to store the keys
+/// @param expected Array to store the expected values
+/// @param values Array to store the new values
+/// @param max_pairs Maximum number of triples it will parse.
+/// @return 0 if the command was not parsed successfully, otherwise return the
+//          number of triples parsed.
+size_t parse_cas(int fd, char keys[][MAX_STRING_SIZE],
+                 char expected[][MAX_STRING_SIZE],
+                 char values[][MAX_STRING_SIZE], size_t max_pairs);
+
+/// Parses the arguments of a paged SHOW command: [cursor,count].
+/// @param fd File descriptor to read from.
+/// @param cursor Pointer to the variable to store the cursor in.
+/// @param count Pointer to the variable to store the page size in.
+/// @return 0 if successful, -1 on error.
+int parse_show_page(int fd, uint64_t *cursor, size_t *count);
+
 /// Parses a WAIT command.
 /// @param fd File descriptor to read from.
 /// @param delay Pointer to the variable to store the wait delay in.
@@ -0,0 +1,207 @@
+#include "pool.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "src/common/io.h"
+#include "thread_registry.h"
+
+//cabecalho de cada slab; os objetos vem logo a seguir
+typedef union SlabHeader {
+  void *next;
+  max_align_t align;
+} SlabHeader;
+
+//cache de uma thread para uma pool
+typedef struct PoolCache {
+  void *free; //objetos livres desta thread
+  size_t count; //num de objetos em free
+  char *slab_cur; //proximo objeto por usar do slab atual
+  char *slab_end;
+  atomic_size_t allocs; //so esta thread escreve; as stats leem
+  atomic_size_t frees;
+  atomic_size_t recycled; //alocacoes servidas por objetos ja usados
+} PoolCache;
+
+//caches de uma thread para todas as pools
+typedef struct ThreadPools {
+  ThreadRecord record; //tem de ser o primeiro membro
+  PoolCache caches[POOL_MAX];
+} ThreadPools;
+
+static Pool *pools[POOL_MAX]; //pools inicializadas, para as estatisticas
+static atomic_int num_pools = 0;
+//as caches de uma thread que terminou (e os objetos livres que la ficaram)
+//sao herdadas pela proxima thread
+static ThreadRegistry registry = THREAD_REGISTRY_INIT(
+    ThreadPools, NULL, NULL, "Failed to allocate pool caches\n");
+static _Thread_local ThreadPools *self = NULL;
+
+static ThreadPools *get_self(void) {
+  if (self == NULL) {
+    self = (ThreadPools *)thread_registry_acquire(&registry);
+  }
+  return self;
+}
+
+int pool_init(Pool *pool, const char *name, size_t obj_size) {
+  int id = atomic_fetch_add(&num_pools, 1);
+  if (id >= POOL_MAX) {
+    atomic_fetch_sub(&num_pools, 1);
+    write_str(STDERR_FILENO, "Too many pools\n");
+    return 1;
+  }
+  //cada objeto livre guarda o ponteiro para o seguinte
+  if (obj_size < sizeof(void *)) {
+    obj_size = sizeof(void *);
+  }
+  size_t align = _Alignof(max_align_t);
+  pool->name = name;
+  pool->obj_size = (obj_size + align - 1) / align * align;
+  pool->id = id;
+  pthread_mutex_init(&pool->lock, NULL);
+  pool->global_free = NULL;
+  pool->global_count = 0;
+  pool->slabs = NULL;
+  atomic_init(&pool->num_slabs, 0);
+  pools[id] = pool;
+  return 0;
+}
+
+//vai buscar um lote de objetos a lista global ou um slab novo
+//pool->lock e so tocado aqui e em flush_batch, uma vez por POOL_BATCH objetos
+static int refill(Pool *pool, PoolCache *cache) {
+  pthread_mutex_lock(&pool->lock);
+  if (pool->global_free != NULL) {
+    void *first = pool->global_free;
+    void *last = first;
+    size_t n = 1;
+    while (n < POOL_BATCH && *(void **)last != NULL) {
+      last = *(void **)last;
+      n++;
+    }
+    pool->global_free = *(void **)last;
+    pool->global_count -= n;
+    pthread_mutex_unlock(&pool->lock);
+    *(void **)last = cache->free;
+    cache->free = first;
+    cache->count += n;
+    return 0;
+  }
+  SlabHeader *slab = malloc(sizeof(SlabHeader) + POOL_SLAB_OBJECTS * pool->obj_size);
+  if (slab == NULL) {
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+  }
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+  pthread_mutex_unlock(&pool->lock);
+  atomic_fetch_add_explicit(&pool->num_slabs, 1, memory_order_relaxed);
+  cache->slab_cur = (char *)(slab + 1);
+  cache->slab_end = cache->slab_cur + POOL_SLAB_OBJECTS * pool->obj_size;
+  return 0;
+}
+
+//devolve um lote de objetos livres a lista global
+static void flush_batch(Pool *pool, PoolCache *cache) {
+  void *first = cache->free;
+  void *last = first;
+  for (size_t n = 1; n < POOL_BATCH; n++) {
+    last = *(void **)last;
+  }
+  cache->free = *(void **)last;
+  cache->count -= POOL_BATCH;
+  pthread_mutex_lock(&pool->lock);
+  *(void **)last = pool->global_free;
+  pool->global_free = first;
+  pool->global_count += POOL_BATCH;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void *pool_alloc(Pool *pool) {
+  PoolCache *cache = &get_self()->caches[pool->id];
+  if (cache->free == NULL && cache->slab_cur == cache->slab_end) {
+    if (refill(pool, cache) != 0) {
+      return NULL;
+    }
+  }
+  void *obj;
+  if (cache->free != NULL) {
+    obj = cache->free;
+    cache->free = *(void **)obj;
+    cache->count--;
+    atomic_store_explicit(&cache->recycled,
+        atomic_load_explicit(&cache->recycled, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+  } else {
+    obj = cache->slab_cur;
+    cache->slab_cur += pool->obj_size;
+  }
+  atomic_store_explicit(&cache->allocs,
+      atomic_load_explicit(&cache->allocs, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+  return obj;
+}
+
+void pool_free(Pool *pool, void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  PoolCache *cache = &get_self()->caches[pool->id];
+  *(void **)ptr = cache->free;
+  cache->free = ptr;
+  cache->count++;
+  atomic_store_explicit(&cache->frees,
+      atomic_load_explicit(&cache->frees, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+  if (cache->count >= 2 * POOL_BATCH) {
+    //esta thread liberta mais do que aloca: partilha com as outras
+    flush_batch(pool, cache);
+  }
+}
+
+void pool_destroy(Pool *pool) {
+  for (ThreadRecord *record = thread_registry_first(&registry);
+       record != NULL; record = record->next) {
+    PoolCache *cache = &((ThreadPools *)record)->caches[pool->id];
+    cache->free = NULL;
+    cache->count = 0;
+    cache->slab_cur = cache->slab_end = NULL;
+  }
+  SlabHeader *slab = pool->slabs;
+  while (slab != NULL) {
+    SlabHeader *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  pool->slabs = NULL;
+  pool->global_free = NULL;
+  pool->global_count = 0;
+  atomic_store(&pool->num_slabs, 0);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+void pool_write_stats(int fd) {
+  int n = atomic_load(&num_pools);
+  for (int id = 0; id < n && id < POOL_MAX; id++) {
+    Pool *pool = pools[id];
+    size_t allocs = 0, frees = 0, recycled = 0;
+    for (ThreadRecord *record = thread_registry_first(&registry);
+         record != NULL; record = record->next) {
+      ThreadPools *tp = (ThreadPools *)record;
+      allocs += atomic_load_explicit(&tp->caches[id].allocs, memory_order_relaxed);
+      frees += atomic_load_explicit(&tp->caches[id].frees, memory_order_relaxed);
+      recycled += atomic_load_explicit(&tp->caches[id].recycled, memory_order_relaxed);
+    }
+    char aux[160];
+    snprintf(aux, sizeof(aux),
+             "[(pool,%s)(slabs,%zu)(in_use,%zu)(allocs,%zu)(recycled,%zu)]\n",
+             pool->name, atomic_load(&pool->num_slabs),
+             allocs >= frees ? allocs - frees : 0, allocs, recycled);
+    write_str(fd, aux);
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef KVS_POOL_H
+#define KVS_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define POOL_MAX 8 // num max de pools no servidor
+#define POOL_SLAB_OBJECTS 256 // objetos por slab pedido ao malloc
+#define POOL_BATCH 64 // objetos trocados de uma vez com a lista global
+
+// Pool de objetos de tamanho fixo. Cada thread tem a sua lista de objetos
+// livres e o seu slab atual, por isso alocar e libertar e O(1) e nao passa
+// pelo malloc nem por locks; so quando uma thread tem objetos livres a mais
+// (ou a menos) troca um lote com a lista global da pool.
+typedef struct Pool {
+  const char *name; //nome mostrado nas estatisticas
+  size_t obj_size; //tamanho de cada objeto (alinhado)
+  int id; //indice da pool nas caches das threads
+  pthread_mutex_t lock; //protege a lista global e os slabs
+  void *global_free; //objetos livres devolvidos pelas threads
+  size_t global_count; //num de objetos na lista global
+  void *slabs; //lista de todos os slabs, para os libertar no fim
+  atomic_size_t num_slabs; //num de slabs alocados
+} Pool;
+
+/// @brief inicializa uma pool
+/// @param pool a pool
+/// @param name nome para as estatisticas
+/// @param obj_size tamanho dos objetos
+/// @return 0 se deu certo, 1 se ja ha POOL_MAX pools
+int pool_init(Pool *pool, const char *name, size_t obj_size);
+
+/// @brief aloca um objeto da pool
+/// @param pool a pool
+/// @return o objeto (nao inicializado), NULL se nao ha memoria
+void *pool_alloc(Pool *pool);
+
+/// @brief devolve um objeto a pool (pode ser de outra thread); NULL e ignorado
+/// @param pool a pool de onde o objeto foi alocado
+/// @param ptr o objeto
+void pool_free(Pool *pool, void *ptr);
+
+/// @brief liberta todos os slabs da pool; so pode ser chamada quando ja
+/// nenhuma thread usa a pool
+/// @param pool a pool
+void pool_destroy(Pool *pool);
+
+/// @brief escreve as estatisticas de todas as pools
+/// @param fd descritor onde escreve
+void pool_write_stats(int fd);
+
+#endif // KVS_POOL_H
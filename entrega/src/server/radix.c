@@ -0,0 +1,478 @@
+#include "radix.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "epoch.h"
+#include "kvs.h"
+
+#define RADIX_DENSE 256 // capacidade dos nos indexados pelo byte
+#define RADIX_SHRINK 40 // filhos abaixo dos quais um no de 256 passa a 48
+
+//no interior; as folhas sao ponteiros para os pares com o bit 0 a 1
+//as chaves acabam no '\0', que conta como mais um byte, por isso nenhuma
+//chave e prefixo de outra e o '\0' fica antes de todos os outros bytes
+typedef struct RadixNode {
+  uint16_t capacity; //4, 16, 48 ou RADIX_DENSE
+  uint16_t num_children; //filhos (nos esparsos nunca muda depois de publicado)
+  uint8_t prefix_len; //bytes que todas as chaves abaixo tem em comum
+  //prefixo, bytes dos filhos por ordem (so nos esparsos) e os filhos
+  unsigned char bytes[];
+} RadixNode;
+
+static bool is_leaf(const void *ref) {
+  return ((uintptr_t)ref & 1) != 0;
+}
+
+static KeyNode *leaf_par(const void *ref) {
+  return (KeyNode *)((uintptr_t)ref & ~(uintptr_t)1);
+}
+
+static void *make_leaf(KeyNode *par) {
+  return (void *)((uintptr_t)par | 1);
+}
+
+//posicao dos filhos dentro do no, alinhada para os ponteiros
+static size_t children_offset(size_t capacity, size_t prefix_len) {
+  size_t offset = sizeof(RadixNode) + prefix_len +
+                  (capacity == RADIX_DENSE ? 0 : capacity);
+  size_t align = _Alignof(_Atomic(void *));
+  return (offset + align - 1) & ~(align - 1);
+}
+
+static size_t node_size(size_t capacity, size_t prefix_len) {
+  return children_offset(capacity, prefix_len) +
+         capacity * sizeof(_Atomic(void *));
+}
+
+//bytes dos filhos de um no esparso
+static unsigned char *node_keys(RadixNode *node) {
+  return node->bytes + node->prefix_len;
+}
+
+static _Atomic(void *) *node_children(RadixNode *node) {
+  return (_Atomic(void *) *)(void *)((char *)node +
+                                     children_offset(node->capacity,
+                                                     node->prefix_len));
+}
+
+//capacidade de um no com num filhos
+static size_t capacity_for(size_t num) {
+  return num <= 4 ? 4 : num <= 16 ? 16 : num <= 48 ? 48 : RADIX_DENSE;
+}
+
+//cria um no sem filhos (ainda nao publicado)
+static RadixNode *new_node(RadixTree *tree, size_t capacity,
+                           const unsigned char *prefix, size_t prefix_len) {
+  size_t size = node_size(capacity, prefix_len);
+  RadixNode *node = malloc(size);
+  if (node == NULL) {
+    return NULL;
+  }
+  node->capacity = (uint16_t)capacity;
+  node->num_children = 0;
+  node->prefix_len = (uint8_t)prefix_len;
+  memcpy(node->bytes, prefix, prefix_len);
+  if (capacity == RADIX_DENSE) {
+    _Atomic(void *) *children = node_children(node);
+    for (size_t i = 0; i < RADIX_DENSE; i++) {
+      atomic_init(&children[i], NULL);
+    }
+  }
+  atomic_fetch_add(tree->mem_used, size);
+  return node;
+}
+
+//liberta um no que nunca foi publicado
+static void discard_node(RadixTree *tree, RadixNode *node) {
+  if (node != NULL) {
+    atomic_fetch_sub(tree->mem_used, node_size(node->capacity, node->prefix_len));
+    free(node);
+  }
+}
+
+//liberta por epocas um no que ja saiu da arvore (os filhos ficam)
+static void retire_node(RadixTree *tree, RadixNode *node) {
+  atomic_fetch_sub(tree->mem_used, node_size(node->capacity, node->prefix_len));
+  epoch_retire(node, free);
+}
+
+//acrescenta um filho a um no ainda nao publicado
+static void add_child(RadixNode *node, unsigned char byte, void *child) {
+  _Atomic(void *) *children = node_children(node);
+  if (node->capacity == RADIX_DENSE) {
+    atomic_init(&children[byte], child);
+  } else {
+    unsigned char *keys = node_keys(node);
+    size_t i = node->num_children;
+    for (; i > 0 && keys[i - 1] > byte; i--) {
+      keys[i] = keys[i - 1];
+      atomic_init(&children[i], atomic_load(&children[i - 1]));
+    }
+    keys[i] = byte;
+    atomic_init(&children[i], child);
+  }
+  node->num_children++;
+}
+
+//primeira posicao de um filho com byte >= byte
+static size_t first_pos(RadixNode *node, unsigned char byte) {
+  if (node->capacity == RADIX_DENSE) {
+    return byte;
+  }
+  unsigned char *keys = node_keys(node);
+  size_t pos = 0;
+  while (pos < node->num_children && keys[pos] < byte) {
+    pos++;
+  }
+  return pos;
+}
+
+//filho seguinte a partir da posicao *pos, por ordem dos bytes; guarda o
+//byte dele e avanca *pos. retorna NULL se ja nao ha filhos
+static void *next_child(RadixNode *node, size_t *pos, unsigned char *byte) {
+  _Atomic(void *) *children = node_children(node);
+  size_t end = node->capacity == RADIX_DENSE ? RADIX_DENSE : node->num_children;
+  for (; *pos < end; (*pos)++) {
+    void *child = atomic_load(&children[*pos]);
+    if (child != NULL) {
+      *byte = node->capacity == RADIX_DENSE ? (unsigned char)*pos
+                                            : node_keys(node)[*pos];
+      (*pos)++;
+      return child;
+    }
+  }
+  return NULL;
+}
+
+//ligacao para o filho com o byte, NULL se nao ha
+static _Atomic(void *) *find_child(RadixNode *node, unsigned char byte) {
+  _Atomic(void *) *children = node_children(node);
+  if (node->capacity == RADIX_DENSE) {
+    return atomic_load(&children[byte]) != NULL ? &children[byte] : NULL;
+  }
+  size_t pos = first_pos(node, byte);
+  if (pos < node->num_children && node_keys(node)[pos] == byte) {
+    return &children[pos];
+  }
+  return NULL;
+}
+
+//copia um no com outra capacidade e outro prefixo, sem o filho skip (-1
+//para os copiar todos)
+static RadixNode *copy_node(RadixTree *tree, RadixNode *node, size_t capacity,
+                            const unsigned char *prefix, size_t prefix_len,
+                            int skip) {
+  RadixNode *copy = new_node(tree, capacity, prefix, prefix_len);
+  if (copy == NULL) {
+    return NULL;
+  }
+  size_t pos = 0;
+  unsigned char byte;
+  void *child;
+  while ((child = next_child(node, &pos, &byte)) != NULL) {
+    if (byte != skip) {
+      add_child(copy, byte, child);
+    }
+  }
+  return copy;
+}
+
+//num de bytes do prefixo do no iguais aos da chave
+static size_t prefix_match(RadixNode *node, const unsigned char *key) {
+  size_t i = 0;
+  //o prefixo nunca tem '\0', por isso nao passa do fim da chave
+  while (i < node->prefix_len && node->bytes[i] == key[i]) {
+    i++;
+  }
+  return i;
+}
+
+RadixTree *radix_create(atomic_size_t *mem_used) {
+  RadixTree *tree = malloc(sizeof(RadixTree));
+  if (tree == NULL) {
+    return NULL;
+  }
+  atomic_init(&tree->root, NULL);
+  pthread_mutex_init(&tree->lock, NULL);
+  tree->mem_used = mem_used;
+  return tree;
+}
+
+//insere o par na subarvore de ref, cujo prefixo acaba em depth; key e a
+//chave do par (com padding a zeros)
+static int insert_at(RadixTree *tree, _Atomic(void *) *ref,
+                     const unsigned char *key, size_t depth, KeyNode *par) {
+  void *node = atomic_load(ref);
+  if (node == NULL) {
+    atomic_store(ref, make_leaf(par));
+    return 0;
+  }
+  if (is_leaf(node)) {
+    //a folha passa a ser filha de um no novo com a parte comum das chaves
+    const unsigned char *other = (const unsigned char *)leaf_par(node)->key;
+    size_t lcp = 0;
+    while (key[depth + lcp] == other[depth + lcp] && key[depth + lcp] != '\0') {
+      lcp++;
+    }
+    if (key[depth + lcp] == other[depth + lcp]) {
+      atomic_store(ref, make_leaf(par)); //a mesma chave
+      return 0;
+    }
+    RadixNode *split = new_node(tree, 4, key + depth, lcp);
+    if (split == NULL) {
+      return 1;
+    }
+    add_child(split, key[depth + lcp], make_leaf(par));
+    add_child(split, other[depth + lcp], node);
+    atomic_store(ref, split);
+    return 0;
+  }
+
+  RadixNode *inner = node;
+  size_t match = prefix_match(inner, key + depth);
+  if (match < inner->prefix_len) {
+    //a chave sai do prefixo a meio: um no novo fica com a parte comum e o
+    //no antigo (copiado com o resto do prefixo) passa a filho dele
+    RadixNode *split = new_node(tree, 4, inner->bytes, match);
+    RadixNode *rest = copy_node(tree, inner, inner->capacity,
+                                inner->bytes + match + 1,
+                                inner->prefix_len - match - 1, -1);
+    if (split == NULL || rest == NULL) {
+      discard_node(tree, split);
+      discard_node(tree, rest);
+      return 1;
+    }
+    add_child(split, inner->bytes[match], rest);
+    add_child(split, key[depth + match], make_leaf(par));
+    atomic_store(ref, split);
+    retire_node(tree, inner);
+    return 0;
+  }
+
+  depth += inner->prefix_len;
+  unsigned char byte = key[depth];
+  _Atomic(void *) *child = find_child(inner, byte);
+  if (child != NULL) {
+    return insert_at(tree, child, key, depth + 1, par);
+  }
+  if (inner->capacity == RADIX_DENSE) {
+    //a posicao ja existe, os leitores veem-na vazia ou com a folha
+    atomic_store(&node_children(inner)[byte], make_leaf(par));
+    inner->num_children++;
+    return 0;
+  }
+  RadixNode *copy =
+      copy_node(tree, inner, capacity_for((size_t)inner->num_children + 1),
+                inner->bytes, inner->prefix_len, -1);
+  if (copy == NULL) {
+    return 1;
+  }
+  add_child(copy, byte, make_leaf(par));
+  atomic_store(ref, copy);
+  retire_node(tree, inner);
+  return 0;
+}
+
+int radix_insert(RadixTree *tree, KeyNode *par) {
+  pthread_mutex_lock(&tree->lock);
+  int result =
+      insert_at(tree, &tree->root, (const unsigned char *)par->key, 0, par);
+  pthread_mutex_unlock(&tree->lock);
+  return result;
+}
+
+//tira a folha com o byte do no apontado por ref
+static void remove_child(RadixTree *tree, _Atomic(void *) *ref,
+                         RadixNode *node, unsigned char byte) {
+  if (node->num_children == 2) {
+    //fica so um filho, que toma o lugar do no: o prefixo dele passa a ser
+    //o do no, o byte do filho e o seu proprio prefixo
+    size_t pos = 0;
+    unsigned char other_byte;
+    void *other;
+    do {
+      other = next_child(node, &pos, &other_byte);
+    } while (other != NULL && other_byte == byte);
+    if (other == NULL || is_leaf(other)) {
+      atomic_store(ref, other);
+      retire_node(tree, node);
+      return;
+    }
+    RadixNode *child = other;
+    unsigned char prefix[2 * KEY_SLOT_SIZE];
+    size_t len = node->prefix_len;
+    memcpy(prefix, node->bytes, len);
+    prefix[len++] = other_byte;
+    memcpy(prefix + len, child->bytes, child->prefix_len);
+    len += child->prefix_len;
+    RadixNode *merged = copy_node(tree, child, child->capacity, prefix, len, -1);
+    if (merged != NULL) {
+      atomic_store(ref, merged);
+      retire_node(tree, node);
+      retire_node(tree, child);
+      return;
+    }
+    //sem memoria fica um no com um so filho, que continua valido
+  }
+  if (node->capacity == RADIX_DENSE && node->num_children - 1 > RADIX_SHRINK) {
+    atomic_store(&node_children(node)[byte], NULL);
+    node->num_children--;
+    return;
+  }
+  RadixNode *copy =
+      copy_node(tree, node, capacity_for((size_t)node->num_children - 1),
+                node->bytes, node->prefix_len, byte);
+  if (copy == NULL) {
+    //sem memoria so esvazia a posicao; os filhos NULL sao ignorados
+    atomic_store(find_child(node, byte), NULL);
+    return;
+  }
+  atomic_store(ref, copy);
+  retire_node(tree, node);
+}
+
+//tira a chave da subarvore do no interior apontado por ref
+static void remove_at(RadixTree *tree, _Atomic(void *) *ref,
+                      const unsigned char *key, size_t depth) {
+  RadixNode *node = atomic_load(ref);
+  if (prefix_match(node, key + depth) < node->prefix_len) {
+    return;
+  }
+  depth += node->prefix_len;
+  unsigned char byte = key[depth];
+  _Atomic(void *) *slot = find_child(node, byte);
+  if (slot == NULL) {
+    return;
+  }
+  void *child = atomic_load(slot);
+  if (child == NULL) {
+    return;
+  }
+  if (!is_leaf(child)) {
+    if (byte != '\0') {
+      remove_at(tree, slot, key, depth + 1);
+    }
+    return;
+  }
+  if (strcmp(leaf_par(child)->key, (const char *)key) == 0) {
+    remove_child(tree, ref, node, byte);
+  }
+}
+
+void radix_remove(RadixTree *tree, const char *key) {
+  pthread_mutex_lock(&tree->lock);
+  void *root = atomic_load(&tree->root);
+  if (root != NULL && is_leaf(root)) {
+    if (strcmp(leaf_par(root)->key, key) == 0) {
+      atomic_store(&tree->root, NULL);
+    }
+  } else if (root != NULL) {
+    remove_at(tree, &tree->root, (const unsigned char *)key, 0);
+  }
+  pthread_mutex_unlock(&tree->lock);
+}
+
+//poe o no interior na pilha do cursor, com a posicao do filho seguinte
+static void cursor_push(RadixCursor *cursor, RadixNode *node, size_t pos) {
+  cursor->stack[cursor->depth].node = node;
+  cursor->stack[cursor->depth].pos = pos;
+  cursor->depth++;
+}
+
+//desce pelos primeiros filhos ate a menor folha da subarvore, pondo os nos
+//na pilha; NULL se a subarvore ficou vazia (nos sem filhos durante remocoes)
+static KeyNode *cursor_descend(RadixCursor *cursor, void *node) {
+  while (!is_leaf(node)) {
+    size_t pos = 0;
+    unsigned char byte;
+    void *child = next_child(node, &pos, &byte);
+    if (child == NULL) {
+      return NULL;
+    }
+    cursor_push(cursor, node, pos);
+    node = child;
+  }
+  return leaf_par(node);
+}
+
+KeyNode *radix_cursor_next(RadixCursor *cursor) {
+  while (cursor->depth > 0) {
+    RadixNode *node = cursor->stack[cursor->depth - 1].node;
+    unsigned char byte;
+    void *child = next_child(node, &cursor->stack[cursor->depth - 1].pos, &byte);
+    if (child == NULL) {
+      cursor->depth--;
+      continue;
+    }
+    KeyNode *par = cursor_descend(cursor, child);
+    if (par != NULL) {
+      return par;
+    }
+  }
+  return NULL;
+}
+
+//menor folha da subarvore, ou a seguinte na pilha se ela ficou vazia
+static KeyNode *cursor_first(RadixCursor *cursor, void *node) {
+  KeyNode *par = cursor_descend(cursor, node);
+  return par != NULL ? par : radix_cursor_next(cursor);
+}
+
+KeyNode *radix_cursor_seek(RadixCursor *cursor, RadixTree *tree,
+                           const char *from) {
+  const unsigned char *key = (const unsigned char *)from;
+  cursor->depth = 0;
+  void *node = atomic_load(&tree->root);
+  size_t depth = 0;
+  while (node != NULL && !is_leaf(node)) {
+    RadixNode *inner = node;
+    for (size_t i = 0; i < inner->prefix_len; i++) {
+      if (inner->bytes[i] != key[depth + i]) {
+        //a subarvore toda fica antes ou depois da chave
+        return inner->bytes[i] > key[depth + i] ? cursor_first(cursor, inner)
+                                                : radix_cursor_next(cursor);
+      }
+    }
+    depth += inner->prefix_len;
+    unsigned char byte = key[depth];
+    size_t pos = first_pos(inner, byte);
+    unsigned char child_byte;
+    void *child = next_child(inner, &pos, &child_byte);
+    if (child == NULL) {
+      return radix_cursor_next(cursor);
+    }
+    cursor_push(cursor, inner, pos);
+    if (child_byte != byte) {
+      //o primeiro filho depois do byte da chave: tudo nele vem depois
+      return cursor_first(cursor, child);
+    }
+    node = child;
+    depth++;
+  }
+  if (node != NULL && strcmp(leaf_par(node)->key, from) >= 0) {
+    return leaf_par(node);
+  }
+  return radix_cursor_next(cursor);
+}
+
+//liberta os nos de uma subarvore (as folhas sao dos pares)
+static void free_subtree(void *node) {
+  if (node == NULL || is_leaf(node)) {
+    return;
+  }
+  size_t pos = 0;
+  unsigned char byte;
+  void *child;
+  while ((child = next_child(node, &pos, &byte)) != NULL) {
+    free_subtree(child);
+  }
+  free(node);
+}
+
+void radix_destroy(RadixTree *tree) {
+  free_subtree(atomic_load(&tree->root));
+  pthread_mutex_destroy(&tree->lock);
+  free(tree);
+}
@@ -0,0 +1,84 @@
+#ifndef KVS_RADIX_H
+#define KVS_RADIX_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "src/common/constants.h"
+
+#define RADIX_MAX_DEPTH (MAX_STRING_SIZE + 1) // nos interiores num caminho (um por byte da chave)
+
+struct KeyNode;
+
+// Indice ordenado das chaves em arvore radix adaptativa (alternativa a
+// skiplist, escolhida no arranque). E so o indice do SCAN e do PREFIX: os
+// pares continuam na tabela de hash, cada um com a chave inteira.
+// Cada no guarda so o pedaco das chaves que os seus filhos tem em comum
+// (compressao de caminhos), por isso com prefixos longos em comum
+// (tenant:region:object:...) uma procura desce poucos nos. Os nos tem 4,
+// 16 ou 48 filhos por ordem ou 256 indexados pelo byte, e mudam de tamanho
+// com o num de filhos. As folhas sao os proprios pares.
+// Os leitores percorrem a arvore sem locks dentro de uma epoca (ver
+// epoch.h): um no publicado nunca muda, so os ponteiros para os filhos, e
+// cada alteracao poe uma copia no lugar do no e liberta o antigo por epocas.
+// Os escritores sao serializados pelo lock da arvore.
+typedef struct RadixTree {
+  _Atomic(void *) root; //raiz: um no, uma folha ou NULL
+  pthread_mutex_t lock; //serializa as insercoes e remocoes
+  atomic_size_t *mem_used; //onde e somada a memoria dos nos
+} RadixTree;
+
+// Travessia por ordem a partir de uma chave. Guarda a pilha dos nos
+// interiores desde a raiz, cada um com a posicao do filho seguinte, por isso
+// passar ao par seguinte so sobe ate ao primeiro no com mais filhos em vez
+// de descer outra vez desde a raiz. Os nos da pilha sao os que estavam na
+// arvore quando o cursor passou por eles: como um no publicado nunca muda
+// (so os filhos) e os que saem so sao libertados no fim da epoca, o cursor
+// continua valido com escritas ao mesmo tempo, mas pode nao ver as chaves
+// inseridas depois de passar.
+typedef struct RadixCursor {
+  struct {
+    void *node; //no interior
+    size_t pos; //posicao do filho seguinte
+  } stack[RADIX_MAX_DEPTH];
+  size_t depth; //nos na pilha
+} RadixCursor;
+
+/// @brief cria uma arvore vazia
+/// @param mem_used contador onde a memoria dos nos vai sendo somada
+/// @return a arvore, NULL se nao havia memoria
+RadixTree *radix_create(atomic_size_t *mem_used);
+
+/// @brief acrescenta um par a arvore (a chave ainda nao pode estar la)
+/// @param tree a arvore
+/// @param par o par, ja com a chave preenchida
+/// @return 0 se deu certo, 1 se nao havia memoria
+int radix_insert(RadixTree *tree, struct KeyNode *par);
+
+/// @brief tira a chave da arvore; os nos que saem sao libertados por epocas
+/// @param tree a arvore
+/// @param key a chave
+void radix_remove(RadixTree *tree, const char *key);
+
+/// @brief poe o cursor no primeiro par com chave >= from; o cursor e os
+/// pares so podem ser usados dentro da mesma epoca
+/// @param cursor o cursor
+/// @param tree a arvore
+/// @param from a chave inicial
+/// @return o par, NULL se nao ha nenhuma chave depois de from
+struct KeyNode *radix_cursor_seek(RadixCursor *cursor, RadixTree *tree,
+                                  const char *from);
+
+/// @brief passa ao par seguinte por ordem das chaves
+/// @param cursor o cursor, ja posto com radix_cursor_seek
+/// @return o par, NULL se ja nao ha mais
+struct KeyNode *radix_cursor_next(RadixCursor *cursor);
+
+/// @brief liberta a arvore e todos os nos (mas nao os pares); so pode ser
+/// chamada quando ja nenhuma thread usa a arvore
+/// @param tree a arvore
+void radix_destroy(RadixTree *tree);
+
+#endif // KVS_RADIX_H
@@ -0,0 +1,113 @@
+#include "reclaim.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "src/common/io.h"
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER; //ha trabalho ou stop
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER; //acabou um lote
+//fila dos trabalhos e contadores, todos protegidos pelo queue_lock
+static ReclaimJob *queue_head = NULL;
+static ReclaimJob *queue_tail = NULL;
+static size_t num_pushed = 0; //trabalhos postos na fila desde o inicio
+static size_t num_done = 0; //trabalhos feitos desde o inicio
+static bool running = false;
+static pthread_t reclaim_thread;
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+
+static void *reclaim_loop(void *arg) {
+  (void)arg;
+  //os sinais sao tratados pelas outras threads
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+  pthread_mutex_lock(&queue_lock);
+  while (1) {
+    while (queue_head == NULL && running) {
+      pthread_cond_wait(&queue_cond, &queue_lock);
+    }
+    if (queue_head == NULL) {
+      break; //a fila ficou vazia depois do reclaim_stop
+    }
+    //tira a fila toda de uma vez e faz os trabalhos sem o lock, para nao
+    //atrasar os deletes que estao a por mais
+    ReclaimJob *job = queue_head;
+    queue_head = queue_tail = NULL;
+    pthread_mutex_unlock(&queue_lock);
+    size_t n = 0;
+    while (job != NULL) {
+      ReclaimJob *next = job->next; //o run pode libertar o trabalho
+      job->run(job);
+      job = next;
+      n++;
+    }
+    pthread_mutex_lock(&queue_lock);
+    num_done += n;
+    pthread_cond_broadcast(&done_cond);
+  }
+  pthread_mutex_unlock(&queue_lock);
+  return NULL;
+}
+
+static void start_reclaimer(void) {
+  pthread_mutex_lock(&queue_lock);
+  running = true;
+  if (pthread_create(&reclaim_thread, NULL, reclaim_loop, NULL) != 0) {
+    //sem thread os deletes fazem o trabalho todo com a stripe bloqueada
+    write_str(STDERR_FILENO, "Failed to create reclaimer thread\n");
+    running = false;
+  }
+  pthread_mutex_unlock(&queue_lock);
+}
+
+int reclaim_push(ReclaimJob *job) {
+  pthread_once(&start_once, start_reclaimer);
+  job->next = NULL;
+  pthread_mutex_lock(&queue_lock);
+  if (!running) {
+    pthread_mutex_unlock(&queue_lock);
+    return 1;
+  }
+  if (queue_tail == NULL) {
+    queue_head = job;
+  } else {
+    queue_tail->next = job;
+  }
+  queue_tail = job;
+  num_pushed++;
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+  return 0;
+}
+
+void reclaim_sync(void) {
+  pthread_mutex_lock(&queue_lock);
+  size_t target = num_pushed;
+  while (num_done < target) {
+    pthread_cond_wait(&done_cond, &queue_lock);
+  }
+  pthread_mutex_unlock(&queue_lock);
+}
+
+void reclaim_stop(void) {
+  pthread_mutex_lock(&queue_lock);
+  bool was_running = running;
+  running = false;
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+  if (was_running) {
+    pthread_join(reclaim_thread, NULL);
+  }
+}
+
+void reclaim_get_stats(size_t *done, size_t *pending) {
+  pthread_mutex_lock(&queue_lock);
+  *done = num_done;
+  *pending = num_pushed - num_done;
+  pthread_mutex_unlock(&queue_lock);
+}
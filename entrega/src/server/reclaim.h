@@ -0,0 +1,37 @@
+#ifndef KVS_RECLAIM_H
+#define KVS_RECLAIM_H
+
+#include <stddef.h>
+
+// Thread de fundo (reclaimer) para o trabalho que sobra dos deletes.
+// Um delete so tira o par da tabela (ou lhe poe um tombstone) com a stripe
+// bloqueada; notificar os subscritores, tirar a subscricao a cada cliente e
+// libertar o par fica para esta thread, que corre os trabalhos pela ordem
+// em que foram postos na fila.
+
+//trabalho para o reclaimer; fica no inicio da estrutura de quem o poe na
+//fila, que o run recebe de volta
+typedef struct ReclaimJob {
+  struct ReclaimJob *next;
+  void (*run)(struct ReclaimJob *job); //corre na thread do reclaimer
+} ReclaimJob;
+
+/// @brief poe um trabalho na fila do reclaimer, pondo a thread a andar se
+/// for a primeira vez; nao espera que seja feito
+/// @param job o trabalho, com o run preenchido
+/// @return 0 se deu certo, 1 se nao ha reclaimer (o chamador faz o trabalho)
+int reclaim_push(ReclaimJob *job);
+
+/// @brief espera que todos os trabalhos postos na fila ate agora (por
+/// qualquer thread) tenham sido feitos
+void reclaim_sync(void);
+
+/// @brief faz os trabalhos que faltam e para a thread do reclaimer
+void reclaim_stop(void);
+
+/// @brief retorna as estatisticas do reclaimer
+/// @param done onde fica o num de trabalhos feitos
+/// @param pending onde fica o num de trabalhos ainda na fila
+void reclaim_get_stats(size_t *done, size_t *pending);
+
+#endif // KVS_RECLAIM_H
@@ -0,0 +1,301 @@
+#include "shard.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/common/io.h"
+
+#define SHARD_SLEEP_MS 10 // espera max de uma thread dona a dormir
+
+_Static_assert((SHARD_QUEUE_SIZE & (SHARD_QUEUE_SIZE - 1)) == 0,
+               "o tamanho das filas tem de ser potencia de 2");
+
+//fila SPSC de uma thread para um shard: so a thread que escreve muda o tail
+//e so a thread dona muda o head; o tail so avanca no fim de um lote
+typedef struct ShardQueue {
+  _Alignas(64) atomic_size_t head; //proxima escrita por aplicar
+  _Alignas(64) atomic_size_t tail; //fim do ultimo lote publicado
+  ShardWrite writes[SHARD_QUEUE_SIZE];
+} ShardQueue;
+
+//registo de uma thread que escreve
+typedef struct ShardProducer {
+  _Atomic(ShardQueue *) queues[MAX_SHARDS]; //criadas na primeira escrita
+  atomic_bool in_use; //false se a thread que o usava ja terminou
+  struct ShardProducer *next;
+} ShardProducer;
+
+//thread dona de um shard
+typedef struct Shard {
+  _Alignas(64) pthread_t thread;
+  size_t index;
+  atomic_bool sleeping; //true enquanto espera na cond
+  pthread_mutex_t lock; //protege a espera
+  pthread_cond_t wake;
+  atomic_size_t batches; //lotes aplicados
+  atomic_size_t writes; //escritas aplicadas
+} Shard;
+
+static Shard shards[MAX_SHARDS];
+static size_t num_shards = 0;
+static atomic_bool running = false;
+static void (*apply_writes)(size_t, ShardWrite *const[], size_t) = NULL;
+static _Atomic(ShardProducer *) producers_head = NULL; //todas as threads
+static _Thread_local ShardProducer *self = NULL; //registo desta thread
+static _Thread_local uint64_t pending = 0; //shards com escritas por aplicar
+static pthread_key_t self_key; //para largar o registo quando a thread acaba
+static pthread_once_t self_key_once = PTHREAD_ONCE_INIT;
+
+//destrutor da self_key: o registo pode ser reutilizado por outra thread (as
+//escritas que ainda estejam nas filas sao aplicadas na mesma)
+static void release_self(void *arg) {
+  ShardProducer *producer = arg;
+  atomic_store(&producer->in_use, false);
+}
+
+static void create_self_key(void) {
+  pthread_key_create(&self_key, release_self);
+}
+
+//retorna o registo desta thread, criando-o na primeira utilizacao
+static ShardProducer *get_self(void) {
+  if (self != NULL) {
+    return self;
+  }
+  pthread_once(&self_key_once, create_self_key);
+  for (ShardProducer *producer = atomic_load(&producers_head);
+       producer != NULL; producer = producer->next) {
+    bool livre = false;
+    if (atomic_compare_exchange_strong(&producer->in_use, &livre, true)) {
+      self = producer;
+      break;
+    }
+  }
+  if (self == NULL) {
+    ShardProducer *producer = calloc(1, sizeof(ShardProducer));
+    if (producer == NULL) {
+      write_str(STDERR_FILENO, "Failed to allocate shard producer\n");
+      exit(1);
+    }
+    atomic_init(&producer->in_use, true);
+    producer->next = atomic_load(&producers_head);
+    while (!atomic_compare_exchange_weak(&producers_head, &producer->next,
+                                         producer))
+      ;
+    self = producer;
+  }
+  pthread_setspecific(self_key, self);
+  return self;
+}
+
+//verifica se alguma fila do shard tem escritas por aplicar
+static bool has_work(size_t index) {
+  for (ShardProducer *producer = atomic_load(&producers_head);
+       producer != NULL; producer = producer->next) {
+    ShardQueue *queue = atomic_load(&producer->queues[index]);
+    if (queue != NULL &&
+        atomic_load(&queue->head) != atomic_load(&queue->tail)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//dorme ate uma escrita chegar (ou SHARD_SLEEP_MS, por seguranca)
+static void shard_sleep(Shard *shard) {
+  pthread_mutex_lock(&shard->lock);
+  //publica que vai dormir antes de ver as filas: quem escreve publica o tail
+  //antes de ver o sleeping, por isso um dos dois ve o outro
+  atomic_store(&shard->sleeping, true);
+  if (atomic_load(&running) && !has_work(shard->index)) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += SHARD_SLEEP_MS * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&shard->wake, &shard->lock, &until);
+  }
+  atomic_store(&shard->sleeping, false);
+  pthread_mutex_unlock(&shard->lock);
+}
+
+static void *shard_loop(void *arg) {
+  Shard *shard = arg;
+  //os sinais sao tratados pelas outras threads
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+  //cada fila contribui com lotes inteiros (ate ao tail), por isso o grupo
+  //pode passar SHARD_DRAIN_MAX no maximo uma fila
+  ShardWrite *batch[SHARD_DRAIN_MAX + SHARD_QUEUE_SIZE];
+  ShardQueue *drained[SHARD_DRAIN_QUEUES];
+  size_t tails[SHARD_DRAIN_QUEUES];
+  int idle = 0;
+  while (1) {
+    size_t n = 0;
+    size_t num_drained = 0;
+    for (ShardProducer *producer = atomic_load(&producers_head);
+         producer != NULL && n < SHARD_DRAIN_MAX &&
+         num_drained < SHARD_DRAIN_QUEUES;
+         producer = producer->next) {
+      ShardQueue *queue = atomic_load(&producer->queues[shard->index]);
+      if (queue == NULL) {
+        continue;
+      }
+      size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+      size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+      if (head == tail) {
+        continue;
+      }
+      for (; head != tail; head++) {
+        batch[n++] = &queue->writes[head & (SHARD_QUEUE_SIZE - 1)];
+      }
+      drained[num_drained] = queue;
+      tails[num_drained++] = tail;
+    }
+
+    if (n > 0) {
+      apply_writes(shard->index, batch, n);
+      //so agora as posicoes podem ser reutilizadas e o shard_sync acaba
+      for (size_t i = 0; i < num_drained; i++) {
+        atomic_store_explicit(&drained[i]->head, tails[i],
+                              memory_order_release);
+      }
+      atomic_fetch_add_explicit(&shard->batches, 1, memory_order_relaxed);
+      atomic_fetch_add_explicit(&shard->writes, n, memory_order_relaxed);
+      idle = 0;
+    } else if (!atomic_load(&running)) {
+      return NULL; //as filas ficaram vazias depois do shards_stop
+    } else if (++idle < SHARD_SPINS) {
+      sched_yield();
+    } else {
+      shard_sleep(shard);
+      idle = 0;
+    }
+  }
+}
+
+int shards_start(size_t n,
+                 void (*apply)(size_t shard, ShardWrite *const writes[],
+                               size_t n)) {
+  apply_writes = apply;
+  atomic_store(&running, true);
+  for (num_shards = 0; num_shards < n; num_shards++) {
+    Shard *shard = &shards[num_shards];
+    shard->index = num_shards;
+    atomic_init(&shard->sleeping, false);
+    atomic_init(&shard->batches, 0);
+    atomic_init(&shard->writes, 0);
+    pthread_mutex_init(&shard->lock, NULL);
+    pthread_cond_init(&shard->wake, NULL);
+    if (pthread_create(&shard->thread, NULL, shard_loop, shard) != 0) {
+      write_str(STDERR_FILENO, "Failed to create shard thread\n");
+      pthread_mutex_destroy(&shard->lock);
+      pthread_cond_destroy(&shard->wake);
+      shards_stop();
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int shard_push(size_t shard, size_t n, char keys[][MAX_STRING_SIZE],
+               char values[][MAX_STRING_SIZE], const uint64_t expires_at[]) {
+  ShardProducer *producer = get_self();
+  ShardQueue *queue = atomic_load(&producer->queues[shard]);
+  if (queue == NULL) {
+    queue = aligned_alloc(_Alignof(ShardQueue), sizeof(ShardQueue));
+    if (queue == NULL) {
+      return 1;
+    }
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_store(&producer->queues[shard], queue);
+  }
+
+  size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  //fila cheia: espera que a thread dona aplique o suficiente para o lote
+  for (int spin = 0;
+       tail + n - atomic_load_explicit(&queue->head, memory_order_acquire) >
+       SHARD_QUEUE_SIZE;
+       spin++) {
+    if (spin >= SHARD_SPINS) {
+      sched_yield();
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    ShardWrite *write = &queue->writes[(tail + i) & (SHARD_QUEUE_SIZE - 1)];
+    memcpy(write->key, keys[i], MAX_STRING_SIZE);
+    memcpy(write->value, values[i], MAX_STRING_SIZE);
+    write->expires_at = expires_at[i];
+  }
+  //publica o lote todo de uma vez e so depois ve se a thread dona dorme
+  atomic_store(&queue->tail, tail + n);
+  pending |= 1ULL << shard;
+  Shard *owner = &shards[shard];
+  if (atomic_load(&owner->sleeping)) {
+    pthread_mutex_lock(&owner->lock);
+    pthread_cond_signal(&owner->wake);
+    pthread_mutex_unlock(&owner->lock);
+  }
+  return 0;
+}
+
+void shard_sync(void) {
+  while (pending != 0) {
+    size_t shard = (size_t)__builtin_ctzll(pending);
+    ShardQueue *queue = atomic_load(&self->queues[shard]);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    for (int spin = 0;
+         atomic_load_explicit(&queue->head, memory_order_acquire) != tail;
+         spin++) {
+      if (spin >= SHARD_SPINS) {
+        sched_yield();
+      }
+    }
+    pending &= pending - 1;
+  }
+}
+
+void shards_stop(void) {
+  if (!atomic_exchange(&running, false)) {
+    return;
+  }
+  for (size_t i = 0; i < num_shards; i++) {
+    Shard *shard = &shards[i];
+    pthread_mutex_lock(&shard->lock);
+    pthread_cond_signal(&shard->wake);
+    pthread_mutex_unlock(&shard->lock);
+    pthread_join(shard->thread, NULL);
+    pthread_mutex_destroy(&shard->lock);
+    pthread_cond_destroy(&shard->wake);
+  }
+  num_shards = 0;
+  //os registos das threads ficam (como os das epocas), so as filas saem
+  for (ShardProducer *producer = atomic_load(&producers_head);
+       producer != NULL; producer = producer->next) {
+    for (size_t i = 0; i < MAX_SHARDS; i++) {
+      free(atomic_exchange(&producer->queues[i], NULL));
+    }
+  }
+  pending = 0;
+}
+
+void shard_get_stats(size_t *batches, size_t *writes) {
+  *batches = 0;
+  *writes = 0;
+  for (size_t i = 0; i < num_shards; i++) {
+    *batches += atomic_load(&shards[i].batches);
+    *writes += atomic_load(&shards[i].writes);
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef KVS_SHARD_H
+#define KVS_SHARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+
+#define MAX_SHARDS 64 // shards do modo particionado
+#define SHARD_QUEUE_SIZE MAX_WRITE_SIZE // escritas de uma fila (potencia de 2)
+#define SHARD_DRAIN_MAX 1024 // escritas tiradas das filas antes de as aplicar
+#define SHARD_DRAIN_QUEUES 64 // filas esvaziadas de cada vez
+#define SHARD_SPINS 1000 // voltas sem trabalho antes de a thread dona dormir
+
+// Threads donas dos shards (modo particionado).
+// Cada shard tem uma thread dona que aplica os WRITE com chaves so desse
+// shard. Cada thread que escreve tem uma fila SPSC sem locks para cada shard
+// e um lote fica visivel na fila todo de uma vez; a thread dona junta o que
+// tirou de todas as filas e aplica-o de uma vez (um so lock das stripes e um
+// so commit), por isso as escritas de varias threads nao disputam a tabela.
+// So os WRITE de um shard passam pelas donas: os READ, DELETE, SCAN e os
+// WRITE com chaves de varios shards correm na thread do comando, com os
+// locks das stripes, como com uma tabela so. Os shards continuam
+// partilhados, isto so tira as escritas do caminho dos outros comandos.
+
+//escrita numa fila
+typedef struct ShardWrite {
+  char key[MAX_STRING_SIZE];
+  char value[MAX_STRING_SIZE];
+  uint64_t expires_at; //prazo (timer_deadline), 0 se nao tem TTL
+} ShardWrite;
+
+/// @brief cria as threads donas dos shards
+/// @param n num de shards (ate MAX_SHARDS)
+/// @param apply funcao chamada pela thread dona com as escritas tiradas das
+/// filas de um shard, que tem de aplicar todas de forma atomica
+/// @return 0 se deu certo, 1 se deu errado
+int shards_start(size_t n,
+                 void (*apply)(size_t shard, ShardWrite *const writes[],
+                               size_t n));
+
+/// @brief poe um lote de escritas na fila desta thread para um shard, sem
+/// esperar que seja aplicado (espera so se a fila estiver cheia)
+/// @param shard o shard de todas as chaves
+/// @param n num de escritas (ate SHARD_QUEUE_SIZE)
+/// @param keys as chaves
+/// @param values os valores
+/// @param expires_at os prazos
+/// @return 0 se deu certo, 1 se nao havia memoria para a fila
+int shard_push(size_t shard, size_t n, char keys[][MAX_STRING_SIZE],
+               char values[][MAX_STRING_SIZE], const uint64_t expires_at[]);
+
+/// @brief espera que todas as escritas postas nas filas por esta thread
+/// tenham sido aplicadas e estejam visiveis
+void shard_sync(void);
+
+/// @brief aplica as escritas que faltam e para as threads donas
+void shards_stop(void);
+
+/// @brief retorna as estatisticas das threads donas
+/// @param batches onde fica o num de lotes aplicados
+/// @param writes onde fica o num de escritas aplicadas
+void shard_get_stats(size_t *batches, size_t *writes);
+
+#endif // KVS_SHARD_H
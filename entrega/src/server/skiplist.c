@@ -0,0 +1,127 @@
+#include "skiplist.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "epoch.h"
+#include "kvs.h"
+
+void skiplist_init(SkipList *sl) {
+  for (int i = 0; i < SKIPLIST_MAX_LEVEL; i++) {
+    atomic_init(&sl->head[i], NULL);
+  }
+  atomic_init(&sl->height, 1);
+  pthread_mutex_init(&sl->lock, NULL);
+}
+
+//altura de um no novo: cada nivel a mais com probabilidade 1/4
+static int random_height(void) {
+  static _Thread_local uint64_t state = 0;
+  if (state == 0) {
+    state = (uintptr_t)&state | 1; //semente diferente em cada thread
+  }
+  //xorshift64
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  int height = 1;
+  uint64_t bits = state;
+  while (height < SKIPLIST_MAX_LEVEL && (bits & 3) == 0) {
+    height++;
+    bits >>= 2;
+  }
+  return height;
+}
+
+//ligacao do nivel level a seguir a node (node NULL e a cabeca)
+static _Atomic(SkipNode *) *link_at(SkipList *sl, SkipNode *node, int level) {
+  return node == NULL ? &sl->head[level] : &node->next[level];
+}
+
+//guarda em preds o ultimo no com chave < key em cada nivel
+static void find_preds(SkipList *sl, const char *key,
+                       SkipNode *preds[SKIPLIST_MAX_LEVEL]) {
+  SkipNode *pred = NULL;
+  for (int level = SKIPLIST_MAX_LEVEL - 1; level >= 0; level--) {
+    SkipNode *next = atomic_load(link_at(sl, pred, level));
+    while (next != NULL && strcmp(next->par->key, key) < 0) {
+      pred = next;
+      next = atomic_load(&next->next[level]);
+    }
+    preds[level] = pred;
+  }
+}
+
+int skiplist_insert(SkipList *sl, KeyNode *par) {
+  int height = random_height();
+  SkipNode *node =
+      malloc(sizeof(SkipNode) + (size_t)height * sizeof(_Atomic(SkipNode *)));
+  if (node == NULL) {
+    return 1;
+  }
+  node->par = par;
+  node->height = height;
+
+  pthread_mutex_lock(&sl->lock);
+  SkipNode *preds[SKIPLIST_MAX_LEVEL];
+  find_preds(sl, par->key, preds);
+  for (int level = 0; level < height; level++) {
+    atomic_init(&node->next[level], atomic_load(link_at(sl, preds[level], level)));
+  }
+  //liga de baixo para cima: um leitor que encontre o no num nivel alto
+  //consegue sempre continuar a partir dele nos niveis de baixo
+  for (int level = 0; level < height; level++) {
+    atomic_store(link_at(sl, preds[level], level), node);
+  }
+  if (height > atomic_load(&sl->height)) {
+    atomic_store(&sl->height, height);
+  }
+  pthread_mutex_unlock(&sl->lock);
+  return 0;
+}
+
+void skiplist_remove(SkipList *sl, const char *key) {
+  pthread_mutex_lock(&sl->lock);
+  SkipNode *preds[SKIPLIST_MAX_LEVEL];
+  find_preds(sl, key, preds);
+  SkipNode *node = atomic_load(link_at(sl, preds[0], 0));
+  if (node == NULL || strcmp(node->par->key, key) != 0) {
+    pthread_mutex_unlock(&sl->lock);
+    return;
+  }
+  //desliga de cima para baixo; os next do no ficam iguais para os leitores
+  //que ainda estejam nele
+  for (int level = node->height - 1; level >= 0; level--) {
+    atomic_store(link_at(sl, preds[level], level),
+                 atomic_load(&node->next[level]));
+  }
+  pthread_mutex_unlock(&sl->lock);
+  epoch_retire(node, free);
+}
+
+SkipNode *skiplist_lower_bound(SkipList *sl, const char *from) {
+  SkipNode *pred = NULL;
+  SkipNode *next = NULL;
+  for (int level = atomic_load(&sl->height) - 1; level >= 0; level--) {
+    next = atomic_load(link_at(sl, pred, level));
+    while (next != NULL && strcmp(next->par->key, from) < 0) {
+      pred = next;
+      next = atomic_load(&next->next[level]);
+    }
+  }
+  return next;
+}
+
+void skiplist_destroy(SkipList *sl) {
+  SkipNode *node = atomic_load(&sl->head[0]);
+  while (node != NULL) {
+    SkipNode *next = atomic_load(&node->next[0]);
+    free(node);
+    node = next;
+  }
+  for (int i = 0; i < SKIPLIST_MAX_LEVEL; i++) {
+    atomic_store(&sl->head[i], NULL);
+  }
+  pthread_mutex_destroy(&sl->lock);
+}
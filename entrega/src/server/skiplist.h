@@ -0,0 +1,55 @@
+#ifndef KVS_SKIPLIST_H
+#define KVS_SKIPLIST_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define SKIPLIST_MAX_LEVEL 20 // chega para milhoes de chaves (p = 1/4)
+
+struct KeyNode;
+
+// Indice ordenado das chaves da tabela (skiplist).
+// Os leitores percorrem-no sem locks dentro de uma epoca (ver epoch.h); os
+// escritores sao serializados pelo lock do indice e os nos que saem sao
+// libertados por epocas, como os pares.
+typedef struct SkipNode {
+  struct KeyNode *par; //par da tabela com esta chave
+  int height; //num de niveis deste no
+  _Atomic(struct SkipNode *) next[]; //proximo no em cada nivel
+} SkipNode;
+
+typedef struct SkipList {
+  _Atomic(SkipNode *) head[SKIPLIST_MAX_LEVEL]; //primeiro no de cada nivel
+  atomic_int height; //num de niveis em uso
+  pthread_mutex_t lock; //serializa as insercoes e remocoes
+} SkipList;
+
+/// @brief inicializa um indice vazio
+/// @param sl o indice
+void skiplist_init(SkipList *sl);
+
+/// @brief acrescenta um par ao indice (a chave ainda nao pode estar la)
+/// @param sl o indice
+/// @param par o par, ja com a chave preenchida
+/// @return 0 se deu certo, 1 se nao havia memoria
+int skiplist_insert(SkipList *sl, struct KeyNode *par);
+
+/// @brief tira a chave do indice; o no e libertado por epocas
+/// @param sl o indice
+/// @param key a chave
+void skiplist_remove(SkipList *sl, const char *key);
+
+/// @brief primeiro no com chave >= from; tem de ser chamada dentro de uma
+/// epoca, e a lista segue-se por next[0]
+/// @param sl o indice
+/// @param from a chave inicial
+/// @return o no, NULL se nao ha nenhuma chave >= from
+SkipNode *skiplist_lower_bound(SkipList *sl, const char *from);
+
+/// @brief liberta todos os nos (mas nao os pares); so pode ser chamada
+/// quando ja nenhuma thread usa o indice
+/// @param sl o indice
+void skiplist_destroy(SkipList *sl);
+
+#endif // KVS_SKIPLIST_H
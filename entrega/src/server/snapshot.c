@@ -0,0 +1,69 @@
+#include "snapshot.h"
+
+#include <stdbool.h>
+
+#include "thread_registry.h"
+
+#define SNAPSHOT_NONE UINT64_MAX // a thread nao tem nenhum snapshot aberto
+
+//registo de uma thread
+typedef struct ThreadSnapshot {
+  _Alignas(64) ThreadRecord record; //tem de ser o primeiro membro
+  atomic_uint_fast64_t snapshot; //SNAPSHOT_NONE fora de um snapshot
+} ThreadSnapshot;
+
+//um registo novo comeca sem snapshot aberto
+static void init_self(ThreadRecord *record) {
+  atomic_init(&((ThreadSnapshot *)record)->snapshot, SNAPSHOT_NONE);
+}
+
+//quando uma thread acaba o registo pode ser reutilizado por outra thread
+static void release_self(ThreadRecord *record) {
+  atomic_store(&((ThreadSnapshot *)record)->snapshot, SNAPSHOT_NONE);
+}
+
+static ThreadRegistry registry = THREAD_REGISTRY_INIT(
+    ThreadSnapshot, init_self, release_self,
+    "Failed to allocate snapshot record\n");
+static _Thread_local ThreadSnapshot *self = NULL; //registo desta thread
+
+//retorna o registo desta thread, criando-o na primeira utilizacao
+static ThreadSnapshot *get_self(void) {
+  if (self == NULL) {
+    self = (ThreadSnapshot *)thread_registry_acquire(&registry);
+  }
+  return self;
+}
+
+uint64_t snapshot_begin(atomic_uint_fast64_t *visible) {
+  ThreadSnapshot *ts = get_self();
+  uint64_t snapshot = atomic_load(visible);
+  //publica o snapshot e confirma que o commit visivel nao mudou entretanto:
+  //um escritor que nao veja o registo leu o commit visivel antes, por isso
+  //o horizonte que calcula nunca passa deste snapshot
+  while (1) {
+    atomic_store(&ts->snapshot, snapshot);
+    uint64_t now = atomic_load(visible);
+    if (now == snapshot) {
+      return snapshot;
+    }
+    snapshot = now;
+  }
+}
+
+void snapshot_end(void) {
+  atomic_store(&self->snapshot, SNAPSHOT_NONE);
+}
+
+uint64_t snapshot_oldest(atomic_uint_fast64_t *visible) {
+  //o commit visivel e lido antes dos registos (ver snapshot_begin)
+  uint64_t oldest = atomic_load(visible);
+  for (ThreadRecord *record = thread_registry_first(&registry);
+       record != NULL; record = record->next) {
+    uint64_t snapshot = atomic_load(&((ThreadSnapshot *)record)->snapshot);
+    if (snapshot < oldest) {
+      oldest = snapshot;
+    }
+  }
+  return oldest;
+}
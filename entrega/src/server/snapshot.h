@@ -0,0 +1,29 @@
+#ifndef KVS_SNAPSHOT_H
+#define KVS_SNAPSHOT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Snapshots das leituras (MVCC).
+// Cada escrita na tabela tem um num de commit e os commits ficam visiveis
+// por ordem; um leitor guarda o ultimo commit visivel quando comeca e le so
+// as versoes com commits ate esse. Cada thread regista o snapshot que tem
+// aberto, para os escritores saberem que versoes antigas ainda podem ser
+// lidas.
+
+/// @brief abre um snapshot desta thread (nao podem ser encadeados)
+/// @param visible ultimo commit visivel da tabela
+/// @return o snapshot: as versoes com commit <= a este sao as que se leem
+uint64_t snapshot_begin(atomic_uint_fast64_t *visible);
+
+/// @brief fecha o snapshot aberto com snapshot_begin
+void snapshot_end(void);
+
+/// @brief retorna o snapshot mais antigo ainda aberto; as versoes mais
+/// antigas do que a ultima com commit <= a este ja nao podem ser lidas
+/// @param visible ultimo commit visivel da tabela
+/// @return o snapshot mais antigo, ou o ultimo commit visivel se nao ha
+/// nenhum aberto
+uint64_t snapshot_oldest(atomic_uint_fast64_t *visible);
+
+#endif // KVS_SNAPSHOT_H
@@ -0,0 +1,66 @@
+#include "thread_registry.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "src/common/io.h"
+
+//destrutor da key: chama o release do modulo e deixa o registo ser
+//reutilizado por outra thread
+static void release_record(void *arg) {
+  ThreadRecord *record = arg;
+  if (record->registry->release != NULL) {
+    record->registry->release(record);
+  }
+  atomic_store(&record->in_use, false);
+}
+
+//cria a key na primeira utilizacao (pthread_once nao recebe argumentos)
+static void create_key(ThreadRegistry *registry) {
+  if (atomic_load_explicit(&registry->key_ready, memory_order_acquire)) {
+    return;
+  }
+  pthread_mutex_lock(&registry->key_lock);
+  if (!atomic_load(&registry->key_ready)) {
+    pthread_key_create(&registry->key, release_record);
+    atomic_store_explicit(&registry->key_ready, true, memory_order_release);
+  }
+  pthread_mutex_unlock(&registry->key_lock);
+}
+
+ThreadRecord *thread_registry_acquire(ThreadRegistry *registry) {
+  create_key(registry);
+  ThreadRecord *self = NULL;
+  //tenta reutilizar o registo de uma thread que ja terminou
+  for (ThreadRecord *record = atomic_load(&registry->head); record != NULL;
+       record = record->next) {
+    bool livre = false;
+    if (atomic_compare_exchange_strong(&record->in_use, &livre, true)) {
+      self = record;
+      break;
+    }
+  }
+  if (self == NULL) {
+    self = aligned_alloc(registry->align, registry->size);
+    if (self == NULL) {
+      write_str(STDERR_FILENO, registry->error);
+      exit(1);
+    }
+    memset(self, 0, registry->size);
+    atomic_init(&self->in_use, true);
+    self->registry = registry;
+    if (registry->init != NULL) {
+      registry->init(self);
+    }
+    self->next = atomic_load(&registry->head);
+    while (!atomic_compare_exchange_weak(&registry->head, &self->next, self))
+      ;
+  }
+  pthread_setspecific(registry->key, self);
+  return self;
+}
+
+ThreadRecord *thread_registry_first(ThreadRegistry *registry) {
+  return atomic_load(&registry->head);
+}
@@ -0,0 +1,60 @@
+#ifndef KVS_THREAD_REGISTRY_H
+#define KVS_THREAD_REGISTRY_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Registos por thread (das epocas, dos snapshots e das pools).
+// Cada thread tem o seu registo, numa lista que so cresce, para quem precisa
+// de ver todas as threads (o avanco das epocas, o snapshot mais antigo, as
+// estatisticas das pools). Quando uma thread acaba o registo e largado e
+// reutilizado pela proxima thread que precisar de um, por isso com threads
+// de curta duracao a lista nao cresce sem limite.
+
+//cabecalho que tem de ser o primeiro membro de cada registo
+typedef struct ThreadRecord {
+  atomic_bool in_use; //false se a thread que o usava ja terminou
+  struct ThreadRecord *next; //proximo registo da lista
+  struct ThreadRegistry *registry; //para o destrutor saber o release
+} ThreadRecord;
+
+//lista dos registos de um modulo
+typedef struct ThreadRegistry {
+  size_t size; //tamanho de cada registo
+  size_t align; //alinhamento de cada registo
+  //prepara um registo novo (ja a zeros) antes de entrar na lista
+  void (*init)(ThreadRecord *record);
+  //chamada quando a thread acaba, antes de o registo ser largado
+  void (*release)(ThreadRecord *record);
+  const char *error; //mensagem se nao houver memoria para um registo
+  _Atomic(ThreadRecord *) head; //todos os registos, livres ou nao
+  pthread_key_t key; //para largar o registo quando a thread acaba
+  atomic_bool key_ready;
+  pthread_mutex_t key_lock; //protege a criacao da key
+} ThreadRegistry;
+
+//inicializador de um ThreadRegistry para registos do tipo type
+#define THREAD_REGISTRY_INIT(type, init_fn, release_fn, error_msg)             \
+  {                                                                            \
+    .size = sizeof(type), .align = _Alignof(type), .init = (init_fn),          \
+    .release = (release_fn), .error = (error_msg), .head = NULL,               \
+    .key_ready = false, .key_lock = PTHREAD_MUTEX_INITIALIZER                  \
+  }
+
+/// @brief retorna um registo para a thread que chama: reutiliza o de uma
+/// thread que ja terminou ou aloca um novo (a zeros e passado ao init);
+/// termina o servidor se nao houver memoria. o chamador guarda-o numa
+/// variavel _Thread_local, pois cada chamada da um registo diferente
+/// @param registry a lista dos registos
+/// @return o registo, com o ThreadRecord no inicio
+ThreadRecord *thread_registry_acquire(ThreadRegistry *registry);
+
+/// @brief retorna o primeiro registo da lista (livre ou nao), para percorrer
+/// os registos de todas as threads com next
+/// @param registry a lista dos registos
+/// @return o primeiro registo, NULL se ainda nao ha nenhum
+ThreadRecord *thread_registry_first(ThreadRegistry *registry);
+
+#endif // KVS_THREAD_REGISTRY_H
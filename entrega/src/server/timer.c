@@ -0,0 +1,193 @@
+#include "timer.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "src/common/io.h"
+
+#define TIMER_SLOT_BITS 6 // log2(TIMER_SLOTS)
+
+//chave a expirar
+typedef struct TimerEntry {
+  struct TimerEntry *next;
+  uint64_t tick; //tick em que expira
+  char key[MAX_STRING_SIZE];
+} TimerEntry;
+
+static pthread_mutex_t wheel_lock = PTHREAD_MUTEX_INITIALIZER;
+static TimerEntry *wheel[TIMER_LEVELS][TIMER_SLOTS];
+static uint64_t current_tick; //ultimo tick ja processado
+static atomic_uint_fast64_t coarse_now = 0;
+static atomic_bool running = false;
+static pthread_t wheel_thread;
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+static Pool entries_pool;
+static void (*expire_handler)(char keys[][MAX_STRING_SIZE], size_t n) = NULL;
+
+static uint64_t monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+void timer_set_handler(void (*expire)(char keys[][MAX_STRING_SIZE], size_t n)) {
+  expire_handler = expire;
+}
+
+uint64_t timer_now(void) {
+  return atomic_load_explicit(&coarse_now, memory_order_relaxed);
+}
+
+//poe a entrada no nivel certo para o seu tick (com wheel_lock); uma entrada
+//com o tick atual so pode vir de um cascade, que e feito antes de se
+//recolher a posicao atual do nivel 0
+static void place(TimerEntry *entry) {
+  uint64_t delta = entry->tick - current_tick;
+  int level = 0;
+  while (level < TIMER_LEVELS - 1 &&
+         delta >= (1ULL << (TIMER_SLOT_BITS * (level + 1)))) {
+    level++;
+  }
+  uint64_t tick = entry->tick;
+  uint64_t max_delta = 1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS);
+  if (tick - current_tick >= max_delta) {
+    //mais longe do que a roda alcanca: fica na ultima posicao e volta a ser
+    //colocada quando la chegar
+    tick = current_tick + max_delta - 1;
+  }
+  size_t slot = (tick >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+  entry->next = wheel[level][slot];
+  wheel[level][slot] = entry;
+}
+
+//desce as entradas da posicao atual do nivel level para os niveis de baixo
+//retorna o indice da posicao
+static size_t cascade(int level) {
+  size_t slot =
+      (current_tick >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+  TimerEntry *entry = wheel[level][slot];
+  wheel[level][slot] = NULL;
+  while (entry != NULL) {
+    TimerEntry *next = entry->next;
+    place(entry);
+    entry = next;
+  }
+  return slot;
+}
+
+//avanca um tick e junta a due as entradas que expiram nele (com wheel_lock)
+static void advance(TimerEntry **due) {
+  current_tick++;
+  size_t slot = current_tick & (TIMER_SLOTS - 1);
+  //o nivel 0 deu a volta: desce o nivel 1, e se esse tambem deu a volta o 2...
+  for (int level = 1; slot == 0 && level < TIMER_LEVELS; level++) {
+    slot = cascade(level);
+  }
+  slot = current_tick & (TIMER_SLOTS - 1);
+  TimerEntry *entry = wheel[0][slot];
+  wheel[0][slot] = NULL;
+  while (entry != NULL) {
+    TimerEntry *next = entry->next;
+    if (entry->tick <= current_tick) {
+      entry->next = *due;
+      *due = entry;
+    } else {
+      place(entry); //veio da ultima posicao, ainda falta
+    }
+    entry = next;
+  }
+}
+
+//entrega as chaves expiradas ao handler em lotes e liberta as entradas
+static void expire_entries(TimerEntry *due) {
+  char keys[TIMER_BATCH][MAX_STRING_SIZE];
+  size_t n = 0;
+  while (due != NULL) {
+    TimerEntry *next = due->next;
+    memcpy(keys[n++], due->key, MAX_STRING_SIZE);
+    pool_free(&entries_pool, due);
+    if (n == TIMER_BATCH || next == NULL) {
+      if (expire_handler != NULL) {
+        expire_handler(keys, n);
+      }
+      n = 0;
+    }
+    due = next;
+  }
+}
+
+static void *wheel_loop(void *arg) {
+  (void)arg;
+  //os sinais sao tratados pelas outras threads
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+  struct timespec tick = {0, TIMER_TICK_MS * 1000000};
+  while (atomic_load(&running)) {
+    nanosleep(&tick, NULL);
+    uint64_t now = monotonic_ms();
+    atomic_store_explicit(&coarse_now, now, memory_order_relaxed);
+    TimerEntry *due = NULL;
+    pthread_mutex_lock(&wheel_lock);
+    while ((current_tick + 1) * TIMER_TICK_MS <= now) {
+      advance(&due);
+    }
+    pthread_mutex_unlock(&wheel_lock);
+    //os pares sao apagados sem a roda bloqueada, para nao atrasar os WRITE
+    expire_entries(due);
+  }
+  return NULL;
+}
+
+static void start_wheel(void) {
+  pool_init(&entries_pool, "timers", sizeof(TimerEntry));
+  uint64_t now = monotonic_ms();
+  current_tick = now / TIMER_TICK_MS;
+  atomic_store(&coarse_now, now);
+  atomic_store(&running, true);
+  if (pthread_create(&wheel_thread, NULL, wheel_loop, NULL) != 0) {
+    //sem thread as chaves so expiram para as procuras, nao sao apagadas
+    write_str(STDERR_FILENO, "Failed to create timer thread\n");
+    atomic_store(&running, false);
+  }
+}
+
+uint64_t timer_deadline(unsigned int ttl_ms) {
+  pthread_once(&start_once, start_wheel);
+  return timer_now() + ttl_ms;
+}
+
+int timer_add(const char *key, uint64_t deadline) {
+  TimerEntry *entry = pool_alloc(&entries_pool);
+  if (entry == NULL) {
+    return 1;
+  }
+  strncpy(entry->key, key, MAX_STRING_SIZE - 1);
+  entry->key[MAX_STRING_SIZE - 1] = '\0';
+  //arredonda para cima, para a chave nunca ser apagada antes do prazo
+  entry->tick = (deadline + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+  pthread_mutex_lock(&wheel_lock);
+  if (entry->tick <= current_tick) {
+    entry->tick = current_tick + 1; //esse tick ja foi processado
+  }
+  place(entry);
+  pthread_mutex_unlock(&wheel_lock);
+  return 0;
+}
+
+void timer_stop(void) {
+  if (!atomic_exchange(&running, false)) {
+    return;
+  }
+  pthread_join(wheel_thread, NULL);
+  //as entradas que faltavam estao nos slabs da pool
+  memset(wheel, 0, sizeof(wheel));
+  pool_destroy(&entries_pool);
+}
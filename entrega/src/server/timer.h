@@ -0,0 +1,45 @@
+#ifndef KVS_TIMER_H
+#define KVS_TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+
+#define TIMER_TICK_MS 10 // resolucao das expiracoes
+#define TIMER_LEVELS 4 // niveis da roda (64^4 ticks, cerca de 46 horas)
+#define TIMER_SLOTS 64 // posicoes de cada nivel
+#define TIMER_BATCH 64 // chaves expiradas entregues de uma vez ao handler
+
+// Roda de temporizadores hierarquica para as chaves com TTL.
+// Cada nivel tem TIMER_SLOTS posicoes e cada posicao de um nivel cobre uma
+// volta inteira do nivel de baixo; quando o nivel de baixo da a volta, as
+// entradas da posicao seguinte do nivel de cima descem (cascade). Uma thread
+// de fundo avanca a roda a cada TIMER_TICK_MS e mantem o relogio grosseiro
+// usado para ver se um par ja expirou.
+
+/// @brief define a funcao chamada (pela thread da roda) com cada lote de
+/// chaves cujo prazo passou; tem de voltar a confirmar a expiracao, pois a
+/// chave pode ter sido reescrita entretanto
+/// @param expire a funcao
+void timer_set_handler(void (*expire)(char keys[][MAX_STRING_SIZE], size_t n));
+
+/// @brief relogio grosseiro (ms, monotono), atualizado a cada tick
+/// @return o instante atual, 0 se ainda nenhuma chave teve TTL
+uint64_t timer_now(void);
+
+/// @brief calcula o prazo de um TTL, pondo a roda a andar se for a primeira vez
+/// @param ttl_ms o TTL em milissegundos
+/// @return o instante em que a chave expira
+uint64_t timer_deadline(unsigned int ttl_ms);
+
+/// @brief agenda a expiracao de uma chave
+/// @param key a chave
+/// @param deadline instante retornado por timer_deadline
+/// @return 0 se deu certo, 1 se nao havia memoria
+int timer_add(const char *key, uint64_t deadline);
+
+/// @brief para a thread da roda e liberta as entradas que faltavam
+void timer_stop(void);
+
+#endif // KVS_TIMER_H